@@ -5,12 +5,16 @@
 #include "audio_codec.h"
 #include "mqtt_protocol.h"
 #include "websocket_protocol.h"
+#include "audio_packet_pool.h"
 #include "assets/lang_config.h"
 #include "mcp_server.h"
 #include "assets.h"
 #include "settings.h"
+#include "loop_profiler.h"
+#include "boot_graph.h"
 
 #include <cstring>
+#include <algorithm>
 #include <esp_log.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
@@ -19,6 +23,13 @@
 
 #define TAG "Application"
 
+// The WeChat style keeps every message on screen, so only the single label style may drop stale ones
+#if CONFIG_USE_WECHAT_MESSAGE_STYLE
+#define CHAT_MESSAGE_KEY(key) kMainTaskKeyNone
+#else
+#define CHAT_MESSAGE_KEY(key) (key)
+#endif
+
 
 static const char* const STATE_STRINGS[] = {
     "unknown",
@@ -69,7 +80,8 @@ Application::~Application() {
     vEventGroupDelete(event_group_);
 }
 
-void Application::CheckAssetsVersion() {
+// Applies the assets in flash unless new ones have to be downloaded first, needs no network
+void Application::LoadAssets() {
     auto& board = Board::GetInstance();
     auto display = board.GetDisplay();
     auto assets = board.GetAssets();
@@ -92,34 +104,52 @@ void Application::CheckAssetsVersion() {
     if (download_url.empty() && !assets->checksum_valid()) {
         download_url = assets->default_assets_url();
     }
-
     if (!download_url.empty()) {
-        char message[256];
-        snprintf(message, sizeof(message), Lang::Strings::FOUND_NEW_ASSETS, download_url.c_str());
-        Alert(Lang::Strings::LOADING_ASSETS, message, "cloud_arrow_down", Lang::Sounds::OGG_UPGRADE);
-        
-        // Wait for the audio service to be idle for 3 seconds
-        vTaskDelay(pdMS_TO_TICKS(3000));
-        SetDeviceState(kDeviceStateUpgrading);
-        board.SetPowerSaveMode(false);
-        display->SetChatMessage("system", Lang::Strings::PLEASE_WAIT);
-
-        bool success = assets->Download(download_url, [display](int progress, size_t speed) -> void {
-            std::thread([display, progress, speed]() {
-                char buffer[32];
-                snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
-                display->SetChatMessage("system", buffer);
-            }).detach();
-        });
+        // Applied by CheckAssetsVersion() once the network is up
+        assets_download_url_ = download_url;
+        return;
+    }
 
-        board.SetPowerSaveMode(true);
-        vTaskDelay(pdMS_TO_TICKS(1000));
+    // Apply assets
+    assets->Apply();
+    display->SetChatMessage("system", "");
+    display->SetEmotion("microchip_ai");
+}
 
-        if (!success) {
-            Alert(Lang::Strings::ERROR, Lang::Strings::DOWNLOAD_ASSETS_FAILED, "circle_xmark", Lang::Sounds::OGG_EXCLAMATION);
-            vTaskDelay(pdMS_TO_TICKS(2000));
-            return;
-        }
+void Application::CheckAssetsVersion() {
+    if (assets_download_url_.empty()) {
+        return;
+    }
+    auto& board = Board::GetInstance();
+    auto display = board.GetDisplay();
+    auto assets = board.GetAssets();
+    const std::string& download_url = assets_download_url_;
+
+    char message[256];
+    snprintf(message, sizeof(message), Lang::Strings::FOUND_NEW_ASSETS, download_url.c_str());
+    Alert(Lang::Strings::LOADING_ASSETS, message, "cloud_arrow_down", Lang::Sounds::OGG_UPGRADE);
+    
+    // Wait for the audio service to be idle for 3 seconds
+    vTaskDelay(pdMS_TO_TICKS(3000));
+    SetDeviceState(kDeviceStateUpgrading);
+    board.SetPowerSaveMode(false);
+    display->SetChatMessage("system", Lang::Strings::PLEASE_WAIT);
+
+    bool success = assets->Download(download_url, [display](int progress, size_t speed) -> void {
+        std::thread([display, progress, speed]() {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "%d%% %uKB/s", progress, speed / 1024);
+            display->SetChatMessage("system", buffer);
+        }).detach();
+    });
+
+    board.SetPowerSaveMode(true);
+    vTaskDelay(pdMS_TO_TICKS(1000));
+
+    if (!success) {
+        Alert(Lang::Strings::ERROR, Lang::Strings::DOWNLOAD_ASSETS_FAILED, "circle_xmark", Lang::Sounds::OGG_EXCLAMATION);
+        vTaskDelay(pdMS_TO_TICKS(2000));
+        return;
     }
 
     // Apply assets
@@ -274,21 +304,29 @@ void Application::ToggleChatState() {
 
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
+            ConnectAudioChannel([this]() {
+                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            });
+        });
+    } else if (device_state_ == kDeviceStateConnecting) {
+        Schedule([this]() {
+            if (device_state_ == kDeviceStateConnecting) {
+                protocol_->CancelOpenAudioChannel();
+                SetDeviceState(kDeviceStateIdle);
             }
-
-            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
+            if (AbandonSessionResume()) {
+                return;
+            }
             AbortSpeaking(kAbortReasonNone);
         });
     } else if (device_state_ == kDeviceStateListening) {
         Schedule([this]() {
+            if (AbandonSessionResume()) {
+                return;
+            }
             protocol_->CloseAudioChannel();
         });
     }
@@ -311,17 +349,15 @@ void Application::StartListening() {
     
     if (device_state_ == kDeviceStateIdle) {
         Schedule([this]() {
-            if (!protocol_->IsAudioChannelOpened()) {
-                SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
-                    return;
-                }
-            }
-
-            SetListeningMode(kListeningModeManualStop);
+            ConnectAudioChannel([this]() {
+                SetListeningMode(kListeningModeManualStop);
+            });
         });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
+            if (AbandonSessionResume()) {
+                return;
+            }
             AbortSpeaking(kAbortReasonNone);
             SetListeningMode(kListeningModeManualStop);
         });
@@ -335,7 +371,8 @@ void Application::StopListening() {
         return;
     }
 
-    const std::array<int, 3> valid_states = {
+    const std::array<int, 4> valid_states = {
+        kDeviceStateConnecting,
         kDeviceStateListening,
         kDeviceStateSpeaking,
         kDeviceStateIdle,
@@ -346,9 +383,25 @@ void Application::StopListening() {
     }
 
     Schedule([this]() {
+        if (AbandonSessionResume()) {
+            return;
+        }
         if (device_state_ == kDeviceStateListening) {
             protocol_->SendStopListening();
             SetDeviceState(kDeviceStateIdle);
+        } else if (device_state_ == kDeviceStateConnecting) {
+            // Released before the channel is up, send what was captured and stop right away
+            auto on_opened = std::move(on_channel_opened_);
+            on_channel_opened_ = [this, on_opened]() {
+                if (on_opened) {
+                    on_opened();
+                }
+                while (auto packet = audio_service_.PopPacketFromSendQueue()) {
+                    protocol_->sender().PushAudio(std::move(packet));
+                }
+                protocol_->SendStopListening();
+                SetDeviceState(kDeviceStateIdle);
+            };
         }
     });
 }
@@ -389,27 +442,146 @@ void Application::Start() {
     /* Start the clock timer to update the status bar */
     esp_timer_start_periodic(clock_timer_handle_, 1000000);
 
-    /* Wait for the network to be ready */
-    board.StartNetwork();
+    // Steps that wait for the network overlap with the ones that do not
+    Ota ota;
+    bool protocol_started = false;
+    BootGraph boot;
+    boot.Add("network", {}, [&board, display]() {
+        board.StartNetwork();
+        // Update the status bar immediately to show the network state
+        display->UpdateStatusBar(true);
+    }, true);
+    boot.Add("assets", {}, [this]() {
+        LoadAssets();
+    });
+    boot.Add("wake_word", {"assets"}, [this]() {
+        // New assets may bring another model, it is loaded on first use after the download
+        if (assets_download_url_.empty()) {
+            audio_service_.PrepareWakeWord();
+        }
+    });
+    boot.Add("mcp_tools", {}, []() {
+        // Add MCP common tools before initializing the protocol
+        auto& mcp_server = McpServer::GetInstance();
+        mcp_server.AddCommonTools();
+        mcp_server.AddUserOnlyTools();
+        mcp_server.BuildToolsListCache();
+    });
+    boot.Add("assets_download", {"network", "assets"}, [this]() {
+        CheckAssetsVersion();
+    }, true);
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    // With the config of the last check the protocol starts right away, the check runs after boot
+    bool ota_cached = ota.LoadCachedConfig();
+#else
+    bool ota_cached = false;
+#endif
+    // Check for new firmware version or get the MQTT broker address
+    boot.Add("ota", {"assets_download"}, [this, &ota, ota_cached]() {
+        if (!ota_cached) {
+            CheckNewVersion(ota);
+        }
+    }, true);
+    boot.Add("protocol", {"ota", "mcp_tools"}, [this, &ota, &protocol_started]() {
+        protocol_started = StartProtocol(ota);
+    }, true);
+    boot.Run();
 
-    // Update the status bar immediately to show the network state
-    display->UpdateStatusBar(true);
+    SystemInfo::PrintHeapStats();
+    SetDeviceState(kDeviceStateIdle);
+#if CONFIG_USE_NETWORK_FAILOVER
+    // The clock tick checks the link from now on, during boot the network is still coming up
+    failover_enabled_ = protocol_ != nullptr;
+#endif
 
-    // Check for new assets version
-    CheckAssetsVersion();
+    has_server_time_ = ota.HasServerTime();
+    if (protocol_started) {
+        std::string message = std::string(Lang::Strings::VERSION) + ota.GetCurrentVersion();
+        display->ShowNotification(message.c_str());
+        display->SetChatMessage("system", "");
+        // Play the success sound to indicate the device is ready
+        audio_service_.PlaySound(Lang::Sounds::OGG_SUCCESS);
+    }
 
-    // Check for new firmware version or get the MQTT broker address
-    Ota ota;
-    CheckNewVersion(ota);
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    if (ota_cached) {
+        xTaskCreate([](void* arg) {
+            auto app = (Application*)arg;
+            app->RefreshOtaConfig();
+            app->check_new_version_task_handle_ = nullptr;
+            vTaskDelete(NULL);
+        }, "check_new_version", 4096 * 2, this, 2, &check_new_version_task_handle_);
+    }
+#endif
+}
+
+#if CONFIG_USE_CACHED_OTA_CONFIG
+// Runs the version check that a boot with the cached config skipped, in its own task
+void Application::RefreshOtaConfig() {
+    auto ota = std::make_unique<Ota>();
+    // The protocol is running on the cached settings, the new ones are written once it is idle
+    ota->DeferProtocolConfig();
+    int retry_delay = 10;
+    for (int attempt = 1; !ota->CheckVersion(); attempt++) {
+        if (attempt >= 3) {
+            ESP_LOGW(TAG, "Background version check failed, keeping the cached config");
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(retry_delay * 1000));
+        retry_delay *= 2;
+    }
+    if (!ota->HasNewVersion()) {
+        ota->MarkCurrentVersionValid();
+    }
+    Schedule([this, ota = std::move(ota)]() mutable {
+        pending_ota_ = std::move(ota);
+        ApplyOtaConfig();
+    });
+}
+
+// Applies the result of the background check, the parts that disturb a conversation wait for idle
+void Application::ApplyOtaConfig() {
+    if (pending_ota_->HasServerTime()) {
+        has_server_time_ = true;
+    }
+    if (!pending_ota_->HasConfigChanged() && !pending_ota_->HasNewVersion()) {
+        ESP_LOGI(TAG, "Cached config is up to date%s", pending_ota_->IsNotModified() ? " (not modified)" : "");
+        pending_ota_.reset();
+        return;
+    }
+    if (device_state_ != kDeviceStateIdle) {
+        // Retried from the clock tick
+        return;
+    }
+
+    auto ota = std::move(pending_ota_);
+    ota->SaveProtocolConfig();
+    if (ota->HasNewVersion()) {
+        UpgradeFirmware(*ota);
+        return;
+    }
+    bool use_mqtt = ota->HasMqttConfig() || !ota->HasWebsocketConfig();
+    bool using_mqtt = dynamic_cast<MqttProtocol*>(protocol_.get()) != nullptr;
+    if (ota->HasActivationCode() || ota->HasActivationChallenge() || use_mqtt != using_mqtt) {
+        // Activation and a change of transport go through the regular boot
+        ESP_LOGW(TAG, "Server config changed, restarting");
+        Reboot();
+        return;
+    }
+    // The new endpoints are in the settings: MQTT reconnects now, WebSocket reads them on every open
+    ESP_LOGI(TAG, "Server config changed, restarting the protocol");
+    protocol_->Start();
+}
+#endif
+
+bool Application::StartProtocol(Ota& ota) {
+    auto& board = Board::GetInstance();
+    auto display = board.GetDisplay();
+    auto codec = board.GetAudioCodec();
 
     // Initialize the protocol
     display->SetStatus(Lang::Strings::LOADING_PROTOCOL);
 
-    // Add MCP common tools before initializing the protocol
-    auto& mcp_server = McpServer::GetInstance();
-    mcp_server.AddCommonTools();
-    mcp_server.AddUserOnlyTools();
-
     if (ota.HasMqttConfig()) {
         protocol_ = std::make_unique<MqttProtocol>();
     } else if (ota.HasWebsocketConfig()) {
@@ -419,17 +591,39 @@ void Application::Start() {
         protocol_ = std::make_unique<MqttProtocol>();
     }
 
+    // The sender holds a few frames at a time and asks for more as they go out
+    protocol_->sender().OnAudioRoom([this]() {
+        xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+    });
     protocol_->OnConnected([this]() {
         DismissAlert();
     });
 
     protocol_->OnNetworkError([this](const std::string& message) {
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+        // A speculative channel failing is not worth an alert, the next session connects as usual
+        if (keep_warm_connecting_ || (keep_warm_parked_ && device_state_ == kDeviceStateIdle)) {
+            ESP_LOGW(TAG, "Keep-warm audio channel error: %s", message.c_str());
+            return;
+        }
+#endif
         last_error_message_ = message;
         xEventGroupSetBits(event_group_, MAIN_EVENT_ERROR);
     });
     protocol_->OnIncomingAudio([this](std::unique_ptr<AudioStreamPacket> packet) {
+#if CONFIG_USE_SESSION_RESUME
+        auto now = esp_timer_get_time();
+        if (resume_audio_pending_) {
+            resume_audio_pending_ = false;
+            ESP_LOGI(TAG, "Reconnect to audio: %lld ms, downlink audio gap %lld ms",
+                (now - resume_start_time_) / 1000, (now - last_incoming_audio_time_) / 1000);
+        }
+        last_incoming_audio_time_ = now;
+#endif
         if (device_state_ == kDeviceStateSpeaking) {
             audio_service_.PushPacketToDecodeQueue(std::move(packet));
+        } else {
+            AudioPacketPool::GetInstance().Release(std::move(packet));
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
@@ -439,27 +633,120 @@ void Application::Start() {
                 protocol_->server_sample_rate(), codec->output_sample_rate());
         }
     });
+#if CONFIG_USE_QOS_FEEDBACK
+    protocol_->OnUplinkQosChanged([this](int bitrate, int packet_loss) {
+        audio_service_.SetEncoderBitrate(bitrate, packet_loss);
+    });
+#endif
     protocol_->OnAudioChannelClosed([this, &board]() {
         board.SetPowerSaveMode(true);
         Schedule([this]() {
+#if CONFIG_USE_SESSION_RESUME
+            // A drop in the middle of a conversation is resumed instead of ending it
+            if (resuming_ || ResumeSession()) {
+                return;
+            }
+#endif
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("system", "");
             SetDeviceState(kDeviceStateIdle);
         });
     });
+    // Hot messages are scanned in place, everything else goes through cJSON
+    protocol_->OnIncomingText([this](std::string_view json) {
+        ControlMessage message;
+        if (!ScanControlMessage(json, json_arena_, message)) {
+            return false;
+        }
+        return HandleControlMessage(message);
+    });
     protocol_->OnIncomingJson([this, display](const cJSON* root) {
-        // Parse JSON data
         auto type = cJSON_GetObjectItem(root, "type");
-        if (strcmp(type->valuestring, "tts") == 0) {
-            auto state = cJSON_GetObjectItem(root, "state");
-            if (strcmp(state->valuestring, "start") == 0) {
+        ControlMessage control_message;
+        control_message.type = LookupControlMessageType(type->valuestring);
+        switch (control_message.type) {
+            case kControlMessageTts:
+            case kControlMessageStt:
+            case kControlMessageLlm: {
+                // Malformed for the scanner but not for cJSON, handle it the same way
+                auto state = cJSON_GetObjectItem(root, "state");
+                auto text = cJSON_GetObjectItem(root, "text");
+                auto emotion = cJSON_GetObjectItem(root, "emotion");
+                control_message.state = cJSON_IsString(state) ? state->valuestring : "";
+                control_message.text = cJSON_IsString(text) ? text->valuestring : "";
+                control_message.emotion = cJSON_IsString(emotion) ? emotion->valuestring : "";
+                HandleControlMessage(control_message);
+                break;
+            }
+            case kControlMessageMcp: {
+                auto payload = cJSON_GetObjectItem(root, "payload");
+                // An array is a JSON-RPC batch
+                if (cJSON_IsObject(payload) || cJSON_IsArray(payload)) {
+                    McpServer::GetInstance().ParseMessage(payload);
+                }
+                break;
+            }
+            case kControlMessageSystem: {
+                auto command = cJSON_GetObjectItem(root, "command");
+                if (cJSON_IsString(command)) {
+                    ESP_LOGI(TAG, "System command: %s", command->valuestring);
+                    if (strcmp(command->valuestring, "reboot") == 0) {
+                        // Do a reboot if user requests a OTA update
+                        Schedule([this]() {
+                            Reboot();
+                        });
+                    } else {
+                        ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
+                    }
+                }
+                break;
+            }
+            case kControlMessageAlert: {
+                auto status = cJSON_GetObjectItem(root, "status");
+                auto message = cJSON_GetObjectItem(root, "message");
+                auto emotion = cJSON_GetObjectItem(root, "emotion");
+                if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
+                    Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
+                } else {
+                    ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+                }
+                break;
+            }
+#if CONFIG_RECEIVE_CUSTOM_MESSAGE
+            case kControlMessageCustom: {
+                auto payload = cJSON_GetObjectItem(root, "payload");
+                ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
+                if (cJSON_IsObject(payload)) {
+                    Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
+                        display->SetChatMessage("system", payload_str.c_str());
+                    }, kMainTaskPriorityLow);
+                } else {
+                    ESP_LOGW(TAG, "Invalid custom message format: missing payload");
+                }
+                break;
+            }
+#endif
+            default:
+                ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+                break;
+        }
+    });
+    return protocol_->Start();
+}
+
+// Runs in the network task, the views in `message` are only valid during this call
+bool Application::HandleControlMessage(const ControlMessage& message) {
+    auto display = Board::GetInstance().GetDisplay();
+    switch (message.type) {
+        case kControlMessageTts:
+            if (message.state == "start") {
                 Schedule([this]() {
                     aborted_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
                 });
-            } else if (strcmp(state->valuestring, "stop") == 0) {
+            } else if (message.state == "stop") {
                 Schedule([this]() {
                     if (device_state_ == kDeviceStateSpeaking) {
                         if (listening_mode_ == kListeningModeManualStop) {
@@ -469,94 +756,49 @@ void Application::Start() {
                         }
                     }
                 });
-            } else if (strcmp(state->valuestring, "sentence_start") == 0) {
-                auto text = cJSON_GetObjectItem(root, "text");
-                if (cJSON_IsString(text)) {
-                    ESP_LOGI(TAG, "<< %s", text->valuestring);
-                    Schedule([this, display, message = std::string(text->valuestring)]() {
-                        display->SetChatMessage("assistant", message.c_str());
-                    });
-                }
-            }
-        } else if (strcmp(type->valuestring, "stt") == 0) {
-            auto text = cJSON_GetObjectItem(root, "text");
-            if (cJSON_IsString(text)) {
-                ESP_LOGI(TAG, ">> %s", text->valuestring);
-                Schedule([this, display, message = std::string(text->valuestring)]() {
-                    display->SetChatMessage("user", message.c_str());
-                });
+            } else if (message.state == "sentence_start" && !message.text.empty()) {
+                ESP_LOGI(TAG, "<< %.*s", (int)message.text.size(), message.text.data());
+                Schedule([display, text = std::string(message.text)]() {
+                    display->SetChatMessage("assistant", text.c_str());
+                }, kMainTaskPriorityLow, CHAT_MESSAGE_KEY(kMainTaskKeyAssistantMessage));
             }
-        } else if (strcmp(type->valuestring, "llm") == 0) {
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(emotion)) {
-                Schedule([this, display, emotion_str = std::string(emotion->valuestring)]() {
-                    display->SetEmotion(emotion_str.c_str());
-                });
-            }
-        } else if (strcmp(type->valuestring, "mcp") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            if (cJSON_IsObject(payload)) {
-                McpServer::GetInstance().ParseMessage(payload);
-            }
-        } else if (strcmp(type->valuestring, "system") == 0) {
-            auto command = cJSON_GetObjectItem(root, "command");
-            if (cJSON_IsString(command)) {
-                ESP_LOGI(TAG, "System command: %s", command->valuestring);
-                if (strcmp(command->valuestring, "reboot") == 0) {
-                    // Do a reboot if user requests a OTA update
-                    Schedule([this]() {
-                        Reboot();
-                    });
-                } else {
-                    ESP_LOGW(TAG, "Unknown system command: %s", command->valuestring);
-                }
+            break;
+        case kControlMessageStt:
+            if (!message.text.empty()) {
+                ESP_LOGI(TAG, ">> %.*s", (int)message.text.size(), message.text.data());
+                Schedule([display, text = std::string(message.text)]() {
+                    display->SetChatMessage("user", text.c_str());
+                }, kMainTaskPriorityLow, CHAT_MESSAGE_KEY(kMainTaskKeyUserMessage));
             }
-        } else if (strcmp(type->valuestring, "alert") == 0) {
-            auto status = cJSON_GetObjectItem(root, "status");
-            auto message = cJSON_GetObjectItem(root, "message");
-            auto emotion = cJSON_GetObjectItem(root, "emotion");
-            if (cJSON_IsString(status) && cJSON_IsString(message) && cJSON_IsString(emotion)) {
-                Alert(status->valuestring, message->valuestring, emotion->valuestring, Lang::Sounds::OGG_VIBRATION);
-            } else {
-                ESP_LOGW(TAG, "Alert command requires status, message and emotion");
+            break;
+        case kControlMessageLlm:
+            if (!message.emotion.empty()) {
+                Schedule([display, emotion = std::string(message.emotion)]() {
+                    display->SetEmotion(emotion.c_str());
+                }, kMainTaskPriorityLow, kMainTaskKeyEmotion);
             }
-#if CONFIG_RECEIVE_CUSTOM_MESSAGE
-        } else if (strcmp(type->valuestring, "custom") == 0) {
-            auto payload = cJSON_GetObjectItem(root, "payload");
-            ESP_LOGI(TAG, "Received custom message: %s", cJSON_PrintUnformatted(root));
-            if (cJSON_IsObject(payload)) {
-                Schedule([this, display, payload_str = std::string(cJSON_PrintUnformatted(payload))]() {
-                    display->SetChatMessage("system", payload_str.c_str());
-                });
-            } else {
-                ESP_LOGW(TAG, "Invalid custom message format: missing payload");
+            break;
+        case kControlMessageMcp: {
+            // McpServer works on a cJSON tree, but only the payload needs one
+            auto payload = cJSON_ParseWithLength(message.payload.data(), message.payload.size());
+            if (payload == nullptr) {
+                ESP_LOGW(TAG, "Failed to parse MCP payload of %u bytes", message.payload.size());
+                return false;
             }
-#endif
-        } else {
-            ESP_LOGW(TAG, "Unknown message type: %s", type->valuestring);
+            McpServer::GetInstance().ParseMessage(payload);
+            cJSON_Delete(payload);
+            break;
         }
-    });
-    bool protocol_started = protocol_->Start();
-
-    SystemInfo::PrintHeapStats();
-    SetDeviceState(kDeviceStateIdle);
-
-    has_server_time_ = ota.HasServerTime();
-    if (protocol_started) {
-        std::string message = std::string(Lang::Strings::VERSION) + ota.GetCurrentVersion();
-        display->ShowNotification(message.c_str());
-        display->SetChatMessage("system", "");
-        // Play the success sound to indicate the device is ready
-        audio_service_.PlaySound(Lang::Sounds::OGG_SUCCESS);
+        default:
+            break;
     }
+    return true;
 }
 
 // Add a async task to MainLoop
-void Application::Schedule(std::function<void()> callback) {
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        main_tasks_.push_back(std::move(callback));
-    }
+void Application::Schedule(MainTask callback, MainTaskPriority priority, MainTaskKey key,
+    const std::source_location& location) {
+    main_tasks_.Push(std::move(callback), priority, key, location.file_name(), location.line());
     xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
 }
 
@@ -564,6 +806,9 @@ void Application::Schedule(std::function<void()> callback) {
 // If other tasks need to access the websocket or chat state,
 // they should use Schedule to call this function
 void Application::MainEventLoop() {
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+    LoopProfiler::GetInstance().Start();
+#endif
     while (true) {
         auto bits = xEventGroupWaitBits(event_group_, MAIN_EVENT_SCHEDULE |
             MAIN_EVENT_SEND_AUDIO |
@@ -573,23 +818,32 @@ void Application::MainEventLoop() {
             MAIN_EVENT_ERROR, pdTRUE, pdFALSE, portMAX_DELAY);
 
         if (bits & MAIN_EVENT_ERROR) {
+            LOOP_PROFILE("error");
             SetDeviceState(kDeviceStateIdle);
             Alert(Lang::Strings::ERROR, last_error_message_.c_str(), "circle_xmark", Lang::Sounds::OGG_EXCLAMATION);
         }
 
-        if (bits & MAIN_EVENT_SEND_AUDIO) {
-            while (auto packet = audio_service_.PopPacketFromSendQueue()) {
-                if (protocol_ && !protocol_->SendAudio(std::move(packet))) {
+        // Audio captured while connecting or resuming stays queued until the channel is up
+        // The backlog stays in the AudioService send queue, which holds off the encoder when full
+        if ((bits & MAIN_EVENT_SEND_AUDIO) && protocol_ && device_state_ != kDeviceStateConnecting && !resuming_) {
+            LOOP_PROFILE("send_audio");
+            auto& sender = protocol_->sender();
+            while (sender.HasAudioRoom()) {
+                auto packet = audio_service_.PopPacketFromSendQueue();
+                if (!packet) {
                     break;
                 }
+                sender.PushAudio(std::move(packet));
             }
         }
 
         if (bits & MAIN_EVENT_WAKE_WORD_DETECTED) {
+            LOOP_PROFILE("wake_word");
             OnWakeWordDetected();
         }
 
         if (bits & MAIN_EVENT_VAD_CHANGE) {
+            LOOP_PROFILE("vad_change");
             if (device_state_ == kDeviceStateListening) {
                 auto led = Board::GetInstance().GetLed();
                 led->OnStateChanged();
@@ -597,25 +851,64 @@ void Application::MainEventLoop() {
         }
 
         if (bits & MAIN_EVENT_SCHEDULE) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            auto tasks = std::move(main_tasks_);
-            lock.unlock();
-            for (auto& task : tasks) {
-                task();
+            if (main_tasks_.Run()) {
+                xEventGroupSetBits(event_group_, MAIN_EVENT_SCHEDULE);
             }
         }
 
         if (bits & MAIN_EVENT_CLOCK_TICK) {
+            LOOP_PROFILE("clock_tick");
             clock_ticks_++;
             auto display = Board::GetInstance().GetDisplay();
-            display->UpdateStatusBar();
+            {
+                LOOP_PROFILE("UpdateStatusBar");
+                display->UpdateStatusBar();
+            }
         
             // Print the debug info every 10 seconds
             if (clock_ticks_ % 10 == 0) {
                 // SystemInfo::PrintTaskCpuUsage(pdMS_TO_TICKS(1000));
                 // SystemInfo::PrintTaskList();
                 SystemInfo::PrintHeapStats();
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+                LoopProfiler::GetInstance().PrintStats();
+#endif
+                AudioPacketPool::GetInstance().PrintStats();
+                main_tasks_.PrintStats();
+                if (protocol_) {
+                    protocol_->sender().PrintStats();
+                }
+            }
+
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+            CheckWarmAudioChannel();
+#endif
+#if CONFIG_USE_CACHED_OTA_CONFIG
+            if (pending_ota_ && device_state_ == kDeviceStateIdle) {
+                ApplyOtaConfig();
+            }
+#endif
+#if CONFIG_USE_SESSION_RESUME
+            // The UDP channel has no disconnect event, its timeout is only noticed by polling
+            if ((device_state_ == kDeviceStateListening || device_state_ == kDeviceStateSpeaking) &&
+                !protocol_->IsAudioChannelOpened()) {
+                ResumeSession();
+            }
+#endif
+#if CONFIG_USE_NETWORK_FAILOVER
+            if (!resuming_ && FailoverNetwork() &&
+                (device_state_ == kDeviceStateListening || device_state_ == kDeviceStateSpeaking)) {
+                ResumeSession();
             }
+#endif
+#if CONFIG_USE_QOS_FEEDBACK
+            // Receiver report on the downlink every QOS_REPORT_INTERVAL_MS
+            if (clock_ticks_ % (QOS_REPORT_INTERVAL_MS / 1000) == 0 &&
+                (device_state_ == kDeviceStateListening || device_state_ == kDeviceStateSpeaking) &&
+                protocol_->IsAudioChannelOpened()) {
+                protocol_->SendQosReport();
+            }
+#endif
         }
     }
 }
@@ -628,36 +921,253 @@ void Application::OnWakeWordDetected() {
     if (device_state_ == kDeviceStateIdle) {
         audio_service_.EncodeWakeWord();
 
-        if (!protocol_->IsAudioChannelOpened()) {
-            SetDeviceState(kDeviceStateConnecting);
-            if (!protocol_->OpenAudioChannel()) {
-                audio_service_.EnableWakeWordDetection(true);
-                return;
-            }
-        }
-
-        auto wake_word = audio_service_.GetLastWakeWord();
-        ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
+        ConnectAudioChannel([this]() {
+            auto wake_word = audio_service_.GetLastWakeWord();
+            ESP_LOGI(TAG, "Wake word detected: %s", wake_word.c_str());
 #if CONFIG_USE_AFE_WAKE_WORD || CONFIG_USE_CUSTOM_WAKE_WORD
-        // Encode and send the wake word data to the server
-        while (auto packet = audio_service_.PopWakeWordPacket()) {
-            protocol_->SendAudio(std::move(packet));
-        }
-        // Set the chat state to wake word detected
-        protocol_->SendWakeWordDetected(wake_word);
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Encode and send the wake word data to the server
+            while (auto packet = audio_service_.PopWakeWordPacket()) {
+                protocol_->sender().PushAudio(std::move(packet));
+            }
+            // Set the chat state to wake word detected
+            protocol_->SendWakeWordDetected(wake_word);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
 #else
-        SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
-        // Play the pop up sound to indicate the wake word is detected
-        audio_service_.PlaySound(Lang::Sounds::OGG_POPUP);
+            SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            // Play the pop up sound to indicate the wake word is detected
+            audio_service_.PlaySound(Lang::Sounds::OGG_POPUP);
 #endif
+        });
     } else if (device_state_ == kDeviceStateSpeaking) {
+        if (AbandonSessionResume()) {
+            return;
+        }
         AbortSpeaking(kAbortReasonWakeWordDetected);
     } else if (device_state_ == kDeviceStateActivating) {
         SetDeviceState(kDeviceStateIdle);
     }
 }
 
+// Opens the audio channel without blocking the main loop. `on_opened` runs on the main loop
+// once the channel is up, audio captured in the meantime waits in the send queue.
+void Application::ConnectAudioChannel(std::function<void()> on_opened) {
+    if (protocol_->IsAudioChannelOpened() && !protocol_->IsAudioChannelOpening()) {
+        on_opened();
+        return;
+    }
+
+    on_channel_opened_ = on_opened;
+    SetDeviceState(kDeviceStateConnecting);
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    // A speculative open already in flight now serves this session
+    keep_warm_connecting_ = false;
+#endif
+    if (protocol_->IsAudioChannelOpening()) {
+        return;
+    }
+    protocol_->OpenAudioChannelAsync([this](bool success) {
+        Schedule([this, success]() {
+            OnAudioChannelOpenDone(success);
+        });
+    });
+}
+
+void Application::OnAudioChannelOpenDone(bool success) {
+    auto on_opened = std::move(on_channel_opened_);
+    on_channel_opened_ = nullptr;
+
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    if (keep_warm_connecting_) {
+        keep_warm_connecting_ = false;
+        if (success && device_state_ == kDeviceStateIdle) {
+            ParkAudioChannel();
+        }
+        return;
+    }
+#endif
+
+    // Cancelled, or a network error has already moved the state on
+    if (device_state_ != kDeviceStateConnecting) {
+        return;
+    }
+    if (!success) {
+        SetDeviceState(kDeviceStateIdle);
+        return;
+    }
+
+    if (on_opened) {
+        on_opened();
+    }
+    // Flush the audio captured while connecting
+    xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+}
+
+// Reopens a channel that dropped mid-conversation and continues the same session on the server.
+// The device keeps its state meanwhile: playback drains the decode queue, captured audio waits in the send queue.
+bool Application::ResumeSession() {
+    if (resuming_) {
+        return true;
+    }
+    if (device_state_ != kDeviceStateListening && device_state_ != kDeviceStateSpeaking) {
+        return false;
+    }
+#if CONFIG_USE_NETWORK_FAILOVER
+    // Reconnecting over a Wi-Fi that just went away would fail, move to the standby network first
+    FailoverNetwork();
+#endif
+    resume_start_time_ = esp_timer_get_time();
+    bool started = protocol_->ResumeAudioChannelAsync([this](bool success) {
+        Schedule([this, success]() {
+            OnSessionResumeDone(success);
+        });
+    });
+    if (!started) {
+        return false;
+    }
+    ESP_LOGW(TAG, "Audio channel dropped while %s, resuming the session", STATE_STRINGS[device_state_]);
+    resuming_ = true;
+    // Downlink audio only matters if the server was speaking
+    resume_audio_pending_ = device_state_ == kDeviceStateSpeaking;
+    return true;
+}
+
+void Application::OnSessionResumeDone(bool success) {
+    if (!resuming_) {
+        return;
+    }
+    resuming_ = false;
+    auto elapsed_ms = (esp_timer_get_time() - resume_start_time_) / 1000;
+
+#if CONFIG_USE_NETWORK_FAILOVER
+    if (failing_over_) {
+        failing_over_ = false;
+        ESP_LOGI(TAG, "Network failover %s in %lld ms", success && protocol_->session_resumed() ? "done" : "failed", elapsed_ms);
+    }
+#endif
+    if (!success || !protocol_->session_resumed()) {
+        ESP_LOGW(TAG, "Session not resumed after %lld ms", elapsed_ms);
+        resume_audio_pending_ = false;
+        if (success) {
+            // The server only offers a new session, the conversation is lost anyway
+            protocol_->CloseAudioChannel();
+        }
+        audio_service_.ClearSendQueue();
+        SetDeviceState(kDeviceStateIdle);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Session resumed in %lld ms", elapsed_ms);
+    // Flush the audio captured while resuming
+    xEventGroupSetBits(event_group_, MAIN_EVENT_SEND_AUDIO);
+}
+
+// The user moved on while the session was resuming, give it up and go back to idle
+bool Application::AbandonSessionResume() {
+    if (!resuming_) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Session resume abandoned");
+    resuming_ = false;
+    resume_audio_pending_ = false;
+#if CONFIG_USE_NETWORK_FAILOVER
+    failing_over_ = false;
+#endif
+    protocol_->CancelOpenAudioChannel();
+    audio_service_.ClearSendQueue();
+    SetDeviceState(kDeviceStateIdle);
+    return true;
+}
+
+#if CONFIG_USE_NETWORK_FAILOVER
+// Lets the board judge the link and switch networks, the connections then move over to the new one.
+// In a conversation the caller resumes the session, between conversations the protocol simply reconnects.
+bool Application::FailoverNetwork() {
+    if (!failover_enabled_ || !protocol_) {
+        return false;
+    }
+    auto& board = Board::GetInstance();
+    if (!board.CheckNetworkFailover(protocol_->last_rtt(), protocol_->packet_loss_percent())) {
+        return false;
+    }
+    if (device_state_ == kDeviceStateListening || device_state_ == kDeviceStateSpeaking) {
+        failing_over_ = true;
+        protocol_->DropConnections();
+        return true;
+    }
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    if (keep_warm_parked_) {
+        keep_warm_parked_ = false;
+        protocol_->CloseAudioChannel();
+    }
+#endif
+    protocol_->DropConnections();
+    protocol_->Start();
+    return true;
+}
+#endif
+
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+// Parks an authenticated audio channel after a session, so the next wake word skips the
+// connect, TLS handshake and hello round trip
+void Application::KeepAudioChannelWarm() {
+    if (device_state_ != kDeviceStateIdle || !protocol_ || !protocol_->server_keep_warm() ||
+        protocol_->IsAudioChannelOpening()) {
+        return;
+    }
+    if (protocol_->IsAudioChannelOpened()) {
+        ParkAudioChannel();
+        return;
+    }
+
+    auto now = esp_timer_get_time();
+    if (now < keep_warm_next_attempt_time_) {
+        ESP_LOGI(TAG, "Keep-warm cooling down for %lld s", (keep_warm_next_attempt_time_ - now) / 1000000);
+        return;
+    }
+    keep_warm_next_attempt_time_ = now + (int64_t)CONFIG_KEEP_WARM_COOLDOWN_SECONDS * keep_warm_backoff_ * 1000000;
+    keep_warm_connecting_ = true;
+    protocol_->OpenAudioChannelAsync([this](bool success) {
+        Schedule([this, success]() {
+            OnAudioChannelOpenDone(success);
+        });
+    });
+}
+
+void Application::ParkAudioChannel() {
+    ESP_LOGI(TAG, "Audio channel parked for up to %d s", CONFIG_KEEP_WARM_MAX_IDLE_SECONDS);
+    keep_warm_parked_ = true;
+    keep_warm_parked_time_ = esp_timer_get_time();
+    keep_warm_keepalive_time_ = keep_warm_parked_time_;
+}
+
+// Called every second while the clock ticks
+void Application::CheckWarmAudioChannel() {
+    if (!keep_warm_parked_ || device_state_ != kDeviceStateIdle) {
+        return;
+    }
+
+    auto now = esp_timer_get_time();
+    if (!protocol_->IsAudioChannelOpened()) {
+        // The server dropped the parked channel, park less often to spare it
+        keep_warm_parked_ = false;
+        keep_warm_backoff_ = std::min(keep_warm_backoff_ * 2, 8);
+        ESP_LOGW(TAG, "Parked audio channel closed by server after %lld s, backoff x%d",
+            (now - keep_warm_parked_time_) / 1000000, keep_warm_backoff_);
+        return;
+    }
+    if (now - keep_warm_parked_time_ >= (int64_t)CONFIG_KEEP_WARM_MAX_IDLE_SECONDS * 1000000) {
+        ESP_LOGI(TAG, "Parked audio channel unused, closing");
+        keep_warm_parked_ = false;
+        protocol_->CloseAudioChannel();
+        return;
+    }
+    if (now - keep_warm_keepalive_time_ >= (int64_t)CONFIG_KEEP_WARM_KEEPALIVE_SECONDS * 1000000) {
+        keep_warm_keepalive_time_ = now;
+        protocol_->SendKeepalive();
+    }
+}
+#endif
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
@@ -676,11 +1186,20 @@ void Application::SetDeviceState(DeviceState state) {
         return;
     }
     
+    LOOP_PROFILE("SetDeviceState", STATE_STRINGS[state]);
     clock_ticks_ = 0;
     auto previous_state = device_state_;
     device_state_ = state;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
 
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    if (keep_warm_parked_ && state != kDeviceStateIdle) {
+        ESP_LOGI(TAG, "Reusing parked audio channel after %lld ms", (esp_timer_get_time() - keep_warm_parked_time_) / 1000);
+        keep_warm_parked_ = false;
+        keep_warm_backoff_ = 1;
+    }
+#endif
+
     // Send the state change event
     DeviceStateEventManager::GetInstance().PostStateChangeEvent(previous_state, state);
 
@@ -695,19 +1214,35 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetEmotion("neutral");
             audio_service_.EnableVoiceProcessing(false);
             audio_service_.EnableWakeWordDetection(true);
+            if (previous_state == kDeviceStateConnecting) {
+                // The channel never came up, drop what was captured for it
+                audio_service_.ClearSendQueue();
+            }
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+            if (previous_state == kDeviceStateListening || previous_state == kDeviceStateSpeaking) {
+                Schedule([this]() {
+                    KeepAudioChannelWarm();
+                });
+            }
+#endif
             break;
         case kDeviceStateConnecting:
             display->SetStatus(Lang::Strings::CONNECTING);
             display->SetEmotion("neutral");
             display->SetChatMessage("system", "");
+            // Start capturing now, the send queue holds the audio until the channel is up
+            audio_service_.EnableVoiceProcessing(true);
+            audio_service_.EnableWakeWordDetection(false);
             break;
         case kDeviceStateListening:
             display->SetStatus(Lang::Strings::LISTENING);
             display->SetEmotion("neutral");
 
-            // Make sure the audio processor is running
-            if (!audio_service_.IsAudioProcessorRunning()) {
-                // Send the start listening command
+            if (previous_state == kDeviceStateConnecting) {
+                // Voice processing has been running since Connecting
+                protocol_->SendStartListening(listening_mode_);
+            } else if (!audio_service_.IsAudioProcessorRunning()) {
+                // Make sure the audio processor is running
                 protocol_->SendStartListening(listening_mode_);
                 audio_service_.EnableVoiceProcessing(true);
                 audio_service_.EnableWakeWordDetection(false);
@@ -735,6 +1270,13 @@ void Application::SetDeviceState(DeviceState state) {
 
 void Application::Reboot() {
     ESP_LOGI(TAG, "Rebooting...");
+    // The open task still uses the protocol, let it finish first
+    if (protocol_ && protocol_->IsAudioChannelOpening()) {
+        protocol_->CancelOpenAudioChannel();
+        while (protocol_->IsAudioChannelOpening()) {
+            vTaskDelay(pdMS_TO_TICKS(100));
+        }
+    }
     // Disconnect the audio channel
     if (protocol_ && protocol_->IsAudioChannelOpened()) {
         protocol_->CloseAudioChannel();
@@ -801,12 +1343,16 @@ bool Application::UpgradeFirmware(Ota& ota, const std::string& url) {
 
 void Application::WakeWordInvoke(const std::string& wake_word) {
     if (device_state_ == kDeviceStateIdle) {
-        ToggleChatState();
         Schedule([this, wake_word]() {
-            if (protocol_) {
-                protocol_->SendWakeWordDetected(wake_word); 
+            if (!protocol_ || device_state_ != kDeviceStateIdle) {
+                return;
             }
-        }); 
+            // Sent once the channel is open, like the wake word from the audio service
+            ConnectAudioChannel([this, wake_word]() {
+                protocol_->SendWakeWordDetected(wake_word);
+                SetListeningMode(aec_mode_ == kAecOff ? kListeningModeAutoStop : kListeningModeRealtime);
+            });
+        });
     } else if (device_state_ == kDeviceStateSpeaking) {
         Schedule([this]() {
             AbortSpeaking(kAbortReasonNone);
@@ -10,11 +10,14 @@
 #include <mutex>
 #include <deque>
 #include <memory>
+#include <source_location>
 
 #include "protocol.h"
+#include "control_message.h"
 #include "ota.h"
 #include "audio_service.h"
 #include "device_state_event.h"
+#include "main_task_queue.h"
 
 
 #define MAIN_EVENT_SCHEDULE (1 << 0)
@@ -46,7 +49,9 @@ public:
     void MainEventLoop();
     DeviceState GetDeviceState() const { return device_state_; }
     bool IsVoiceDetected() const { return audio_service_.IsVoiceDetected(); }
-    void Schedule(std::function<void()> callback);
+    // Runs the callback in the main loop, display updates should use kMainTaskPriorityLow
+    void Schedule(MainTask callback, MainTaskPriority priority = kMainTaskPriorityHigh, MainTaskKey key = kMainTaskKeyNone,
+        const std::source_location& location = std::source_location::current());
     void SetDeviceState(DeviceState state);
     void Alert(const char* status, const char* message, const char* emotion = "", const std::string_view& sound = "");
     void DismissAlert();
@@ -68,8 +73,7 @@ private:
     Application();
     ~Application();
 
-    std::mutex mutex_;
-    std::deque<std::function<void()>> main_tasks_;
+    MainTaskQueue main_tasks_;
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_ = nullptr;
     esp_timer_handle_t clock_timer_handle_ = nullptr;
@@ -77,19 +81,66 @@ private:
     ListeningMode listening_mode_ = kListeningModeAutoStop;
     AecMode aec_mode_ = kAecOff;
     std::string last_error_message_;
+    std::string assets_download_url_;  // Set during boot when the assets in flash are outdated
     AudioService audio_service_;
+    JsonArena json_arena_;  // Only used by the network task that delivers incoming messages
 
     bool has_server_time_ = false;
     bool aborted_ = false;
     int clock_ticks_ = 0;
     TaskHandle_t check_new_version_task_handle_ = nullptr;
     TaskHandle_t main_event_loop_task_handle_ = nullptr;
+    std::function<void()> on_channel_opened_;
+
+    // Session resume after the audio channel drops mid-conversation
+    bool resuming_ = false;
+    volatile bool resume_audio_pending_ = false;
+    int64_t resume_start_time_ = 0;
+    int64_t last_incoming_audio_time_ = 0;
+#if CONFIG_USE_NETWORK_FAILOVER
+    bool failing_over_ = false;
+    volatile bool failover_enabled_ = false;  // Set once boot is done and the protocol runs
+#endif
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    std::unique_ptr<Ota> pending_ota_;  // Background check result waiting for idle
+#endif
+
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    // Audio channel parked between sessions
+    bool keep_warm_parked_ = false;
+    volatile bool keep_warm_connecting_ = false;
+    int64_t keep_warm_parked_time_ = 0;
+    int64_t keep_warm_keepalive_time_ = 0;
+    int64_t keep_warm_next_attempt_time_ = 0;
+    int keep_warm_backoff_ = 1;
+#endif
 
     void OnWakeWordDetected();
     void CheckNewVersion(Ota& ota);
+    void LoadAssets();
     void CheckAssetsVersion();
+    bool StartProtocol(Ota& ota);
     void ShowActivationCode(const std::string& code, const std::string& message);
     void SetListeningMode(ListeningMode mode);
+    void ConnectAudioChannel(std::function<void()> on_opened);
+    void OnAudioChannelOpenDone(bool success);
+    // False if the message could not be handled, the caller falls back to the full parse
+    bool HandleControlMessage(const ControlMessage& message);
+    bool ResumeSession();
+    void OnSessionResumeDone(bool success);
+    bool AbandonSessionResume();
+#if CONFIG_USE_NETWORK_FAILOVER
+    bool FailoverNetwork();
+#endif
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    void RefreshOtaConfig();
+    void ApplyOtaConfig();
+#endif
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    void KeepAudioChannelWarm();
+    void ParkAudioChannel();
+    void CheckWarmAudioChannel();
+#endif
 };
 
 
@@ -0,0 +1,68 @@
+#include "adaptive_opus_encoder.h"
+
+#include <esp_log.h>
+
+#define TAG "AdaptiveOpusEncoder"
+#define MAX_OPUS_PACKET_SIZE 1500
+
+AdaptiveOpusEncoder::AdaptiveOpusEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    frame_size_ = sample_rate / 1000 * duration_ms;
+
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    opus_encoder_ctl(encoder_, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(0));
+}
+
+AdaptiveOpusEncoder::~AdaptiveOpusEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void AdaptiveOpusEncoder::SetComplexity(int complexity) {
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void AdaptiveOpusEncoder::SetBitrate(int bitrate) {
+    if (encoder_ == nullptr || bitrate == bitrate_) {
+        return;
+    }
+    if (opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate)) == OPUS_OK) {
+        bitrate_ = bitrate;
+    }
+}
+
+void AdaptiveOpusEncoder::SetPacketLoss(int percent) {
+    if (encoder_ == nullptr) {
+        return;
+    }
+    opus_encoder_ctl(encoder_, OPUS_SET_PACKET_LOSS_PERC(percent));
+    opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(percent > 0 ? 1 : 0));
+}
+
+bool AdaptiveOpusEncoder::Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus) {
+    if (encoder_ == nullptr) {
+        return false;
+    }
+    if (pcm.size() != (size_t)(frame_size_ * channels_)) {
+        ESP_LOGE(TAG, "Audio data size %u does not match frame size %d", pcm.size(), frame_size_ * channels_);
+        return false;
+    }
+
+    opus.resize(MAX_OPUS_PACKET_SIZE);
+    auto ret = opus_encode(encoder_, pcm.data(), frame_size_, opus.data(), opus.size());
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+        return false;
+    }
+    opus.resize(ret);
+    return true;
+}
@@ -0,0 +1,39 @@
+#ifndef ADAPTIVE_OPUS_ENCODER_H
+#define ADAPTIVE_OPUS_ENCODER_H
+
+#include <opus.h>
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Uplink Opus encoder whose bitrate and in-band FEC can be changed while it runs.
+ *
+ * OpusEncoderWrapper only exposes complexity and DTX, so this talks to libopus directly. The
+ * expected packet loss doubles as the FEC switch: with loss above 0 the encoder embeds a low
+ * bitrate copy of the previous frame that the server can decode in place of a lost packet.
+ */
+class AdaptiveOpusEncoder {
+public:
+    AdaptiveOpusEncoder(int sample_rate, int channels, int duration_ms);
+    ~AdaptiveOpusEncoder();
+
+    void SetComplexity(int complexity);
+    void SetBitrate(int bitrate);
+    void SetPacketLoss(int percent);
+    bool Encode(std::vector<int16_t>&& pcm, std::vector<uint8_t>& opus);
+
+    int sample_rate() const { return sample_rate_; }
+    int duration_ms() const { return duration_ms_; }
+    int bitrate() const { return bitrate_; }
+
+private:
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+    int bitrate_ = OPUS_AUTO;
+};
+
+#endif // ADAPTIVE_OPUS_ENCODER_H
@@ -1,4 +1,5 @@
 #include "audio_service.h"
+#include "audio_packet_pool.h"
 #include <esp_log.h>
 #include <cstring>
 
@@ -36,7 +37,12 @@ void AudioService::Initialize(AudioCodec* codec) {
 
     /* Setup the audio codec */
     opus_decoder_ = std::make_unique<OpusDecoderWrapper>(codec->output_sample_rate(), 1, OPUS_FRAME_DURATION_MS);
+#if CONFIG_USE_QOS_FEEDBACK
+    opus_encoder_ = std::make_unique<AdaptiveOpusEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_encoder_->SetBitrate(QOS_UPLINK_START_BITRATE);
+#else
     opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+#endif
     opus_encoder_->SetComplexity(0);
 
     if (codec->input_sample_rate() != 16000) {
@@ -335,7 +341,10 @@ void AudioService::OpusCodecTask() {
             task->timestamp = packet->timestamp;
 
             SetDecodeSampleRate(packet->sample_rate, packet->frame_duration);
-            if (opus_decoder_->Decode(std::move(packet->payload), task->pcm)) {
+            bool decoded = opus_decoder_->Decode(std::move(packet->payload), task->pcm);
+            // Hand the packet back to the receive pool with its payload capacity
+            AudioPacketPool::GetInstance().Release(std::move(packet));
+            if (decoded) {
                 // Resample if the sample rate is different
                 if (opus_decoder_->sample_rate() != codec_->output_sample_rate()) {
                     int target_size = output_resampler_.GetOutputSamples(task->pcm.size());
@@ -365,6 +374,12 @@ void AudioService::OpusCodecTask() {
             packet->frame_duration = OPUS_FRAME_DURATION_MS;
             packet->sample_rate = 16000;
             packet->timestamp = task->timestamp;
+#if CONFIG_USE_QOS_FEEDBACK
+            if (encoder_settings_changed_.exchange(false)) {
+                opus_encoder_->SetBitrate(encoder_bitrate_);
+                opus_encoder_->SetPacketLoss(encoder_packet_loss_);
+            }
+#endif
             if (!opus_encoder_->Encode(std::move(task->pcm), packet->payload)) {
                 ESP_LOGE(TAG, "Failed to encode audio");
                 continue;
@@ -390,6 +405,14 @@ void AudioService::OpusCodecTask() {
     ESP_LOGW(TAG, "Opus codec task stopped");
 }
 
+void AudioService::SetEncoderBitrate([[maybe_unused]] int bitrate, [[maybe_unused]] int packet_loss) {
+#if CONFIG_USE_QOS_FEEDBACK
+    encoder_bitrate_ = bitrate;
+    encoder_packet_loss_ = packet_loss;
+    encoder_settings_changed_ = true;
+#endif
+}
+
 void AudioService::SetDecodeSampleRate(int sample_rate, int frame_duration) {
     if (opus_decoder_->sample_rate() == sample_rate && opus_decoder_->duration_ms() == frame_duration) {
         return;
@@ -434,6 +457,8 @@ bool AudioService::PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> pa
         if (wait) {
             audio_queue_cv_.wait(lock, [this]() { return audio_decode_queue_.size() < MAX_DECODE_PACKETS_IN_QUEUE; });
         } else {
+            lock.unlock();
+            AudioPacketPool::GetInstance().Release(std::move(packet));
             return false;
         }
     }
@@ -453,6 +478,12 @@ std::unique_ptr<AudioStreamPacket> AudioService::PopPacketFromSendQueue() {
     return packet;
 }
 
+void AudioService::ClearSendQueue() {
+    std::lock_guard<std::mutex> lock(audio_queue_mutex_);
+    audio_send_queue_.clear();
+    audio_queue_cv_.notify_all();
+}
+
 void AudioService::EncodeWakeWord() {
     if (wake_word_) {
         wake_word_->EncodeWakeWordData();
@@ -478,12 +509,9 @@ void AudioService::EnableWakeWordDetection(bool enable) {
 
     ESP_LOGD(TAG, "%s wake word detection", enable ? "Enabling" : "Disabling");
     if (enable) {
+        PrepareWakeWord();
         if (!wake_word_initialized_) {
-            if (!wake_word_->Initialize(codec_, models_list_)) {
-                ESP_LOGE(TAG, "Failed to initialize wake word");
-                return;
-            }
-            wake_word_initialized_ = true;
+            return;
         }
         wake_word_->Start();
         xEventGroupSetBits(event_group_, AS_EVENT_WAKE_WORD_RUNNING);
@@ -493,6 +521,17 @@ void AudioService::EnableWakeWordDetection(bool enable) {
     }
 }
 
+void AudioService::PrepareWakeWord() {
+    if (!wake_word_ || wake_word_initialized_) {
+        return;
+    }
+    if (!wake_word_->Initialize(codec_, models_list_)) {
+        ESP_LOGE(TAG, "Failed to initialize wake word");
+        return;
+    }
+    wake_word_initialized_ = true;
+}
+
 void AudioService::EnableVoiceProcessing(bool enable) {
     ESP_LOGD(TAG, "%s voice processing", enable ? "Enabling" : "Disabling");
     if (enable) {
@@ -626,10 +665,9 @@ void AudioService::PlaySound(const std::string_view& ogg) {
             }
 
             // Audio packet (Opus)
-            auto packet = std::make_unique<AudioStreamPacket>();
+            auto packet = AudioPacketPool::GetInstance().Acquire(pkt_len);
             packet->sample_rate = sample_rate;
             packet->frame_duration = 60;
-            packet->payload.resize(pkt_len);
             std::memcpy(packet->payload.data(), pkt_ptr, pkt_len);
             PushPacketToDecodeQueue(std::move(packet), true);
         }
@@ -6,6 +6,7 @@
 #include <condition_variable>
 #include <chrono>
 #include <mutex>
+#include <atomic>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
@@ -18,6 +19,7 @@
 #include <opus_resampler.h>
 
 #include "audio_codec.h"
+#include "adaptive_opus_encoder.h"
 #include "audio_processor.h"
 #include "processors/audio_debugger.h"
 #include "wake_word.h"
@@ -96,6 +98,8 @@ public:
     bool IsAudioProcessorRunning() const { return xEventGroupGetBits(event_group_) & AS_EVENT_AUDIO_PROCESSOR_RUNNING; }
 
     void EnableWakeWordDetection(bool enable);
+    // Loads the wake word model ahead of the first EnableWakeWordDetection(true), boot only
+    void PrepareWakeWord();
     void EnableVoiceProcessing(bool enable);
     void EnableAudioTesting(bool enable);
     void EnableDeviceAec(bool enable);
@@ -104,10 +108,13 @@ public:
 
     bool PushPacketToDecodeQueue(std::unique_ptr<AudioStreamPacket> packet, bool wait = false);
     std::unique_ptr<AudioStreamPacket> PopPacketFromSendQueue();
+    void ClearSendQueue();
     void PlaySound(const std::string_view& sound);
     bool ReadAudioData(std::vector<int16_t>& data, int sample_rate, int samples);
     void ResetDecoder();
     void SetModelsList(srmodel_list_t* models_list);
+    // Applied by the codec task before the next frame, packet_loss > 0 turns on in-band FEC
+    void SetEncoderBitrate(int bitrate, int packet_loss);
 
 private:
     AudioCodec* codec_ = nullptr;
@@ -115,7 +122,14 @@ private:
     std::unique_ptr<AudioProcessor> audio_processor_;
     std::unique_ptr<WakeWord> wake_word_;
     std::unique_ptr<AudioDebugger> audio_debugger_;
+#if CONFIG_USE_QOS_FEEDBACK
+    std::unique_ptr<AdaptiveOpusEncoder> opus_encoder_;
+    std::atomic<int> encoder_bitrate_ = 0;
+    std::atomic<int> encoder_packet_loss_ = 0;
+    std::atomic<bool> encoder_settings_changed_ = false;
+#else
     std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
+#endif
     std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
     OpusResampler input_resampler_;
     OpusResampler reference_resampler_;
@@ -0,0 +1,439 @@
+#include "benchmarks.h"
+#include "audio_service.h"
+#include "audio_frame_batcher.h"
+#include "aes_ctr_cipher.h"
+#include "control_message.h"
+#include "cbor_codec.h"
+#include "mcp_server.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#define TAG "Benchmarks"
+
+// Estimated per-message cost of the transport below the binary protocol header
+#define WEBSOCKET_CLIENT_FRAME_OVERHEAD 6   // 2 bytes header + 4 bytes mask key
+#define TLS_RECORD_OVERHEAD 29              // Record header, explicit nonce and AES-GCM tag
+#define TCP_IP_OVERHEAD 40                  // IPv4 + TCP headers without options
+
+// Counts heap allocations made through std::basic_string
+static uint32_t allocation_count = 0;
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+    CountingAllocator() = default;
+    template <typename U> CountingAllocator(const CountingAllocator<U>&) {}
+    T* allocate(size_t n) {
+        allocation_count++;
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        std::allocator<T>().deallocate(p, n);
+    }
+    template <typename U> bool operator==(const CountingAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const CountingAllocator<U>&) const { return false; }
+};
+
+using CountedString = std::basic_string<char, std::char_traits<char>, CountingAllocator<char>>;
+
+struct BenchmarkSuite {
+    const char* name;
+    cJSON* (*run)();
+};
+
+static const BenchmarkSuite kSuites[] = {
+    {"audio_batch", Benchmarks::RunAudioBatch},
+    {"aes", Benchmarks::RunAes},
+    {"control_message", Benchmarks::RunControlMessage},
+    {"cbor", Benchmarks::RunCbor},
+    {"mcp_tools", Benchmarks::RunMcpTools},
+};
+
+cJSON* Benchmarks::Run(const std::string& suite) {
+    for (auto& s : kSuites) {
+        if (suite == s.name) {
+            ESP_LOGI(TAG, "Running benchmark: %s", s.name);
+            auto start_time = esp_timer_get_time();
+            cJSON* result = s.run();
+            cJSON_AddStringToObject(result, "suite", s.name);
+            cJSON_AddNumberToObject(result, "elapsed_ms", (esp_timer_get_time() - start_time) / 1000);
+            return result;
+        }
+    }
+    throw std::runtime_error("Unknown benchmark suite: " + suite + ", available: " + GetSuiteNames());
+}
+
+std::string Benchmarks::GetSuiteNames() {
+    std::string names;
+    for (auto& s : kSuites) {
+        if (!names.empty()) {
+            names += ",";
+        }
+        names += s.name;
+    }
+    return names;
+}
+
+// Loopback of the uplink audio path: batch, serialize, then parse the batch again.
+// Wire bytes include the estimated WebSocket, TLS and TCP/IP overhead of each message.
+cJSON* Benchmarks::RunAudioBatch() {
+    const int frame_count = 600;
+    const size_t frame_size = 120;
+    const int transport_overhead = WEBSOCKET_CLIENT_FRAME_OVERHEAD + TLS_RECORD_OVERHEAD + TCP_IP_OVERHEAD;
+
+    cJSON* results = cJSON_CreateArray();
+    AudioFrameBatcher batcher;
+    std::string buffer;
+    uint8_t frame[frame_size];
+    memset(frame, 0x5a, sizeof(frame));
+
+    for (int frames_per_message = 1; frames_per_message <= 4; frames_per_message++) {
+        // A fake RTT selects the number of frames per message
+        batcher.SetLatencyBudget(frames_per_message * OPUS_FRAME_DURATION_MS);
+        batcher.SetLinkRtt((frames_per_message - 1) * 100);
+
+        int messages = 0;
+        int parsed_frames = 0;
+        size_t wire_bytes = 0;
+        auto start_time = esp_timer_get_time();
+        for (int i = 0; i < frame_count; i++) {
+            auto packet = std::make_unique<AudioStreamPacket>();
+            packet->frame_duration = OPUS_FRAME_DURATION_MS;
+            packet->payload.assign(frame, frame + frame_size);
+            if (!batcher.Add(std::move(packet))) {
+                continue;
+            }
+            int count = batcher.frame_count();
+            buffer.resize(sizeof(BinaryProtocol4));
+            auto timestamp = batcher.Serialize(buffer);
+            AudioFrameBatcher::Parse((const uint8_t*)buffer.data() + sizeof(BinaryProtocol4), buffer.size() - sizeof(BinaryProtocol4),
+                count, timestamp, [&parsed_frames](const uint8_t*, size_t, uint32_t) {
+                    parsed_frames++;
+                });
+            messages++;
+            wire_bytes += buffer.size() + transport_overhead;
+        }
+        auto elapsed_us = esp_timer_get_time() - start_time;
+
+        // A single frame goes out as BinaryProtocol3 without the frame table
+        if (frames_per_message == 1) {
+            wire_bytes = frame_count * (sizeof(BinaryProtocol3) + frame_size + transport_overhead);
+        }
+        int audio_ms = frame_count * OPUS_FRAME_DURATION_MS;
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "frames_per_message", frames_per_message);
+        cJSON_AddNumberToObject(item, "messages_per_second", messages * 1000.0 / audio_ms);
+        cJSON_AddNumberToObject(item, "wire_bytes_per_second", wire_bytes * 1000.0 / audio_ms);
+        cJSON_AddNumberToObject(item, "overhead_percent", 100.0 * (wire_bytes - frame_count * frame_size) / wire_bytes);
+        cJSON_AddNumberToObject(item, "cpu_us_per_message", messages > 0 ? (double)elapsed_us / messages : 0);
+        cJSON_AddBoolToObject(item, "loopback_ok", parsed_frames == messages * frames_per_message);
+        cJSON_AddItemToArray(results, item);
+    }
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "frame_bytes", frame_size);
+    cJSON_AddNumberToObject(json, "frame_duration_ms", OPUS_FRAME_DURATION_MS);
+    cJSON_AddItemToObject(json, "results", results);
+    return json;
+}
+
+// UDP audio encryption: the previous per-packet path (nonce and ciphertext strings, fresh
+// stream block) against AesCtrCipher encrypting in a reused send buffer
+cJSON* Benchmarks::RunAes() {
+    const int packet_count = 1000;
+    const size_t payload_sizes[] = {120, 480};
+    uint8_t key[16];
+    memset(key, 0x11, sizeof(key));
+    CountedString nonce_template(AES_CTR_NONCE_SIZE, '\x01');
+
+    cJSON* results = cJSON_CreateArray();
+    for (auto payload_size : payload_sizes) {
+        std::string payload(payload_size, '\x5a');
+
+        // Previous implementation
+        mbedtls_aes_context ctx;
+        mbedtls_aes_init(&ctx);
+        mbedtls_aes_setkey_enc(&ctx, key, 128);
+        allocation_count = 0;
+        auto start_time = esp_timer_get_time();
+        for (int i = 0; i < packet_count; i++) {
+            CountedString nonce(nonce_template);
+            *(uint32_t*)&nonce[12] = i;
+            CountedString encrypted;
+            encrypted.resize(nonce.size() + payload.size());
+            memcpy(encrypted.data(), nonce.data(), nonce.size());
+            size_t nc_off = 0;
+            uint8_t stream_block[16] = {0};
+            mbedtls_aes_crypt_ctr(&ctx, payload.size(), &nc_off, (uint8_t*)nonce.data(), stream_block,
+                (const uint8_t*)payload.data(), (uint8_t*)&encrypted[nonce.size()]);
+        }
+        auto legacy_us = esp_timer_get_time() - start_time;
+        auto legacy_allocations = allocation_count;
+        mbedtls_aes_free(&ctx);
+
+        // In place on a reused buffer
+        AesCtrCipher cipher;
+        cipher.SetKey(key, 128);
+        CountedString buffer;
+        allocation_count = 0;
+        start_time = esp_timer_get_time();
+        for (int i = 0; i < packet_count; i++) {
+            buffer.resize(AES_CTR_NONCE_SIZE + payload.size());
+            auto header = (uint8_t*)buffer.data();
+            memcpy(header, nonce_template.data(), AES_CTR_NONCE_SIZE);
+            *(uint32_t*)&header[12] = i;
+            memcpy(header + AES_CTR_NONCE_SIZE, payload.data(), payload.size());
+            cipher.Crypt(header, header + AES_CTR_NONCE_SIZE, header + AES_CTR_NONCE_SIZE, payload.size());
+        }
+        auto in_place_us = esp_timer_get_time() - start_time;
+        auto in_place_allocations = allocation_count;
+
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "payload_bytes", payload_size);
+        cJSON_AddNumberToObject(item, "legacy_us_per_packet", (double)legacy_us / packet_count);
+        cJSON_AddNumberToObject(item, "legacy_heap_ops_per_packet", (double)legacy_allocations / packet_count);
+        cJSON_AddNumberToObject(item, "in_place_us_per_packet", (double)in_place_us / packet_count);
+        cJSON_AddNumberToObject(item, "in_place_heap_ops_per_packet", (double)in_place_allocations / packet_count);
+        cJSON_AddItemToArray(results, item);
+    }
+
+    cJSON* json = cJSON_CreateObject();
+#if CONFIG_MBEDTLS_HARDWARE_AES
+    cJSON_AddBoolToObject(json, "hardware_aes", true);
+#else
+    cJSON_AddBoolToObject(json, "hardware_aes", false);
+#endif
+    cJSON_AddItemToObject(json, "results", results);
+    return json;
+}
+
+// Allocations cJSON_Parse made for a tree: one per item, key and string value. Counted from the
+// tree rather than through cJSON_InitHooks, the hooks are process-wide and other tasks parse JSON too
+static uint32_t CountJsonAllocations(const cJSON* item) {
+    uint32_t count = 0;
+    for (; item != nullptr; item = item->next) {
+        count++;
+        if (item->string != nullptr && !(item->type & cJSON_StringIsConst)) {
+            count++;
+        }
+        if (item->valuestring != nullptr && !(item->type & cJSON_IsReference)) {
+            count++;
+        }
+        count += CountJsonAllocations(item->child);
+    }
+    return count;
+}
+
+// Incoming control messages: cJSON tree plus strcmp chain against the in-place scanner
+cJSON* Benchmarks::RunControlMessage() {
+    const int iterations = 500;
+    const char* messages[] = {
+        R"({"type":"tts","state":"sentence_start","text":"今天天气晴朗，最高气温二十六度，适合出门散步。","session_id":"8f1c2a7e"})",
+        R"({"type":"tts","state":"sentence_start","text":"\u4eca\u5929\u5929\u6c14\u6674\u6717","session_id":"8f1c2a7e"})",
+        R"({"type":"tts","state":"start","sample_rate":24000,"session_id":"8f1c2a7e"})",
+        R"({"type":"stt","text":"明天北京天气怎么样","session_id":"8f1c2a7e"})",
+        R"({"type":"llm","text":"😊","emotion":"happy","session_id":"8f1c2a7e"})",
+    };
+
+    cJSON* results = cJSON_CreateArray();
+    JsonArena arena;
+    for (auto json : messages) {
+        size_t length = strlen(json);
+        int matched = 0;
+
+        auto start_time = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++) {
+            cJSON* root = cJSON_ParseWithLength(json, length);
+            auto type = cJSON_GetObjectItem(root, "type");
+            if (strcmp(type->valuestring, "tts") == 0 || strcmp(type->valuestring, "stt") == 0 ||
+                strcmp(type->valuestring, "llm") == 0) {
+                auto state = cJSON_GetObjectItem(root, "state");
+                auto text = cJSON_GetObjectItem(root, "text");
+                matched += cJSON_IsString(state) || cJSON_IsString(text);
+            }
+            cJSON_Delete(root);
+        }
+        auto cjson_us = esp_timer_get_time() - start_time;
+        cJSON* root = cJSON_ParseWithLength(json, length);
+        auto cjson_allocations = CountJsonAllocations(root);
+        cJSON_Delete(root);
+
+        start_time = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++) {
+            ControlMessage message;
+            if (ScanControlMessage(std::string_view(json, length), arena, message)) {
+                matched -= !message.text.empty() || !message.state.empty();
+            }
+        }
+        auto scanner_us = esp_timer_get_time() - start_time;
+
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "bytes", length);
+        cJSON_AddNumberToObject(item, "cjson_us_per_message", (double)cjson_us / iterations);
+        cJSON_AddNumberToObject(item, "cjson_heap_ops_per_message", cjson_allocations);
+        cJSON_AddNumberToObject(item, "scanner_us_per_message", (double)scanner_us / iterations);
+        cJSON_AddBoolToObject(item, "same_fields", matched == 0);
+        cJSON_AddItemToArray(results, item);
+    }
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddItemToObject(json, "results", results);
+    return json;
+}
+
+// JSON -> CBOR -> JSON loopback of typical control and MCP messages. Messages are built and parsed
+// as JSON either way, the transcode is the CPU cost CBOR adds on top of the JSON-only path
+cJSON* Benchmarks::RunCbor() {
+    const int iterations = 200;
+    std::string tools_list = R"({"session_id":"8f1c2a7e","type":"mcp","payload":{"jsonrpc":"2.0","id":2,"result":{"tools":[)";
+    for (int i = 0; i < 12; i++) {
+        if (i > 0) {
+            tools_list += ",";
+        }
+        tools_list += R"({"name":"self.audio_speaker.set_volume_)" + std::to_string(i) +
+            R"(","description":"Set the volume of the audio speaker. If the current volume is unknown, you must call `self.get_device_status` tool first and then call this tool.","inputSchema":{"type":"object","properties":{"volume":{"type":"integer","minimum":0,"maximum":100}},"required":["volume"]}})";
+    }
+    tools_list += R"(],"nextCursor":"self.screen.set_brightness"}}})";
+    const std::string messages[] = {
+        R"({"session_id":"8f1c2a7e","type":"listen","state":"start","mode":"auto"})",
+        R"({"type":"tts","state":"sentence_start","text":"今天天气晴朗，最高气温二十六度。","session_id":"8f1c2a7e"})",
+        R"({"session_id":"8f1c2a7e","type":"mcp","payload":{"jsonrpc":"2.0","id":7,"result":{"content":[{"type":"text","text":"{\"audio_speaker\":{\"volume\":70},\"screen\":{\"brightness\":80,\"theme\":\"light\"},\"network\":{\"type\":\"cellular\",\"signal\":\"medium\"}}"}],"isError":false}}})",
+        tools_list,
+    };
+
+    cJSON* results = cJSON_CreateArray();
+    std::string cbor;
+    std::string json;
+    for (auto& message : messages) {
+        auto start_time = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++) {
+            cbor.clear();
+            CborCodec::FromJson(message, cbor);
+        }
+        auto encode_us = esp_timer_get_time() - start_time;
+
+        start_time = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++) {
+            json.clear();
+            CborCodec::ToJson((const uint8_t*)cbor.data(), cbor.size(), json);
+        }
+        auto decode_us = esp_timer_get_time() - start_time;
+
+        // What receiving the message costs without CBOR
+        start_time = esp_timer_get_time();
+        for (int i = 0; i < iterations; i++) {
+            cJSON_Delete(cJSON_ParseWithLength(message.data(), message.size()));
+        }
+        auto parse_us = esp_timer_get_time() - start_time;
+
+        cJSON* original = cJSON_Parse(message.c_str());
+        cJSON* decoded = cJSON_Parse(json.c_str());
+        cJSON* item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "json_bytes", message.size());
+        cJSON_AddNumberToObject(item, "cbor_bytes", cbor.size());
+        cJSON_AddNumberToObject(item, "encode_us_per_message", (double)encode_us / iterations);
+        cJSON_AddNumberToObject(item, "decode_us_per_message", (double)decode_us / iterations);
+        cJSON_AddNumberToObject(item, "json_parse_us_per_message", (double)parse_us / iterations);
+        cJSON_AddNumberToObject(item, "cbor_receive_us_per_message", (double)(decode_us + parse_us) / iterations);
+        cJSON_AddBoolToObject(item, "loopback_ok", cJSON_Compare(original, decoded, true));
+        cJSON_AddItemToArray(results, item);
+        cJSON_Delete(original);
+        cJSON_Delete(decoded);
+    }
+
+    cJSON* result = cJSON_CreateObject();
+    cJSON_AddItemToObject(result, "results", results);
+    return result;
+}
+
+// Tool registry of 64 tools: name lookup, schema serialization and argument lookup,
+// each against the linear search or per-request serialization it replaced
+cJSON* Benchmarks::RunMcpTools() {
+    const int tool_count = 64;
+    const int iterations = 100;
+    std::vector<McpTool*> tools;
+    McpToolIndex index;
+    for (int i = 0; i < tool_count; i++) {
+        PropertyList properties;
+        for (int j = 0; j < i % 4; j++) {
+            properties.AddProperty(Property("argument_" + std::to_string(j), kPropertyTypeInteger, 0, 0, 100));
+        }
+        auto tool = new McpTool("self.benchmark.device_" + std::to_string(i / 8) + ".set_property_" + std::to_string(i),
+            "Set a property of a device. If the current value is unknown, call `self.get_device_status` first.",
+            properties, [](const PropertyList&) -> ReturnValue { return true; });
+        index.Insert(tool->name(), tools.size());
+        tools.push_back(tool);
+    }
+    std::vector<std::string> names;
+    for (auto tool : tools) {
+        names.push_back(std::string(tool->name().view()));
+    }
+
+    int found = 0;
+    auto start_time = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) {
+        for (auto& name : names) {
+            auto it = std::find_if(tools.begin(), tools.end(), [&name](const McpTool* t) { return t->name() == name; });
+            found += it != tools.end();
+        }
+    }
+    auto linear_us = esp_timer_get_time() - start_time;
+    start_time = esp_timer_get_time();
+    for (int i = 0; i < iterations; i++) {
+        for (auto& name : names) {
+            found -= index.Find(name, tools) >= 0;
+        }
+    }
+    auto index_us = esp_timer_get_time() - start_time;
+
+    size_t catalog_bytes = 0;
+    start_time = esp_timer_get_time();
+    for (auto tool : tools) {
+        catalog_bytes += tool->BuildJson().size();
+    }
+    auto build_us = esp_timer_get_time() - start_time;
+    for (auto tool : tools) {
+        tool->to_json();
+    }
+    std::string catalog;
+    catalog.reserve(catalog_bytes);
+    start_time = esp_timer_get_time();
+    for (auto tool : tools) {
+        catalog += tool->to_json();
+    }
+    auto cached_us = esp_timer_get_time() - start_time;
+
+    auto& properties = tools[tool_count - 1]->properties();
+    const std::string argument = "argument_2";
+    int values = 0;
+    start_time = esp_timer_get_time();
+    for (int i = 0; i < iterations * 10; i++) {
+        values += properties[argument].max_value();
+    }
+    auto property_us = esp_timer_get_time() - start_time;
+
+    for (auto tool : tools) {
+        delete tool;
+    }
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "tools", tool_count);
+    cJSON_AddNumberToObject(json, "linear_lookup_us", (double)linear_us / (iterations * tool_count));
+    cJSON_AddNumberToObject(json, "index_lookup_us", (double)index_us / (iterations * tool_count));
+    cJSON_AddBoolToObject(json, "same_results", found == 0);
+    cJSON_AddNumberToObject(json, "catalog_bytes", catalog_bytes);
+    cJSON_AddNumberToObject(json, "serialize_catalog_us", build_us);
+    cJSON_AddNumberToObject(json, "cached_catalog_us", cached_us);
+    cJSON_AddBoolToObject(json, "same_catalog", catalog.size() == catalog_bytes);
+    cJSON_AddNumberToObject(json, "property_lookup_us", (double)property_us / (iterations * 10));
+    cJSON_AddBoolToObject(json, "same_property", values == iterations * 10 * 100);
+    return json;
+}
@@ -0,0 +1,25 @@
+#ifndef _BENCHMARKS_H_
+#define _BENCHMARKS_H_
+
+#include <cJSON.h>
+#include <string>
+
+/*
+ * On-device micro benchmarks, exposed through the self.benchmark.run tool when
+ * CONFIG_USE_BENCHMARK_TOOLS is enabled. Each suite returns a JSON report.
+ */
+class Benchmarks {
+public:
+    // Throws std::runtime_error if the suite does not exist
+    static cJSON* Run(const std::string& suite);
+    static std::string GetSuiteNames();
+
+    // Suites
+    static cJSON* RunAudioBatch();
+    static cJSON* RunAes();
+    static cJSON* RunControlMessage();
+    static cJSON* RunCbor();
+    static cJSON* RunMcpTools();
+};
+
+#endif // _BENCHMARKS_H_
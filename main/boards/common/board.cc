@@ -1,6 +1,7 @@
 #include "board.h"
 #include "system_info.h"
 #include "settings.h"
+#include "boot_graph.h"
 #include "display/display.h"
 #include "display/oled_display.h"
 #include "assets/lang_config.h"
@@ -170,6 +171,12 @@ std::string Board::GetSystemInfoJson() {
     }
     json += R"(},)";
 
+    // Timeline of the last completed boot, the one before this during the OTA check
+    auto boot_timeline = BootGraph::GetLastTimelineJson();
+    if (!boot_timeline.empty()) {
+        json += R"("boot_timeline":)" + boot_timeline + R"(,)";
+    }
+
     json += R"("board":)" + GetBoardJson();
 
     // Close the JSON object
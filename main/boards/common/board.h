@@ -53,6 +53,8 @@ public:
     virtual std::string GetBoardJson() = 0;
     virtual std::string GetDeviceStatusJson() = 0;
     virtual Assets* GetAssets();
+    // Called every second with the link figures of the protocol, true if the board switched to another network
+    virtual bool CheckNetworkFailover(int rtt_ms, int loss_percent) { return false; }
 };
 
 #define DECLARE_BOARD(BOARD_CLASS_NAME) \
@@ -4,9 +4,18 @@
 #include "assets/lang_config.h"
 #include "settings.h"
 #include <esp_log.h>
+#include <wifi_station.h>
 
 static const char *TAG = "DualNetworkBoard";
 
+// Wi-Fi counts as degraded when one of these holds for FAILOVER_DEGRADED_SECONDS in a conversation
+#define FAILOVER_RSSI_THRESHOLD -80
+#define FAILOVER_RTT_THRESHOLD_MS 800
+#define FAILOVER_LOSS_THRESHOLD 10
+#define FAILOVER_DEGRADED_SECONDS 3
+// Back on Wi-Fi after it has been healthy this long, only between conversations
+#define FAILBACK_HEALTHY_SECONDS 30
+
 DualNetworkBoard::DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin, int32_t default_net_type) 
     : Board(), 
       ml307_tx_pin_(ml307_tx_pin), 
@@ -35,11 +44,12 @@ void DualNetworkBoard::SaveNetworkTypeToSettings(NetworkType type) {
 void DualNetworkBoard::InitializeCurrentBoard() {
     if (network_type_ == NetworkType::ML307) {
         ESP_LOGI(TAG, "Initialize ML307 board");
-        current_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_dtr_pin_);
+        primary_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_dtr_pin_);
     } else {
         ESP_LOGI(TAG, "Initialize WiFi board");
-        current_board_ = std::make_unique<WifiBoard>();
+        primary_board_ = std::make_unique<WifiBoard>();
     }
+    current_board_ = primary_board_.get();
 }
 
 void DualNetworkBoard::SwitchNetworkType() {
@@ -58,7 +68,7 @@ void DualNetworkBoard::SwitchNetworkType() {
 
  
 std::string DualNetworkBoard::GetBoardType() {
-    return current_board_->GetBoardType();
+    return current_board_.load()->GetBoardType();
 }
 
 void DualNetworkBoard::StartNetwork() {
@@ -69,25 +79,95 @@ void DualNetworkBoard::StartNetwork() {
     } else {
         display->SetStatus(Lang::Strings::DETECTING_MODULE);
     }
-    current_board_->StartNetwork();
+    primary_board_->StartNetwork();
+
+#if CONFIG_USE_NETWORK_FAILOVER
+    if (network_type_ == NetworkType::WIFI) {
+        StartStandbyNetwork();
+    }
+#endif
+}
+
+// The modem registers in its own task, Wi-Fi stays in use meanwhile
+void DualNetworkBoard::StartStandbyNetwork() {
+    standby_board_ = std::make_unique<Ml307Board>(ml307_tx_pin_, ml307_rx_pin_, ml307_dtr_pin_);
+    xTaskCreate([](void* arg) {
+        auto board = (DualNetworkBoard*)arg;
+        auto ml307 = static_cast<Ml307Board*>(board->standby_board_.get());
+        board->standby_ready_ = ml307->StartStandby();
+        vTaskDelete(NULL);
+    }, "standby_net", 4096, this, 2, nullptr);
+}
+
+// Both boards stay alive, so a task still holding the old network interface does not crash.
+// Only the active board pointer changes, tasks calling GetNetwork() meanwhile get one or the other.
+void DualNetworkBoard::SwapToStandby() {
+    failed_over_ = !failed_over_;
+    current_board_ = failed_over_ ? standby_board_.get() : primary_board_.get();
+    network_type_ = failed_over_ ? NetworkType::ML307 : NetworkType::WIFI;
+    degraded_seconds_ = 0;
+    healthy_seconds_ = 0;
+}
+
+bool DualNetworkBoard::CheckNetworkFailover(int rtt_ms, int loss_percent) {
+    if (!standby_ready_) {
+        return false;
+    }
+
+    auto& wifi_station = WifiStation::GetInstance();
+    bool wifi_connected = wifi_station.IsConnected();
+    int rssi = wifi_connected ? wifi_station.GetRssi() : -127;
+    auto device_state = Application::GetInstance().GetDeviceState();
+
+    if (!failed_over_) {
+        if (!wifi_connected) {
+            degraded_seconds_ = FAILOVER_DEGRADED_SECONDS;
+        } else if (rssi < FAILOVER_RSSI_THRESHOLD || rtt_ms > FAILOVER_RTT_THRESHOLD_MS || loss_percent > FAILOVER_LOSS_THRESHOLD) {
+            degraded_seconds_++;
+        } else {
+            degraded_seconds_ = 0;
+        }
+        bool in_conversation = device_state == kDeviceStateListening || device_state == kDeviceStateSpeaking;
+        if (!in_conversation || degraded_seconds_ < FAILOVER_DEGRADED_SECONDS) {
+            return false;
+        }
+        ESP_LOGW(TAG, "Wi-Fi degraded (connected %d, rssi %d, rtt %d ms, loss %d%%), failing over to 4G",
+            wifi_connected, rssi, rtt_ms, loss_percent);
+        SwapToStandby();
+        GetDisplay()->ShowNotification(Lang::Strings::SWITCH_TO_4G_NETWORK);
+        return true;
+    }
+
+    if (wifi_connected && rssi >= FAILOVER_RSSI_THRESHOLD + 5) {
+        healthy_seconds_++;
+    } else {
+        healthy_seconds_ = 0;
+    }
+    if (healthy_seconds_ < FAILBACK_HEALTHY_SECONDS || device_state != kDeviceStateIdle) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Wi-Fi recovered (rssi %d), switching back", rssi);
+    SwapToStandby();
+    GetDisplay()->ShowNotification(Lang::Strings::SWITCH_TO_WIFI_NETWORK);
+    return true;
 }
 
 NetworkInterface* DualNetworkBoard::GetNetwork() {
-    return current_board_->GetNetwork();
+    return current_board_.load()->GetNetwork();
 }
 
 const char* DualNetworkBoard::GetNetworkStateIcon() {
-    return current_board_->GetNetworkStateIcon();
+    return current_board_.load()->GetNetworkStateIcon();
 }
 
 void DualNetworkBoard::SetPowerSaveMode(bool enabled) {
-    current_board_->SetPowerSaveMode(enabled);
+    current_board_.load()->SetPowerSaveMode(enabled);
 }
 
 std::string DualNetworkBoard::GetBoardJson() {   
-    return current_board_->GetBoardJson();
+    return current_board_.load()->GetBoardJson();
 }
 
 std::string DualNetworkBoard::GetDeviceStatusJson() {
-    return current_board_->GetDeviceStatusJson();
+    return current_board_.load()->GetDeviceStatusJson();
 }
@@ -5,6 +5,7 @@
 #include "wifi_board.h"
 #include "ml307_board.h"
 #include <memory>
+#include <atomic>
 
 //enum NetworkType
 enum class NetworkType {
@@ -15,9 +16,11 @@ enum class NetworkType {
 // 双网络板卡类，可以在WiFi和ML307之间切换
 class DualNetworkBoard : public Board {
 private:
-    // 使用基类指针存储当前活动的板卡
-    std::unique_ptr<Board> current_board_;
-    NetworkType network_type_ = NetworkType::ML307;  // Default to ML307
+    // 启动时初始化的板卡
+    std::unique_ptr<Board> primary_board_;
+    // 当前活动的板卡，故障切换时在主循环中更新，其他任务随时读取
+    std::atomic<Board*> current_board_ = nullptr;
+    std::atomic<NetworkType> network_type_ = NetworkType::ML307;  // Default to ML307
 
     // ML307的引脚配置
     gpio_num_t ml307_tx_pin_;
@@ -32,6 +35,16 @@ private:
 
     // 初始化当前网络类型对应的板卡
     void InitializeCurrentBoard();
+
+    // Wi-Fi 为主网络时，ML307 在后台注册网络作为备用，会话中 Wi-Fi 变差时无缝切换
+    std::unique_ptr<Board> standby_board_;
+    std::atomic<bool> standby_ready_ = false;
+    bool failed_over_ = false;
+    int degraded_seconds_ = 0;
+    int healthy_seconds_ = 0;
+
+    void StartStandbyNetwork();
+    void SwapToStandby();
  
 public:
     DualNetworkBoard(gpio_num_t ml307_tx_pin, gpio_num_t ml307_rx_pin, gpio_num_t ml307_dtr_pin = GPIO_NUM_NC, int32_t default_net_type = 1);
@@ -44,7 +57,7 @@ public:
     NetworkType GetNetworkType() const { return network_type_; }
     
     // 获取当前活动的板卡引用
-    Board& GetCurrentBoard() const { return *current_board_; }
+    Board& GetCurrentBoard() const { return *current_board_.load(); }
     
     // 重写Board接口
     virtual std::string GetBoardType() override;
@@ -54,6 +67,7 @@ public:
     virtual void SetPowerSaveMode(bool enabled) override;
     virtual std::string GetBoardJson() override;
     virtual std::string GetDeviceStatusJson() override;
+    virtual bool CheckNetworkFailover(int rtt_ms, int loss_percent) override;
 };
 
 #endif // DUAL_NETWORK_BOARD_H 
\ No newline at end of file
@@ -243,6 +243,7 @@ std::string Esp32Camera::Explain(const std::string& question) {
     }
     // 结束块
     http->Write("", 0);
+    McpServer::GetInstance().ReportProgress(2, 3, "uploaded");
 
     if (http->GetStatusCode() != 200) {
         ESP_LOGE(TAG, "Failed to upload photo, status code: %d", http->GetStatusCode());
@@ -251,6 +252,7 @@ std::string Esp32Camera::Explain(const std::string& question) {
 
     std::string result = http->ReadAll();
     http->Close();
+    McpServer::GetInstance().ReportProgress(3, 3, "explained");
 
     // Get remain task stack size
     size_t remain_stack_size = uxTaskGetStackHighWaterMark(nullptr);
@@ -68,6 +68,27 @@ void Ml307Board::StartNetwork() {
     ESP_LOGI(TAG, "ML307 ICCID: %s", iccid.c_str());
 }
 
+bool Ml307Board::StartStandby() {
+    for (int i = 0; i < 3 && modem_ == nullptr; i++) {
+        modem_ = AtModem::Detect(tx_pin_, rx_pin_, dtr_pin_, 921600);
+        if (modem_ == nullptr) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+    }
+    if (modem_ == nullptr) {
+        ESP_LOGW(TAG, "No modem detected for standby");
+        return false;
+    }
+
+    auto result = modem_->WaitForNetworkReady();
+    if (result != NetworkStatus::Ready) {
+        ESP_LOGW(TAG, "Standby modem is not registered: %d", (int)result);
+        return false;
+    }
+    ESP_LOGI(TAG, "Standby modem ready, CSQ: %d", modem_->GetCsq());
+    return true;
+}
+
 NetworkInterface* Ml307Board::GetNetwork() {
     return modem_.get();
 }
@@ -102,6 +102,9 @@ void WifiBoard::StartNetwork() {
         notification += ssid;
         display->ShowNotification(notification.c_str(), 30000);
     });
+#if CONFIG_USE_WIFI_FAST_CONNECT
+    fast_connect_.Begin();
+#endif
     wifi_station.Start();
 
     // Try to connect to WiFi, if failed, launch the WiFi configuration AP
@@ -111,6 +114,9 @@ void WifiBoard::StartNetwork() {
         EnterWifiConfigMode();
         return;
     }
+#if CONFIG_USE_WIFI_FAST_CONNECT
+    fast_connect_.Save();
+#endif
 }
 
 NetworkInterface* WifiBoard::GetNetwork() {
@@ -147,6 +153,12 @@ std::string WifiBoard::GetBoardJson() {
         board_json += R"("rssi":)" + std::to_string(wifi_station.GetRssi()) + R"(,)";
         board_json += R"("channel":)" + std::to_string(wifi_station.GetChannel()) + R"(,)";
         board_json += R"("ip":")" + wifi_station.GetIpAddress() + R"(",)";
+#if CONFIG_USE_WIFI_FAST_CONNECT
+        auto connect_json = fast_connect_.GetMetricsJson();
+        if (!connect_json.empty()) {
+            board_json += R"("connect":)" + connect_json + R"(,)";
+        }
+#endif
     }
     board_json += R"("mac":")" + SystemInfo::GetMacAddress() + R"(")";
     board_json += R"(})";
@@ -3,9 +3,16 @@
 
 #include "board.h"
 
+#if CONFIG_USE_WIFI_FAST_CONNECT
+#include "wifi_fast_connect.h"
+#endif
+
 class WifiBoard : public Board {
 protected:
     bool wifi_config_mode_ = false;
+#if CONFIG_USE_WIFI_FAST_CONNECT
+    WifiFastConnect fast_connect_;
+#endif
     void EnterWifiConfigMode();
     virtual std::string GetBoardJson() override;
 
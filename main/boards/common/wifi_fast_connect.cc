@@ -0,0 +1,166 @@
+#include "wifi_fast_connect.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_netif.h>
+#include <ssid_manager.h>
+#include <algorithm>
+#include <cstdio>
+
+#define TAG "WifiFastConnect"
+
+static std::string FormatBssid(const uint8_t* bssid) {
+    char text[13];
+    snprintf(text, sizeof(text), "%02x%02x%02x%02x%02x%02x", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+    return text;
+}
+
+static bool ParseBssid(const std::string& text, uint8_t* bssid) {
+    unsigned int bytes[6];
+    if (text.size() != 12 || sscanf(text.c_str(), "%2x%2x%2x%2x%2x%2x", &bytes[0], &bytes[1], &bytes[2],
+            &bytes[3], &bytes[4], &bytes[5]) != 6) {
+        return false;
+    }
+    std::copy(bytes, bytes + 6, bssid);
+    return true;
+}
+
+WifiFastConnect::~WifiFastConnect() {
+    if (wifi_event_instance_ != nullptr) {
+        esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_instance_);
+    }
+    if (ip_event_instance_ != nullptr) {
+        esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, ip_event_instance_);
+    }
+}
+
+void WifiFastConnect::Begin() {
+    Settings settings("wifi_fast");
+    ssid_ = settings.GetString("ssid");
+    channel_ = settings.GetInt("channel");
+    ip_address_ = settings.GetString("ip");
+
+    // The access point is only probed while its SSID is still configured
+    auto ssid_list = SsidManager::GetInstance().GetSsidList();
+    bool configured = std::any_of(ssid_list.begin(), ssid_list.end(), [this](const SsidItem& item) {
+        return item.ssid == ssid_;
+    });
+    cached_ = configured && channel_ > 0 && ParseBssid(settings.GetString("bssid"), bssid_);
+    if (cached_) {
+        ESP_LOGI(TAG, "Probing %s (%s) on channel %d", ssid_.c_str(), FormatBssid(bssid_).c_str(), channel_);
+    }
+
+    // Registered ahead of WifiStation, whose handler runs after this one for the same event
+    esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &WifiFastConnect::EventHandler, this,
+        &wifi_event_instance_);
+    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &WifiFastConnect::EventHandler, this,
+        &ip_event_instance_);
+}
+
+void WifiFastConnect::EventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
+    auto this_ = static_cast<WifiFastConnect*>(arg);
+    int64_t now = esp_timer_get_time();
+    if (event_base == IP_EVENT) {
+        if (this_->got_ip_time_ != 0) {
+            return;
+        }
+        auto event = static_cast<ip_event_got_ip_t*>(event_data);
+        char ip_address[16];
+        esp_ip4addr_ntoa(&event->ip_info.ip, ip_address, sizeof(ip_address));
+        this_->got_ip_address_ = ip_address;
+        this_->got_ip_time_ = now;
+        ESP_LOGI(TAG, "Connected in %d ms: scan %d ms (%s), association %d ms, DHCP %d ms (%s)",
+            (int)((now - this_->start_time_) / 1000), (int)((this_->scan_done_time_ - this_->start_time_) / 1000),
+            this_->probe_hit_ ? "probe" : "full", (int)((this_->connected_time_ - this_->scan_done_time_) / 1000),
+            (int)((now - this_->connected_time_) / 1000),
+            this_->got_ip_address_ == this_->ip_address_ ? "lease restored" : "new lease");
+        return;
+    }
+
+    switch (event_id) {
+        case WIFI_EVENT_STA_START:
+            this_->start_time_ = now;
+            this_->OnStaStart();
+            break;
+        case WIFI_EVENT_SCAN_DONE:
+            if (this_->connected_time_ == 0) {
+                this_->scan_done_time_ = now;
+            }
+            this_->OnScanDone();
+            break;
+        case WIFI_EVENT_STA_CONNECTED:
+            if (this_->connected_time_ == 0) {
+                this_->connected_time_ = now;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void WifiFastConnect::OnStaStart() {
+    if (!cached_) {
+        return;
+    }
+    // WifiStation's full scan, requested right after this, is refused while the probe runs
+    wifi_scan_config_t scan_config = {};
+    scan_config.ssid = (uint8_t*)ssid_.c_str();
+    scan_config.bssid = bssid_;
+    scan_config.channel = channel_;
+    scan_config.scan_type = WIFI_SCAN_TYPE_ACTIVE;
+    scan_config.scan_time.active.min = 0;
+    scan_config.scan_time.active.max = WIFI_FAST_CONNECT_PROBE_TIME_MS;
+    probing_ = esp_wifi_scan_start(&scan_config, false) == ESP_OK;
+}
+
+void WifiFastConnect::OnScanDone() {
+    if (!probing_) {
+        return;
+    }
+    probing_ = false;
+    // Only count the records, WifiStation takes them after this handler
+    uint16_t count = 0;
+    esp_wifi_scan_get_ap_num(&count);
+    if (count > 0) {
+        probe_hit_ = true;
+        return;
+    }
+    ESP_LOGW(TAG, "%s not found on channel %d, scanning all channels", ssid_.c_str(), channel_);
+    esp_wifi_scan_start(nullptr, false);
+}
+
+void WifiFastConnect::Save() {
+    wifi_ap_record_t ap_info;
+    if (esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+        return;
+    }
+    std::string ssid((const char*)ap_info.ssid);
+    auto bssid = FormatBssid(ap_info.bssid);
+
+    Settings settings("wifi_fast", true);
+    if (settings.GetString("ssid") == ssid && settings.GetString("bssid") == bssid &&
+        settings.GetInt("channel") == ap_info.primary && settings.GetString("ip") == got_ip_address_) {
+        return;
+    }
+    settings.SetString("ssid", ssid);
+    settings.SetString("bssid", bssid);
+    settings.SetInt("channel", ap_info.primary);
+    settings.SetString("ip", got_ip_address_);
+    ESP_LOGI(TAG, "Saved %s (%s) on channel %d", ssid.c_str(), bssid.c_str(), ap_info.primary);
+}
+
+std::string WifiFastConnect::GetMetricsJson() const {
+    if (got_ip_time_ == 0) {
+        return "";
+    }
+    std::string json = R"({)";
+    json += R"("scan_ms":)" + std::to_string((scan_done_time_ - start_time_) / 1000) + R"(,)";
+    json += R"("assoc_ms":)" + std::to_string((connected_time_ - scan_done_time_) / 1000) + R"(,)";
+    json += R"("dhcp_ms":)" + std::to_string((got_ip_time_ - connected_time_) / 1000) + R"(,)";
+    json += R"("probe":)" + std::string(!cached_ ? R"("none")" : probe_hit_ ? R"("hit")" : R"("miss")") + R"(,)";
+    json += R"("lease_restored":)" + std::string(got_ip_address_ == ip_address_ ? "true" : "false");
+    json += R"(})";
+    return json;
+}
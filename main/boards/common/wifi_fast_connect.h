@@ -0,0 +1,60 @@
+#ifndef WIFI_FAST_CONNECT_H
+#define WIFI_FAST_CONNECT_H
+
+#include <esp_event.h>
+#include <cstdint>
+#include <string>
+
+/*
+ * Shortens the Wi-Fi connect at boot when the device comes back to the same access point.
+ *
+ * WifiStation begins with a scan of every channel. After a connect the BSSID, channel and IP
+ * address are kept in NVS, and on the next start that scan is replaced by a probe of the
+ * cached BSSID on the cached channel. WifiStation takes the single result and associates as
+ * usual. If the probe finds nothing, the full scan starts right away and the cache is rewritten
+ * after the connect. lwIP restores the DHCP lease (LWIP_DHCP_RESTORE_LAST_IP): the client asks for
+ * its last address and skips the discovery round, also on reconnects.
+ *
+ * The first connect is timed in phases: scan, association and DHCP. The driver reports
+ * authentication, association and the key handshake as one event, so the association phase
+ * covers all three.
+ */
+#define WIFI_FAST_CONNECT_PROBE_TIME_MS 120
+
+class WifiFastConnect {
+public:
+    WifiFastConnect() = default;
+    ~WifiFastConnect();
+    WifiFastConnect(const WifiFastConnect&) = delete;
+    WifiFastConnect& operator=(const WifiFastConnect&) = delete;
+
+    // Must be called before WifiStation::Start(), so the probe runs in place of its scan
+    void Begin();
+    // Call once connected, keeps the access point for the next start
+    void Save();
+    std::string GetMetricsJson() const;
+
+private:
+    esp_event_handler_instance_t wifi_event_instance_ = nullptr;
+    esp_event_handler_instance_t ip_event_instance_ = nullptr;
+
+    std::string ssid_;
+    uint8_t bssid_[6] = {};
+    int channel_ = 0;
+    std::string ip_address_;
+    bool cached_ = false;
+    bool probing_ = false;
+    bool probe_hit_ = false;
+
+    int64_t start_time_ = 0;
+    int64_t scan_done_time_ = 0;
+    int64_t connected_time_ = 0;
+    int64_t got_ip_time_ = 0;
+    std::string got_ip_address_;
+
+    static void EventHandler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
+    void OnStaStart();
+    void OnScanDone();
+};
+
+#endif // WIFI_FAST_CONNECT_H
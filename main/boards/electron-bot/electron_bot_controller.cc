@@ -110,6 +110,14 @@ private:
         StartActionTaskIfNeeded();
     }
 
+    // Moves wait for room in the action queue, they run on an MCP tool worker in call order instead of the main loop
+    void AddMotionTool(const char* name, const char* description, const PropertyList& properties,
+                       std::function<ReturnValue(const PropertyList&)> callback) {
+        auto tool = new McpTool(name, description, properties, callback);
+        tool->set_policy(kMcpToolPolicyExclusive, "electron.motion");
+        McpServer::GetInstance().AddTool(tool);
+    }
+
     void StartActionTaskIfNeeded() {
         if (action_task_handle_ == nullptr) {
             xTaskCreate(ActionTask, "electron_bot_action", 1024 * 4, this, configMAX_PRIORITIES - 1,
@@ -149,7 +157,7 @@ public:
         ESP_LOGI(TAG, "开始注册Electron Bot MCP工具...");
 
         // 手部动作统一工具
-        mcp_server.AddTool(
+        AddMotionTool(
             "self.electron.hand_action",
             "手部动作控制。action: 1=举手, 2=放手, 3=挥手, 4=拍打; hand: 1=左手, 2=右手, 3=双手; "
             "steps: 动作重复次数(1-10); speed: 动作速度(500-1500，数值越小越快); amount: "
@@ -194,7 +202,7 @@ public:
             });
 
         // 身体动作
-        mcp_server.AddTool(
+        AddMotionTool(
             "self.electron.body_turn",
             "身体转向。steps: 转向步数(1-10); speed: 转向速度(500-1500，数值越小越快); direction: "
             "转向方向(1=左转, 2=右转, 3=回中心); angle: 转向角度(0-90度)",
@@ -228,25 +236,25 @@ public:
             });
 
         // 头部动作
-        mcp_server.AddTool("self.electron.head_move",
-                           "头部运动。action: 1=抬头, 2=低头, 3=点头, 4=回中心, 5=连续点头; steps: "
-                           "动作重复次数(1-10); speed: 动作速度(500-1500，数值越小越快); angle: "
-                           "头部转动角度(1-15度)",
-                           PropertyList({Property("action", kPropertyTypeInteger, 3, 1, 5),
-                                         Property("steps", kPropertyTypeInteger, 1, 1, 10),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
-                                         Property("angle", kPropertyTypeInteger, 5, 1, 15)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int action_num = properties["action"].value<int>();
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               int amount = properties["angle"].value<int>();
-                               int action = ACTION_HEAD_UP + (action_num - 1);
-                               QueueAction(action, steps, speed, 0, amount);
-                               return true;
-                           });
-
-        // 系统工具
+        AddMotionTool("self.electron.head_move",
+                      "头部运动。action: 1=抬头, 2=低头, 3=点头, 4=回中心, 5=连续点头; steps: "
+                      "动作重复次数(1-10); speed: 动作速度(500-1500，数值越小越快); angle: "
+                      "头部转动角度(1-15度)",
+                      PropertyList({Property("action", kPropertyTypeInteger, 3, 1, 5),
+                                    Property("steps", kPropertyTypeInteger, 1, 1, 10),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
+                                    Property("angle", kPropertyTypeInteger, 5, 1, 15)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int action_num = properties["action"].value<int>();
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          int amount = properties["angle"].value<int>();
+                          int action = ACTION_HEAD_UP + (action_num - 1);
+                          QueueAction(action, steps, speed, 0, amount);
+                          return true;
+                      });
+
+        // 系统工具，停止留在主循环执行，不排在动作之后
         mcp_server.AddTool("self.electron.stop", "立即停止", PropertyList(),
                            [this](const PropertyList& properties) -> ReturnValue {
                                // 清空队列但保持任务常驻
@@ -262,7 +270,7 @@ public:
                            });
 
         // 单个舵机校准工具
-        mcp_server.AddTool(
+        AddMotionTool(
             "self.electron.set_trim",
             "校准单个舵机位置。设置指定舵机的微调参数以调整ElectronBot的初始姿态，设置将永久保存。"
             "servo_type: 舵机类型(right_pitch:右臂旋转, right_roll:右臂推拉, left_pitch:左臂旋转, "
@@ -158,6 +158,14 @@ private:
         StartActionTaskIfNeeded();
     }
 
+    // Moves wait for room in the action queue, they run on an MCP tool worker in call order instead of the main loop
+    void AddMotionTool(const char* name, const char* description, const PropertyList& properties,
+                       std::function<ReturnValue(const PropertyList&)> callback) {
+        auto tool = new McpTool(name, description, properties, callback);
+        tool->set_policy(kMcpToolPolicyExclusive, "otto.motion");
+        McpServer::GetInstance().AddTool(tool);
+    }
+
     void LoadTrimsFromNVS() {
         Settings settings("otto_trims", false);
 
@@ -197,125 +205,125 @@ public:
         ESP_LOGI(TAG, "开始注册MCP工具...");
 
         // 基础移动动作
-        mcp_server.AddTool("self.otto.walk_forward",
-                           "行走。steps: 行走步数(1-100); speed: 行走速度(500-1500，数值越小越快); "
-                           "direction: 行走方向(-1=后退, 1=前进); arm_swing: 手臂摆动幅度(0-170度)",
-                           PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
-                                         Property("arm_swing", kPropertyTypeInteger, 50, 0, 170),
-                                         Property("direction", kPropertyTypeInteger, 1, -1, 1)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               int arm_swing = properties["arm_swing"].value<int>();
-                               int direction = properties["direction"].value<int>();
-                               QueueAction(ACTION_WALK, steps, speed, direction, arm_swing);
-                               return true;
-                           });
-
-        mcp_server.AddTool("self.otto.turn_left",
-                           "转身。steps: 转身步数(1-100); speed: 转身速度(500-1500，数值越小越快); "
-                           "direction: 转身方向(1=左转, -1=右转); arm_swing: 手臂摆动幅度(0-170度)",
-                           PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
-                                         Property("arm_swing", kPropertyTypeInteger, 50, 0, 170),
-                                         Property("direction", kPropertyTypeInteger, 1, -1, 1)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               int arm_swing = properties["arm_swing"].value<int>();
-                               int direction = properties["direction"].value<int>();
-                               QueueAction(ACTION_TURN, steps, speed, direction, arm_swing);
-                               return true;
-                           });
-
-        mcp_server.AddTool("self.otto.jump",
-                           "跳跃。steps: 跳跃次数(1-100); speed: 跳跃速度(500-1500，数值越小越快)",
-                           PropertyList({Property("steps", kPropertyTypeInteger, 1, 1, 100),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               QueueAction(ACTION_JUMP, steps, speed, 0, 0);
-                               return true;
-                           });
+        AddMotionTool("self.otto.walk_forward",
+                      "行走。steps: 行走步数(1-100); speed: 行走速度(500-1500，数值越小越快); "
+                      "direction: 行走方向(-1=后退, 1=前进); arm_swing: 手臂摆动幅度(0-170度)",
+                      PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
+                                    Property("arm_swing", kPropertyTypeInteger, 50, 0, 170),
+                                    Property("direction", kPropertyTypeInteger, 1, -1, 1)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          int arm_swing = properties["arm_swing"].value<int>();
+                          int direction = properties["direction"].value<int>();
+                          QueueAction(ACTION_WALK, steps, speed, direction, arm_swing);
+                          return true;
+                      });
+
+        AddMotionTool("self.otto.turn_left",
+                      "转身。steps: 转身步数(1-100); speed: 转身速度(500-1500，数值越小越快); "
+                      "direction: 转身方向(1=左转, -1=右转); arm_swing: 手臂摆动幅度(0-170度)",
+                      PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
+                                    Property("arm_swing", kPropertyTypeInteger, 50, 0, 170),
+                                    Property("direction", kPropertyTypeInteger, 1, -1, 1)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          int arm_swing = properties["arm_swing"].value<int>();
+                          int direction = properties["direction"].value<int>();
+                          QueueAction(ACTION_TURN, steps, speed, direction, arm_swing);
+                          return true;
+                      });
+
+        AddMotionTool("self.otto.jump",
+                      "跳跃。steps: 跳跃次数(1-100); speed: 跳跃速度(500-1500，数值越小越快)",
+                      PropertyList({Property("steps", kPropertyTypeInteger, 1, 1, 100),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          QueueAction(ACTION_JUMP, steps, speed, 0, 0);
+                          return true;
+                      });
 
         // 特殊动作
-        mcp_server.AddTool("self.otto.swing",
-                           "左右摇摆。steps: 摇摆次数(1-100); speed: "
-                           "摇摆速度(500-1500，数值越小越快); amount: 摇摆幅度(0-170度)",
-                           PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
-                                         Property("amount", kPropertyTypeInteger, 30, 0, 170)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               int amount = properties["amount"].value<int>();
-                               QueueAction(ACTION_SWING, steps, speed, 0, amount);
-                               return true;
-                           });
-
-        mcp_server.AddTool("self.otto.moonwalk",
-                           "太空步。steps: 太空步步数(1-100); speed: 速度(500-1500，数值越小越快); "
-                           "direction: 方向(1=左, -1=右); amount: 幅度(0-170度)",
-                           PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
-                                         Property("direction", kPropertyTypeInteger, 1, -1, 1),
-                                         Property("amount", kPropertyTypeInteger, 25, 0, 170)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               int direction = properties["direction"].value<int>();
-                               int amount = properties["amount"].value<int>();
-                               QueueAction(ACTION_MOONWALK, steps, speed, direction, amount);
-                               return true;
-                           });
-
-        mcp_server.AddTool("self.otto.bend",
-                           "弯曲身体。steps: 弯曲次数(1-100); speed: "
-                           "弯曲速度(500-1500，数值越小越快); direction: 弯曲方向(1=左, -1=右)",
-                           PropertyList({Property("steps", kPropertyTypeInteger, 1, 1, 100),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
-                                         Property("direction", kPropertyTypeInteger, 1, -1, 1)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               int direction = properties["direction"].value<int>();
-                               QueueAction(ACTION_BEND, steps, speed, direction, 0);
-                               return true;
-                           });
-
-        mcp_server.AddTool("self.otto.shake_leg",
-                           "摇腿。steps: 摇腿次数(1-100); speed: 摇腿速度(500-1500，数值越小越快); "
-                           "direction: 腿部选择(1=左腿, -1=右腿)",
-                           PropertyList({Property("steps", kPropertyTypeInteger, 1, 1, 100),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
-                                         Property("direction", kPropertyTypeInteger, 1, -1, 1)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               int direction = properties["direction"].value<int>();
-                               QueueAction(ACTION_SHAKE_LEG, steps, speed, direction, 0);
-                               return true;
-                           });
-
-        mcp_server.AddTool("self.otto.updown",
-                           "上下运动。steps: 上下运动次数(1-100); speed: "
-                           "运动速度(500-1500，数值越小越快); amount: 运动幅度(0-170度)",
-                           PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
-                                         Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
-                                         Property("amount", kPropertyTypeInteger, 20, 0, 170)}),
-                           [this](const PropertyList& properties) -> ReturnValue {
-                               int steps = properties["steps"].value<int>();
-                               int speed = properties["speed"].value<int>();
-                               int amount = properties["amount"].value<int>();
-                               QueueAction(ACTION_UPDOWN, steps, speed, 0, amount);
-                               return true;
-                           });
+        AddMotionTool("self.otto.swing",
+                      "左右摇摆。steps: 摇摆次数(1-100); speed: "
+                      "摇摆速度(500-1500，数值越小越快); amount: 摇摆幅度(0-170度)",
+                      PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
+                                    Property("amount", kPropertyTypeInteger, 30, 0, 170)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          int amount = properties["amount"].value<int>();
+                          QueueAction(ACTION_SWING, steps, speed, 0, amount);
+                          return true;
+                      });
+
+        AddMotionTool("self.otto.moonwalk",
+                      "太空步。steps: 太空步步数(1-100); speed: 速度(500-1500，数值越小越快); "
+                      "direction: 方向(1=左, -1=右); amount: 幅度(0-170度)",
+                      PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
+                                    Property("direction", kPropertyTypeInteger, 1, -1, 1),
+                                    Property("amount", kPropertyTypeInteger, 25, 0, 170)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          int direction = properties["direction"].value<int>();
+                          int amount = properties["amount"].value<int>();
+                          QueueAction(ACTION_MOONWALK, steps, speed, direction, amount);
+                          return true;
+                      });
+
+        AddMotionTool("self.otto.bend",
+                      "弯曲身体。steps: 弯曲次数(1-100); speed: "
+                      "弯曲速度(500-1500，数值越小越快); direction: 弯曲方向(1=左, -1=右)",
+                      PropertyList({Property("steps", kPropertyTypeInteger, 1, 1, 100),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
+                                    Property("direction", kPropertyTypeInteger, 1, -1, 1)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          int direction = properties["direction"].value<int>();
+                          QueueAction(ACTION_BEND, steps, speed, direction, 0);
+                          return true;
+                      });
+
+        AddMotionTool("self.otto.shake_leg",
+                      "摇腿。steps: 摇腿次数(1-100); speed: 摇腿速度(500-1500，数值越小越快); "
+                      "direction: 腿部选择(1=左腿, -1=右腿)",
+                      PropertyList({Property("steps", kPropertyTypeInteger, 1, 1, 100),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
+                                    Property("direction", kPropertyTypeInteger, 1, -1, 1)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          int direction = properties["direction"].value<int>();
+                          QueueAction(ACTION_SHAKE_LEG, steps, speed, direction, 0);
+                          return true;
+                      });
+
+        AddMotionTool("self.otto.updown",
+                      "上下运动。steps: 上下运动次数(1-100); speed: "
+                      "运动速度(500-1500，数值越小越快); amount: 运动幅度(0-170度)",
+                      PropertyList({Property("steps", kPropertyTypeInteger, 3, 1, 100),
+                                    Property("speed", kPropertyTypeInteger, 1000, 500, 1500),
+                                    Property("amount", kPropertyTypeInteger, 20, 0, 170)}),
+                      [this](const PropertyList& properties) -> ReturnValue {
+                          int steps = properties["steps"].value<int>();
+                          int speed = properties["speed"].value<int>();
+                          int amount = properties["amount"].value<int>();
+                          QueueAction(ACTION_UPDOWN, steps, speed, 0, amount);
+                          return true;
+                      });
 
         // 手部动作（仅在有手部舵机时可用）
         if (has_hands_) {
-            mcp_server.AddTool(
+            AddMotionTool(
                 "self.otto.hands_up",
                 "举手。speed: 举手速度(500-1500，数值越小越快); direction: 手部选择(1=左手, "
                 "-1=右手, 0=双手)",
@@ -328,7 +336,7 @@ public:
                     return true;
                 });
 
-            mcp_server.AddTool(
+            AddMotionTool(
                 "self.otto.hands_down",
                 "放手。speed: 放手速度(500-1500，数值越小越快); direction: 手部选择(1=左手, "
                 "-1=右手, 0=双手)",
@@ -341,7 +349,7 @@ public:
                     return true;
                 });
 
-            mcp_server.AddTool(
+            AddMotionTool(
                 "self.otto.hand_wave",
                 "挥手。speed: 挥手速度(500-1500，数值越小越快); direction: 手部选择(1=左手, "
                 "-1=右手, 0=双手)",
@@ -355,7 +363,7 @@ public:
                 });
         }
 
-        // 系统工具
+        // 系统工具，停止留在主循环执行，不排在动作之后
         mcp_server.AddTool("self.otto.stop", "立即停止", PropertyList(),
                            [this](const PropertyList& properties) -> ReturnValue {
                                if (action_task_handle_ != nullptr) {
@@ -369,7 +377,7 @@ public:
                                return true;
                            });
 
-        mcp_server.AddTool(
+        AddMotionTool(
             "self.otto.set_trim",
             "校准单个舵机位置。设置指定舵机的微调参数以调整Otto的初始站立姿态，设置将永久保存。"
             "servo_type: 舵机类型(left_leg/right_leg/left_foot/right_foot/left_hand/right_hand); "
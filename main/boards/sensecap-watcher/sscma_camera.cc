@@ -330,6 +330,7 @@ std::string SscmaCamera::Explain(const std::string& question) {
     
     // 结束块
     http->Write("", 0);
+    McpServer::GetInstance().ReportProgress(2, 3, "uploaded");
 
     if (http->GetStatusCode() != 200) {
         ESP_LOGE(TAG, "Failed to upload photo, status code: %d", http->GetStatusCode());
@@ -338,6 +339,7 @@ std::string SscmaCamera::Explain(const std::string& question) {
 
     std::string result = http->ReadAll();
     http->Close();
+    McpServer::GetInstance().ReportProgress(3, 3, "explained");
 
     ESP_LOGI(TAG, "Explain image size=%d, question=%s\n%s", jpeg_data_.len, question.c_str(), result.c_str());
     return result;
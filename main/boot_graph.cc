@@ -0,0 +1,172 @@
+#include "boot_graph.h"
+#include "settings.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_app_desc.h>
+#include <cJSON.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "BootGraph"
+
+void BootGraph::Add(const char* name, std::vector<const char*> dependencies, std::function<void()> step, bool on_caller) {
+    Step new_step;
+    new_step.name = name;
+    new_step.function = step;
+    new_step.on_caller = on_caller;
+    for (auto dependency : dependencies) {
+        auto it = std::find_if(steps_.begin(), steps_.end(), [dependency](const Step& s) {
+            return strcmp(s.name, dependency) == 0;
+        });
+        if (it == steps_.end()) {
+            ESP_LOGE(TAG, "Step %s depends on unknown step %s", name, dependency);
+            continue;
+        }
+        new_step.dependencies.push_back(it - steps_.begin());
+    }
+    steps_.push_back(std::move(new_step));
+}
+
+// Must be called with mutex_ held
+int BootGraph::TakeReadyStep(bool on_caller) {
+    for (int i = 0; i < (int)steps_.size(); i++) {
+        auto& step = steps_[i];
+        if (step.started || step.on_caller != on_caller) {
+            continue;
+        }
+        bool ready = std::all_of(step.dependencies.begin(), step.dependencies.end(), [this](int dependency) {
+            return steps_[dependency].done;
+        });
+        if (ready) {
+            step.started = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Must be called with mutex_ held
+bool BootGraph::HasPendingSteps(bool on_caller) const {
+    return std::any_of(steps_.begin(), steps_.end(), [on_caller](const Step& step) {
+        return step.on_caller == on_caller && !step.started;
+    });
+}
+
+void BootGraph::RunSteps(bool on_caller) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        int index = -1;
+        cv_.wait(lock, [this, on_caller, &index]() {
+            index = TakeReadyStep(on_caller);
+            return index >= 0 || !HasPendingSteps(on_caller);
+        });
+        if (index < 0) {
+            return;
+        }
+
+        auto& step = steps_[index];
+        step.start_time = esp_timer_get_time();
+        lock.unlock();
+        ESP_LOGI(TAG, "Step %s started", step.name);
+        step.function();
+        lock.lock();
+        step.end_time = esp_timer_get_time();
+        step.done = true;
+        cv_.notify_all();
+    }
+}
+
+void BootGraph::Run() {
+    start_time_ = esp_timer_get_time();
+
+    int worker_steps = std::count_if(steps_.begin(), steps_.end(), [](const Step& step) { return !step.on_caller; });
+    running_workers_ = std::min(worker_steps, BOOT_GRAPH_WORKERS);
+    for (int i = 0; i < running_workers_; i++) {
+        xTaskCreate([](void* arg) {
+            auto graph = (BootGraph*)arg;
+            graph->RunSteps(false);
+            std::lock_guard<std::mutex> lock(graph->mutex_);
+            graph->running_workers_--;
+            graph->cv_.notify_all();
+            vTaskDelete(NULL);
+        }, "boot_worker", BOOT_GRAPH_WORKER_STACK_SIZE, this, uxTaskPriorityGet(NULL), nullptr);
+    }
+
+    RunSteps(true);
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return running_workers_ == 0; });
+    }
+    Report();
+}
+
+void BootGraph::Report() {
+    if (steps_.empty()) {
+        return;
+    }
+    auto ms = [this](int64_t time) { return (int)((time - start_time_) / 1000); };
+
+    auto root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "version", esp_app_get_description()->version);
+    auto steps = cJSON_AddObjectToObject(root, "steps");
+    int last = 0;
+    for (int i = 0; i < (int)steps_.size(); i++) {
+        auto& step = steps_[i];
+        int64_t ready_time = start_time_;
+        for (auto dependency : step.dependencies) {
+            ready_time = std::max(ready_time, steps_[dependency].end_time);
+        }
+        ESP_LOGI(TAG, "%-16s ready %6d ms, ran %6d - %6d ms (%d ms)", step.name, ms(ready_time),
+            ms(step.start_time), ms(step.end_time), (int)((step.end_time - step.start_time) / 1000));
+        // [ready, start, end] in ms after the graph started
+        auto item = cJSON_CreateArray();
+        cJSON_AddItemToArray(item, cJSON_CreateNumber(ms(ready_time)));
+        cJSON_AddItemToArray(item, cJSON_CreateNumber(ms(step.start_time)));
+        cJSON_AddItemToArray(item, cJSON_CreateNumber(ms(step.end_time)));
+        cJSON_AddItemToObject(steps, step.name, item);
+        if (step.end_time > steps_[last].end_time) {
+            last = i;
+        }
+    }
+
+    // Walk back from the step that finished last through the dependency that finished last
+    std::vector<int> path;
+    for (int index = last; index >= 0;) {
+        path.push_back(index);
+        int gate = -1;
+        for (auto dependency : steps_[index].dependencies) {
+            if (gate < 0 || steps_[dependency].end_time > steps_[gate].end_time) {
+                gate = dependency;
+            }
+        }
+        index = gate;
+    }
+    std::string critical_path;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        if (!critical_path.empty()) {
+            critical_path += " > ";
+        }
+        critical_path += steps_[*it].name;
+    }
+
+    int64_t end_time = steps_[last].end_time;
+    ESP_LOGI(TAG, "Boot done in %d ms, %lld ms after power on, critical path: %s", ms(end_time),
+        end_time / 1000, critical_path.c_str());
+    cJSON_AddNumberToObject(root, "total_ms", ms(end_time));
+    cJSON_AddNumberToObject(root, "uptime_ms", end_time / 1000);
+    cJSON_AddStringToObject(root, "critical_path", critical_path.c_str());
+
+    auto json = cJSON_PrintUnformatted(root);
+    timeline_json_ = json;
+    cJSON_free(json);
+    cJSON_Delete(root);
+
+    Settings settings("boot", true);
+    settings.SetString("timeline", timeline_json_);
+}
+
+std::string BootGraph::GetLastTimelineJson() {
+    Settings settings("boot");
+    return settings.GetString("timeline");
+}
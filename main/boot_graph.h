@@ -0,0 +1,72 @@
+#ifndef BOOT_GRAPH_H
+#define BOOT_GRAPH_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Runs the boot steps of Application::Start() as a dependency graph.
+ *
+ * A step starts as soon as the steps it depends on are done. Steps added with on_caller run on
+ * the task that calls Run(), in the order they were added; that keeps the network bring-up, the
+ * Wi-Fi configuration mode and the OTA check on the large main task stack where they always ran.
+ * The other steps run on up to BOOT_GRAPH_WORKERS short-lived worker tasks.
+ *
+ * When the graph is done the timeline is logged: when each step became ready, started and
+ * finished, and the critical path, the chain of steps that gated the end of boot. A compact copy
+ * is kept in NVS so that the next boot can report it in the system info sent with the OTA check,
+ * which lets the server track time to ready across firmware versions.
+ */
+#define BOOT_GRAPH_WORKERS 2
+#define BOOT_GRAPH_WORKER_STACK_SIZE (4096 * 2)
+
+class BootGraph {
+public:
+    BootGraph() = default;
+    ~BootGraph() = default;
+    BootGraph(const BootGraph&) = delete;
+    BootGraph& operator=(const BootGraph&) = delete;
+
+    // Dependencies must have been added before
+    void Add(const char* name, std::vector<const char*> dependencies, std::function<void()> step, bool on_caller = false);
+    // Blocks until every step is done
+    void Run();
+
+    // The timeline of this boot, empty until Run() returns
+    std::string GetTimelineJson() const { return timeline_json_; }
+    // The timeline saved by the previous boot, empty if there is none
+    static std::string GetLastTimelineJson();
+
+private:
+    struct Step {
+        const char* name;
+        std::vector<int> dependencies;
+        std::function<void()> function;
+        bool on_caller;
+        bool started = false;
+        bool done = false;
+        int64_t start_time = 0;
+        int64_t end_time = 0;
+    };
+
+    std::vector<Step> steps_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int64_t start_time_ = 0;
+    int running_workers_ = 0;
+    std::string timeline_json_;
+
+    void RunSteps(bool on_caller);
+    int TakeReadyStep(bool on_caller);
+    bool HasPendingSteps(bool on_caller) const;
+    void Report();
+};
+
+#endif // BOOT_GRAPH_H
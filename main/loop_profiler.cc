@@ -0,0 +1,286 @@
+#include "loop_profiler.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#define TAG "LoopProfiler"
+
+static const uint32_t BUCKET_LIMITS_US[LOOP_PROFILER_BUCKET_COUNT - 1] = {1000, 5000, 20000, 100000, 500000};
+
+static const char* TaskStateName(eTaskState state) {
+    switch (state) {
+        case eRunning: return "running";
+        case eReady: return "ready";
+        case eBlocked: return "blocked";
+        case eSuspended: return "suspended";
+        default: return "deleted";
+    }
+}
+
+void LoopProfiler::Start() {
+    task_handle_ = xTaskGetCurrentTaskHandle();
+
+    esp_timer_create_args_t watchdog_timer_args = {
+        .callback = [](void* arg) {
+            ((LoopProfiler*)arg)->CheckStall();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "loop_watchdog",
+        .skip_unhandled_events = true
+    };
+    esp_timer_create(&watchdog_timer_args, &watchdog_timer_);
+    esp_timer_start_periodic(watchdog_timer_, LOOP_PROFILER_STALL_MS * 1000 / 2);
+}
+
+bool LoopProfiler::Enter(const char* name, const char* detail, int line) {
+    if (task_handle_ == nullptr || xTaskGetCurrentTaskHandle() != task_handle_) {
+        return false;
+    }
+    int64_t now = esp_timer_get_time();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (depth_ < LOOP_PROFILER_MAX_DEPTH) {
+        auto& frame = stack_[depth_];
+        frame.name = name;
+        frame.detail = detail;
+        frame.line = line;
+        frame.start_time = now;
+    }
+    depth_++;
+    return true;
+}
+
+void LoopProfiler::Exit() {
+    int64_t now = esp_timer_get_time();
+    std::unique_lock<std::mutex> lock(mutex_);
+    depth_--;
+    if (depth_ >= LOOP_PROFILER_MAX_DEPTH) {
+        return;
+    }
+    auto& frame = stack_[depth_];
+    uint32_t duration_us = (uint32_t)(now - frame.start_time);
+
+    auto site = FindSite(frame);
+    if (site != nullptr) {
+        int bucket = 0;
+        while (bucket < LOOP_PROFILER_BUCKET_COUNT - 1 && duration_us >= BUCKET_LIMITS_US[bucket]) {
+            bucket++;
+        }
+        site->buckets[bucket]++;
+        site->count++;
+        site->total_us += duration_us;
+        site->max_us = std::max(site->max_us, duration_us);
+    }
+    RecordSlowest(frame, duration_us);
+
+    if (depth_ == 0 && stall_pending_) {
+        stall_pending_ = false;
+        stall_.duration_us = duration_us;
+        stalls_[stall_count_ % LOOP_PROFILER_STALL_COUNT] = stall_;
+        stall_count_++;
+        char path[160];
+        FormatPath(stall_, path, sizeof(path));
+        lock.unlock();
+        ESP_LOGW(TAG, "Main loop stall ended after %lu ms: %s", duration_us / 1000, path);
+    }
+}
+
+// Runs in the esp_timer task while the main loop may be stuck
+void LoopProfiler::CheckStall() {
+    int64_t now = esp_timer_get_time();
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (depth_ == 0 || stall_pending_ || now - stack_[0].start_time < LOOP_PROFILER_STALL_MS * 1000) {
+        return;
+    }
+    stall_pending_ = true;
+    stall_.depth = std::min(depth_, LOOP_PROFILER_MAX_DEPTH);
+    std::copy(stack_, stack_ + stall_.depth, stall_.path);
+    stall_.time = now;
+    stall_.task_state = TaskStateName(eTaskGetState(task_handle_));
+    char path[160];
+    FormatPath(stall_, path, sizeof(path));
+    lock.unlock();
+    ESP_LOGW(TAG, "Main loop stalled for %lld ms in %s, task %s", (now - stall_.path[0].start_time) / 1000,
+        path, stall_.task_state);
+}
+
+// Must be called with mutex_ held
+LoopProfiler::Site* LoopProfiler::FindSite(const Frame& frame) {
+    for (int i = 0; i < site_count_; i++) {
+        auto& site = sites_[i];
+        if (site.name == frame.name && site.detail == frame.detail && site.line == frame.line) {
+            return &site;
+        }
+    }
+    if (site_count_ == LOOP_PROFILER_MAX_SITES) {
+        dropped_sites_++;
+        return nullptr;
+    }
+    auto& site = sites_[site_count_++];
+    memset(&site, 0, sizeof(site));
+    site.name = frame.name;
+    site.detail = frame.detail;
+    site.line = frame.line;
+    return &site;
+}
+
+// Must be called with mutex_ held and `frame` on top of the stack
+void LoopProfiler::RecordSlowest(const Frame& frame, uint32_t duration_us) {
+    int index = slowest_count_;
+    if (slowest_count_ == LOOP_PROFILER_TOP_COUNT) {
+        index = 0;
+        for (int i = 1; i < slowest_count_; i++) {
+            if (slowest_[i].duration_us < slowest_[index].duration_us) {
+                index = i;
+            }
+        }
+        if (duration_us <= slowest_[index].duration_us) {
+            return;
+        }
+    } else {
+        slowest_count_++;
+    }
+    auto& call = slowest_[index];
+    call.depth = depth_ + 1;
+    std::copy(stack_, stack_ + call.depth, call.path);
+    call.duration_us = duration_us;
+    call.time = frame.start_time;
+    call.task_state = nullptr;
+}
+
+void LoopProfiler::FormatFrame(const Frame& frame, char* buffer, size_t size) {
+    const char* name = frame.name;
+    int written;
+    if (frame.line > 0) {
+        // Scheduled tasks are named after the full path of the calling file
+        auto slash = strrchr(name, '/');
+        written = snprintf(buffer, size, "%s:%d", slash ? slash + 1 : name, frame.line);
+    } else {
+        written = snprintf(buffer, size, "%s", name);
+    }
+    if (frame.detail != nullptr && written >= 0 && (size_t)written < size) {
+        snprintf(buffer + written, size - written, "(%s)", frame.detail);
+    }
+}
+
+void LoopProfiler::FormatPath(const Call& call, char* buffer, size_t size) {
+    buffer[0] = '\0';
+    size_t length = 0;
+    for (int i = 0; i < call.depth; i++) {
+        if (i > 0) {
+            if (length + 4 > size) {
+                break;
+            }
+            strcpy(buffer + length, " > ");
+            length += 3;
+        }
+        FormatFrame(call.path[i], buffer + length, size - length);
+        length += strlen(buffer + length);
+    }
+}
+
+void LoopProfiler::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (site_count_ == 0) {
+        return;
+    }
+    // The three sites that took the most time in total
+    int top[3] = {-1, -1, -1};
+    for (int i = 0; i < site_count_; i++) {
+        for (int j = 0; j < 3; j++) {
+            if (top[j] < 0 || sites_[i].total_us > sites_[top[j]].total_us) {
+                for (int k = 2; k > j; k--) {
+                    top[k] = top[k - 1];
+                }
+                top[j] = i;
+                break;
+            }
+        }
+    }
+    uint32_t slowest_us = 0;
+    for (int i = 0; i < slowest_count_; i++) {
+        slowest_us = std::max(slowest_us, slowest_[i].duration_us);
+    }
+    ESP_LOGI(TAG, "%d sites, slowest call %lu ms, %d stalls over %d ms", site_count_, slowest_us / 1000,
+        stall_count_, LOOP_PROFILER_STALL_MS);
+    for (int j = 0; j < 3 && top[j] >= 0; j++) {
+        auto& site = sites_[top[j]];
+        char name[64];
+        FormatFrame({site.name, site.detail, site.line, 0}, name, sizeof(name));
+        ESP_LOGI(TAG, "  %s: %lu calls, total %llu ms, max %lu ms", name, site.count, site.total_us / 1000,
+            site.max_us / 1000);
+    }
+}
+
+cJSON* LoopProfiler::GetStatsJson() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "stall_threshold_ms", LOOP_PROFILER_STALL_MS);
+    auto limits = cJSON_AddArrayToObject(root, "bucket_limits_ms");
+    for (auto limit : BUCKET_LIMITS_US) {
+        cJSON_AddItemToArray(limits, cJSON_CreateNumber(limit / 1000));
+    }
+
+    char text[160];
+    auto sites = cJSON_AddArrayToObject(root, "sites");
+    for (int i = 0; i < site_count_; i++) {
+        auto& site = sites_[i];
+        auto item = cJSON_CreateObject();
+        FormatFrame({site.name, site.detail, site.line, 0}, text, sizeof(text));
+        cJSON_AddStringToObject(item, "site", text);
+        cJSON_AddNumberToObject(item, "count", site.count);
+        cJSON_AddNumberToObject(item, "avg_us", site.count > 0 ? (double)(site.total_us / site.count) : 0);
+        cJSON_AddNumberToObject(item, "max_us", site.max_us);
+        auto buckets = cJSON_AddArrayToObject(item, "histogram");
+        for (auto bucket : site.buckets) {
+            cJSON_AddItemToArray(buckets, cJSON_CreateNumber(bucket));
+        }
+        cJSON_AddItemToArray(sites, item);
+    }
+    if (dropped_sites_ > 0) {
+        cJSON_AddNumberToObject(root, "dropped_sites", dropped_sites_);
+    }
+
+    int64_t now = esp_timer_get_time();
+    auto add_call = [&](cJSON* array, const Call& call) {
+        auto item = cJSON_CreateObject();
+        FormatPath(call, text, sizeof(text));
+        cJSON_AddStringToObject(item, "path", text);
+        cJSON_AddNumberToObject(item, "duration_us", call.duration_us);
+        cJSON_AddNumberToObject(item, "age_s", (double)((now - call.time) / 1000000));
+        if (call.task_state != nullptr) {
+            cJSON_AddStringToObject(item, "task_state", call.task_state);
+        }
+        cJSON_AddItemToArray(array, item);
+    };
+
+    int order[LOOP_PROFILER_TOP_COUNT];
+    for (int i = 0; i < slowest_count_; i++) {
+        order[i] = i;
+    }
+    std::sort(order, order + slowest_count_, [this](int a, int b) {
+        return slowest_[a].duration_us > slowest_[b].duration_us;
+    });
+    auto slowest = cJSON_AddArrayToObject(root, "slowest");
+    for (int i = 0; i < slowest_count_; i++) {
+        add_call(slowest, slowest_[order[i]]);
+    }
+
+    cJSON_AddNumberToObject(root, "stall_count", stall_count_);
+    auto stalls = cJSON_AddArrayToObject(root, "stalls");
+    int first = std::max(0, stall_count_ - LOOP_PROFILER_STALL_COUNT);
+    for (int i = stall_count_ - 1; i >= first; i--) {
+        add_call(stalls, stalls_[i % LOOP_PROFILER_STALL_COUNT]);
+    }
+    return root;
+}
+
+void LoopProfiler::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    site_count_ = 0;
+    dropped_sites_ = 0;
+    slowest_count_ = 0;
+    stall_count_ = 0;
+}
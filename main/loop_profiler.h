@@ -0,0 +1,129 @@
+#ifndef LOOP_PROFILER_H
+#define LOOP_PROFILER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <cJSON.h>
+
+#include <cstdint>
+#include <mutex>
+
+/*
+ * Times the main loop when CONFIG_USE_MAIN_LOOP_PROFILER is enabled.
+ *
+ * Every event handler, scheduled task and marked call (SetDeviceState, UpdateStatusBar) opens a
+ * scope. A scheduled task is named after the file and line that called Schedule(). Each site keeps
+ * a duration histogram, and the slowest calls are kept with the chain of scopes they ran in.
+ *
+ * A watchdog timer checks the open scopes while they run. Once the outermost one passes
+ * LOOP_PROFILER_STALL_MS it captures the scope chain at that moment, down to the innermost marked
+ * call, together with the FreeRTOS state of the main loop task: "blocked" points at a wait on I/O
+ * or a lock, "running" or "ready" at work on the CPU. The stall is logged right away, so a loop
+ * that never comes back still leaves a trace.
+ */
+#define LOOP_PROFILER_MAX_SITES 48
+#define LOOP_PROFILER_MAX_DEPTH 6
+#define LOOP_PROFILER_TOP_COUNT 8
+#define LOOP_PROFILER_STALL_COUNT 4
+#define LOOP_PROFILER_STALL_MS 200
+#define LOOP_PROFILER_BUCKET_COUNT 6  // < 1, 5, 20, 100, 500 ms and above
+
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+#define LOOP_PROFILE_CONCAT_(a, b) a##b
+#define LOOP_PROFILE_CONCAT(a, b) LOOP_PROFILE_CONCAT_(a, b)
+#define LOOP_PROFILE(...) LoopProfiler::Scope LOOP_PROFILE_CONCAT(loop_profile_scope_, __LINE__)(__VA_ARGS__)
+#else
+#define LOOP_PROFILE(...)
+#endif
+
+class LoopProfiler {
+public:
+    static LoopProfiler& GetInstance() {
+        static LoopProfiler instance;
+        return instance;
+    }
+    LoopProfiler(const LoopProfiler&) = delete;
+    LoopProfiler& operator=(const LoopProfiler&) = delete;
+
+    // Scopes opened in other tasks are ignored
+    class Scope {
+    public:
+        // `name` and `detail` must outlive the profiler, string literals or static tables
+        Scope(const char* name, const char* detail = nullptr, int line = 0) {
+            active_ = LoopProfiler::GetInstance().Enter(name, detail, line);
+        }
+        ~Scope() {
+            if (active_) {
+                LoopProfiler::GetInstance().Exit();
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        bool active_;
+    };
+
+    // Called from the main loop task itself
+    void Start();
+    void PrintStats();
+    // The caller owns the returned object
+    cJSON* GetStatsJson();
+    void Reset();
+
+private:
+    LoopProfiler() = default;
+    ~LoopProfiler() = default;
+
+    struct Frame {
+        const char* name = nullptr;
+        const char* detail = nullptr;
+        int line = 0;
+        int64_t start_time = 0;
+    };
+
+    struct Site {
+        const char* name;
+        const char* detail;
+        int line;
+        uint32_t count;
+        uint32_t max_us;
+        uint64_t total_us;
+        uint32_t buckets[LOOP_PROFILER_BUCKET_COUNT];
+    };
+
+    struct Call {
+        Frame path[LOOP_PROFILER_MAX_DEPTH];
+        int depth = 0;
+        uint32_t duration_us = 0;
+        int64_t time = 0;
+        const char* task_state = nullptr;  // Stalls only
+    };
+
+    std::mutex mutex_;
+    TaskHandle_t task_handle_ = nullptr;
+    esp_timer_handle_t watchdog_timer_ = nullptr;
+    Frame stack_[LOOP_PROFILER_MAX_DEPTH];
+    int depth_ = 0;  // May exceed LOOP_PROFILER_MAX_DEPTH, deeper scopes are not recorded
+    bool stall_pending_ = false;
+    Call stall_;
+
+    Site sites_[LOOP_PROFILER_MAX_SITES];
+    int site_count_ = 0;
+    uint32_t dropped_sites_ = 0;  // Calls of sites that found sites_ full
+    Call slowest_[LOOP_PROFILER_TOP_COUNT];
+    int slowest_count_ = 0;
+    Call stalls_[LOOP_PROFILER_STALL_COUNT];
+    int stall_count_ = 0;  // Total since the last reset, the newest LOOP_PROFILER_STALL_COUNT are kept
+
+    bool Enter(const char* name, const char* detail, int line);
+    void Exit();
+    void CheckStall();
+    Site* FindSite(const Frame& frame);
+    void RecordSlowest(const Frame& frame, uint32_t duration_us);
+    static void FormatFrame(const Frame& frame, char* buffer, size_t size);
+    static void FormatPath(const Call& call, char* buffer, size_t size);
+};
+
+#endif // LOOP_PROFILER_H
@@ -0,0 +1,126 @@
+#include "main_task_queue.h"
+#include "loop_profiler.h"
+
+#include <esp_log.h>
+
+#define TAG "MainTaskQueue"
+
+static_assert((MAIN_TASK_QUEUE_SIZE & (MAIN_TASK_QUEUE_SIZE - 1)) == 0, "MAIN_TASK_QUEUE_SIZE must be a power of two");
+
+MainTaskQueue::MainTaskQueue() {
+    for (auto& lane : lanes_) {
+        for (uint32_t i = 0; i < MAIN_TASK_QUEUE_SIZE; i++) {
+            lane.slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    for (auto& generation : generations_) {
+        generation.store(0, std::memory_order_relaxed);
+    }
+}
+
+bool MainTaskQueue::TryPush(Lane& lane, Entry& entry) {
+    uint32_t position = lane.enqueue_position.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &lane.slots[position & (MAIN_TASK_QUEUE_SIZE - 1)];
+        uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(sequence - position);
+        if (diff == 0) {
+            // The slot is free for this lap, claim it
+            if (lane.enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The main loop has not consumed the slot from the previous lap yet
+            return false;
+        } else {
+            position = lane.enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
+    slot->entry = std::move(entry);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool MainTaskQueue::Pop(Lane& lane, Entry& entry) {
+    auto& slot = lane.slots[lane.dequeue_position & (MAIN_TASK_QUEUE_SIZE - 1)];
+    uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence == lane.dequeue_position + 1) {
+        entry = std::move(slot.entry);
+        slot.sequence.store(lane.dequeue_position + MAIN_TASK_QUEUE_SIZE, std::memory_order_release);
+        lane.dequeue_position++;
+        return true;
+    }
+
+    // The ring is empty, tasks that spilled over come after everything in it
+    if (!lane.overflowed.load(std::memory_order_acquire)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(lane.overflow_mutex);
+    if (lane.overflow.empty()) {
+        lane.overflowed.store(false, std::memory_order_release);
+        return false;
+    }
+    entry = std::move(lane.overflow.front());
+    lane.overflow.pop_front();
+    return true;
+}
+
+void MainTaskQueue::Push(MainTask task, MainTaskPriority priority, MainTaskKey key, const char* file, int line) {
+    if (task.on_heap()) {
+        heap_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    Entry entry;
+    entry.task = std::move(task);
+    entry.key = key;
+    entry.file = file;
+    entry.line = line;
+    if (key != kMainTaskKeyNone) {
+        entry.generation = generations_[key].fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+
+    auto& lane = lanes_[priority];
+    if (!lane.overflowed.load(std::memory_order_acquire) && TryPush(lane, entry)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(lane.overflow_mutex);
+    lane.overflow.push_back(std::move(entry));
+    lane.overflowed.store(true, std::memory_order_release);
+    overflow_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool MainTaskQueue::Run() {
+    Entry entry;
+    for (int budget = MAIN_TASK_RUN_BUDGET; budget > 0; budget--) {
+        // Re-check the high lane before every task so a state change never waits behind UI updates
+        int priority = kMainTaskPriorityHigh;
+        while (priority < kMainTaskPriorityCount && !Pop(lanes_[priority], entry)) {
+            priority++;
+        }
+        if (priority == kMainTaskPriorityCount) {
+            return false;
+        }
+
+        if (entry.key != kMainTaskKeyNone &&
+            entry.generation != generations_[entry.key].load(std::memory_order_acquire)) {
+            coalesced_count_++;
+        } else {
+            LOOP_PROFILE(entry.file, nullptr, entry.line);
+            entry.task();
+            run_count_[priority]++;
+        }
+        entry.task.Reset();
+    }
+    return true;
+}
+
+void MainTaskQueue::PrintStats() {
+    uint32_t heap_count = heap_count_.exchange(0, std::memory_order_relaxed);
+    uint32_t overflow_count = overflow_count_.exchange(0, std::memory_order_relaxed);
+    ESP_LOGI(TAG, "Ran %lu high, %lu low, coalesced %lu, heap captures %lu, overflowed %lu",
+        run_count_[kMainTaskPriorityHigh], run_count_[kMainTaskPriorityLow], coalesced_count_, heap_count,
+        overflow_count);
+    run_count_[kMainTaskPriorityHigh] = 0;
+    run_count_[kMainTaskPriorityLow] = 0;
+    coalesced_count_ = 0;
+}
@@ -0,0 +1,180 @@
+#ifndef MAIN_TASK_QUEUE_H
+#define MAIN_TASK_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * The work queue behind Application::Schedule().
+ *
+ * A MainTask keeps its capture inline when it fits in MAIN_TASK_STORAGE_SIZE bytes, which covers
+ * `this` plus a std::string or a PropertyList, so scheduling does not touch the heap. Each lane is
+ * a bounded ring with one sequence counter per slot (Vyukov's queue): producers claim a slot with a
+ * compare-and-swap and only the main loop consumes, so no producer ever waits on a mutex. A full
+ * ring spills into a locked overflow list instead of dropping or blocking the caller, which may be
+ * the main loop itself.
+ *
+ * The high lane carries state and audio control and always runs first; the low lane carries
+ * display updates. A task scheduled with a key is skipped if a newer task with the same key was
+ * scheduled before it ran, so a burst of chat messages only draws the last one.
+ */
+#define MAIN_TASK_STORAGE_SIZE 48
+#define MAIN_TASK_QUEUE_SIZE 32  // Per lane, must be a power of two
+// Tasks run per Run() call, the rest wait for the next round so other main loop events get a turn
+#define MAIN_TASK_RUN_BUDGET 64
+
+enum MainTaskPriority {
+    kMainTaskPriorityHigh,
+    kMainTaskPriorityLow,
+    kMainTaskPriorityCount
+};
+
+enum MainTaskKey {
+    kMainTaskKeyNone,
+    kMainTaskKeyAssistantMessage,
+    kMainTaskKeyUserMessage,
+    kMainTaskKeyEmotion,
+    kMainTaskKeyCount
+};
+
+class MainTask {
+public:
+    MainTask() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, MainTask>>>
+    MainTask(F&& callable) {
+        using T = std::decay_t<F>;
+        if constexpr (sizeof(T) <= MAIN_TASK_STORAGE_SIZE && alignof(T) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible_v<T>) {
+            new (storage_) T(std::forward<F>(callable));
+            ops_ = &InlineOps<T>::ops;
+        } else {
+            *reinterpret_cast<T**>(storage_) = new T(std::forward<F>(callable));
+            ops_ = &HeapOps<T>::ops;
+        }
+    }
+
+    MainTask(MainTask&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    MainTask& operator=(MainTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    MainTask(const MainTask&) = delete;
+    MainTask& operator=(const MainTask&) = delete;
+
+    ~MainTask() {
+        Reset();
+    }
+
+    void operator()() { ops_->invoke(storage_); }
+    explicit operator bool() const { return ops_ != nullptr; }
+    bool on_heap() const { return ops_ != nullptr && ops_->on_heap; }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src);  // Leaves src destroyed
+        void (*destroy)(void* storage);
+        bool on_heap;
+    };
+
+    template <typename T>
+    struct InlineOps {
+        static void Invoke(void* storage) { (*static_cast<T*>(storage))(); }
+        static void Move(void* dst, void* src) {
+            new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        }
+        static void Destroy(void* storage) { static_cast<T*>(storage)->~T(); }
+        static constexpr Ops ops = {Invoke, Move, Destroy, false};
+    };
+
+    template <typename T>
+    struct HeapOps {
+        static void Invoke(void* storage) { (**static_cast<T**>(storage))(); }
+        static void Move(void* dst, void* src) { *static_cast<T**>(dst) = *static_cast<T**>(src); }
+        static void Destroy(void* storage) { delete *static_cast<T**>(storage); }
+        static constexpr Ops ops = {Invoke, Move, Destroy, true};
+    };
+
+    void MoveFrom(MainTask& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[MAIN_TASK_STORAGE_SIZE];
+    const Ops* ops_ = nullptr;
+};
+
+class MainTaskQueue {
+public:
+    MainTaskQueue();
+
+    // Safe from any task, never blocks unless the lane overflowed. `file` and `line` name the
+    // caller for the main loop profiler
+    void Push(MainTask task, MainTaskPriority priority, MainTaskKey key, const char* file, int line);
+    // Main loop only, returns true if tasks are left over because the budget ran out
+    bool Run();
+    void PrintStats();
+
+private:
+    struct Entry {
+        MainTask task;
+        uint8_t key = kMainTaskKeyNone;
+        uint32_t generation = 0;
+        const char* file = nullptr;
+        int line = 0;
+    };
+
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        Entry entry;
+    };
+
+    struct Lane {
+        Slot slots[MAIN_TASK_QUEUE_SIZE];
+        std::atomic<uint32_t> enqueue_position{0};
+        uint32_t dequeue_position = 0;
+        // Once something spilled, later pushes follow it until the main loop drains the list
+        std::atomic<bool> overflowed{false};
+        std::mutex overflow_mutex;
+        std::deque<Entry> overflow;
+    };
+
+    Lane lanes_[kMainTaskPriorityCount];
+    std::atomic<uint32_t> generations_[kMainTaskKeyCount];
+
+    // Counters since the last PrintStats()
+    std::atomic<uint32_t> heap_count_{0};
+    std::atomic<uint32_t> overflow_count_{0};
+    uint32_t run_count_[kMainTaskPriorityCount] = {};
+    uint32_t coalesced_count_ = 0;
+
+    bool TryPush(Lane& lane, Entry& entry);
+    bool Pop(Lane& lane, Entry& entry);
+};
+
+#endif // MAIN_TASK_QUEUE_H
@@ -9,6 +9,8 @@
 #include <algorithm>
 #include <cstring>
 #include <esp_pthread.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
 
 #include "application.h"
 #include "display.h"
@@ -17,13 +19,27 @@
 #include "settings.h"
 #include "lvgl_theme.h"
 #include "lvgl_display.h"
+#if CONFIG_USE_BENCHMARK_TOOLS
+#include "benchmarks.h"
+#endif
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+#include "loop_profiler.h"
+#endif
 
 #define TAG "MCP"
 
+thread_local McpServer::ToolCall* McpServer::current_call_ = nullptr;
+thread_local std::shared_ptr<McpServer::ReplyBatch> McpServer::parsing_batch_;
+
 McpServer::McpServer() {
 }
 
 McpServer::~McpServer() {
+    if (deadline_timer_ != nullptr) {
+        esp_timer_stop(deadline_timer_);
+        esp_timer_delete(deadline_timer_);
+    }
+    ReleaseToolsListCache();
     for (auto tool : tools_) {
         delete tool;
     }
@@ -37,6 +53,8 @@ void McpServer::AddCommonTools() {
 
     // Backup the original tools list and restore it after adding the common tools.
     auto original_tools = std::move(tools_);
+    tools_.clear();
+    tool_index_.Rebuild(tools_);
     auto& board = Board::GetInstance();
 
     // Do not add custom tools here.
@@ -99,7 +117,7 @@ void McpServer::AddCommonTools() {
 
     auto camera = board.GetCamera();
     if (camera) {
-        AddTool("self.camera.take_photo",
+        auto tool = new McpTool("self.camera.take_photo",
             "Take a photo and explain it. Use this tool after the user asks you to see something.\n"
             "Args:\n"
             "  `question`: The question that you want to ask about the photo.\n"
@@ -115,14 +133,21 @@ void McpServer::AddCommonTools() {
                 if (!camera->Capture()) {
                     throw std::runtime_error("Failed to capture photo");
                 }
+                // The camera reports "uploaded" once the photo is sent, and "explained" with the server's answer
+                McpServer::GetInstance().ReportProgress(1, 3, "captured");
                 auto question = properties["question"].value<std::string>();
                 return camera->Explain(question);
             });
+        // Capture, encode and upload take seconds, keep them off the main loop
+        tool->set_policy(kMcpToolPolicyExclusive, "camera");
+        tool->set_timeout_ms(30000);
+        AddTool(tool);
     }
 #endif
 
     // Restore the original tools list to the end of the tools list
     tools_.insert(tools_.end(), original_tools.begin(), original_tools.end());
+    tool_index_.Rebuild(tools_);
 }
 
 void McpServer::AddUserOnlyTools() {
@@ -148,6 +173,34 @@ void McpServer::AddUserOnlyTools() {
             return true;
         });
 
+#if CONFIG_USE_MAIN_LOOP_PROFILER
+    AddUserOnlyTool("self.main_loop.get_profile",
+        "Get the main loop profile: per call site histograms, the slowest calls and the recent stalls. "
+        "Set `reset` to start a new measurement after reading.",
+        PropertyList({
+            Property("reset", kPropertyTypeBoolean, false)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto& profiler = LoopProfiler::GetInstance();
+            auto json = profiler.GetStatsJson();
+            if (properties["reset"].value<bool>()) {
+                profiler.Reset();
+            }
+            return json;
+        });
+#endif
+
+#if CONFIG_USE_BENCHMARK_TOOLS
+    AddUserOnlyTool("self.benchmark.run", "Run an on-device benchmark suite. Suites: " + Benchmarks::GetSuiteNames(),
+        PropertyList({
+            Property("suite", kPropertyTypeString)
+        }),
+        [](const PropertyList& properties) -> ReturnValue {
+            auto suite = properties["suite"].value<std::string>();
+            return Benchmarks::Run(suite);
+        });
+#endif
+
     // Firmware upgrade
     AddUserOnlyTool("self.upgrade_firmware", "Upgrade firmware from a specific URL. This will download and install the firmware, then reboot the device.",
         PropertyList({
@@ -306,20 +359,92 @@ void McpServer::AddUserOnlyTools() {
 
 void McpServer::AddTool(McpTool* tool) {
     // Prevent adding duplicate tools
-    if (std::find_if(tools_.begin(), tools_.end(), [tool](const McpTool* t) { return t->name() == tool->name(); }) != tools_.end()) {
+    if (tool_index_.Find(tool->name(), tools_) >= 0) {
         ESP_LOGW(TAG, "Tool %s already added", tool->name().c_str());
         return;
     }
 
     ESP_LOGI(TAG, "Add tool: %s%s", tool->name().c_str(), tool->user_only() ? " [user]" : "");
+    // Serialize the schema now, tools/list only copies it from here on
+    tool->to_json();
+    tool_index_.Insert(tool->name(), tools_.size());
     tools_.push_back(tool);
+    // The catalog changed, it is serialized again on the next tools/list
+    ReleaseToolsListCache();
+}
+
+void McpServer::ReleaseToolsListCache() {
+    if (tools_json_ != nullptr) {
+        heap_caps_free(tools_json_);
+        tools_json_ = nullptr;
+    }
+    tools_json_end_.clear();
+    tools_hash_ = 0;
 }
 
-void McpServer::AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
+void McpServer::BuildToolsListCache() {
+    ReleaseToolsListCache();
+    auto start_time = esp_timer_get_time();
+
+    std::string catalog;
+    std::vector<uint32_t> ends;
+    ends.reserve(tools_.size());
+    for (auto tool : tools_) {
+        catalog += tool->to_json();
+        ends.push_back(catalog.size());
+    }
+
+    // The catalog is read-only from here on, keep it out of internal RAM when PSRAM is available
+    char* buffer = (char*)heap_caps_malloc(catalog.size() + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer == nullptr) {
+        buffer = (char*)heap_caps_malloc(catalog.size() + 1, MALLOC_CAP_8BIT);
+    }
+    if (buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes for the tools list", (unsigned)catalog.size());
+        return;
+    }
+    memcpy(buffer, catalog.c_str(), catalog.size() + 1);
+
+    // FNV-1a over the serialized catalog, it only changes when a tool, its schema or the order changes
+    uint32_t hash = Fnv1aHash(catalog);
+
+    tools_json_ = buffer;
+    tools_json_end_ = std::move(ends);
+    tools_hash_ = hash;
+    ESP_LOGI(TAG, "Tools list cached: %u tools, %u bytes, hash %08lx, %lld ms", (unsigned)tools_.size(),
+        (unsigned)catalog.size(), hash, (esp_timer_get_time() - start_time) / 1000);
+
+    // The per-tool schemas are in the catalog now. Names and descriptions declared as literals
+    // stay in flash, the rest was copied to the heap when the tool was added
+    size_t flash_bytes = 0;
+    size_t heap_bytes = 0;
+    auto count = [&flash_bytes, &heap_bytes](const McpText& text) {
+        (text.in_flash() ? flash_bytes : heap_bytes) += text.size() + 1;
+    };
+    for (auto tool : tools_) {
+        tool->ReleaseJson();
+        count(tool->name());
+        count(tool->description());
+        for (auto& property : tool->properties()) {
+            count(property.name());
+        }
+    }
+    ESP_LOGI(TAG, "Tool metadata: %u bytes referenced in flash, %u bytes on the heap", (unsigned)flash_bytes,
+        (unsigned)heap_bytes);
+}
+
+uint32_t McpServer::GetToolsHash() {
+    if (tools_json_ == nullptr) {
+        BuildToolsListCache();
+    }
+    return tools_hash_;
+}
+
+void McpServer::AddTool(std::string_view name, std::string_view description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
     AddTool(new McpTool(name, description, properties, callback));
 }
 
-void McpServer::AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
+void McpServer::AddUserOnlyTool(std::string_view name, std::string_view description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback) {
     auto tool = new McpTool(name, description, properties, callback);
     tool->set_user_only(true);
     AddTool(tool);
@@ -354,7 +479,37 @@ void McpServer::ParseCapabilities(const cJSON* capabilities) {
     }
 }
 
+void McpServer::ParseBatch(const cJSON* json) {
+    int size = cJSON_GetArraySize(json);
+    if (size == 0) {
+        ESP_LOGE(TAG, "Empty batch");
+        return;
+    }
+
+    auto batch = std::make_shared<ReplyBatch>();
+    batch->start_time = esp_timer_get_time();
+    parsing_batch_ = batch;
+    const cJSON* item;
+    cJSON_ArrayForEach(item, json) {
+        if (!cJSON_IsObject(item)) {
+            ESP_LOGE(TAG, "Invalid batch item");
+            continue;
+        }
+        if (cJSON_IsNumber(cJSON_GetObjectItem(item, "id"))) {
+            batch->requests++;
+        }
+        ParseMessage(item);
+    }
+    parsing_batch_ = nullptr;
+    CompleteBatch(*batch, "");
+}
+
 void McpServer::ParseMessage(const cJSON* json) {
+    if (cJSON_IsArray(json)) {
+        ParseBatch(json);
+        return;
+    }
+
     // Check JSONRPC version
     auto version = cJSON_GetObjectItem(json, "jsonrpc");
     if (version == nullptr || !cJSON_IsString(version) || strcmp(version->valuestring, "2.0") != 0) {
@@ -371,6 +526,13 @@ void McpServer::ParseMessage(const cJSON* json) {
     
     auto method_str = std::string(method->valuestring);
     if (method_str.find("notifications") == 0) {
+        if (method_str == "notifications/cancelled") {
+            auto params = cJSON_GetObjectItem(json, "params");
+            auto request_id = cJSON_GetObjectItem(params, "requestId");
+            if (cJSON_IsNumber(request_id)) {
+                CancelToolCall(request_id->valueint);
+            }
+        }
         return;
     }
     
@@ -396,7 +558,12 @@ void McpServer::ParseMessage(const cJSON* json) {
             }
         }
         auto app_desc = esp_app_get_description();
-        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
+        // The tools hash lets the server reuse the catalog it cached for this firmware instead of paging tools/list
+        char tools_hash[9];
+        snprintf(tools_hash, sizeof(tools_hash), "%08lx", GetToolsHash());
+        std::string message = "{\"protocolVersion\":\"2024-11-05\",\"capabilities\":{\"tools\":{\"hash\":\"";
+        message += tools_hash;
+        message += "\"}},\"serverInfo\":{\"name\":\"" BOARD_NAME "\",\"version\":\"";
         message += app_desc->version;
         message += "\"}}";
         ReplyResult(id_int, message);
@@ -432,63 +599,132 @@ void McpServer::ParseMessage(const cJSON* json) {
             ReplyError(id_int, "Invalid arguments");
             return;
         }
-        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments);
+        std::string progress_token;
+        auto meta = cJSON_GetObjectItem(params, "_meta");
+        auto token = cJSON_IsObject(meta) ? cJSON_GetObjectItem(meta, "progressToken") : nullptr;
+        if (cJSON_IsNumber(token) || cJSON_IsString(token)) {
+            auto token_str = cJSON_PrintUnformatted(token);
+            progress_token = token_str;
+            cJSON_free(token_str);
+        }
+        DoToolCall(id_int, std::string(tool_name->valuestring), tool_arguments, progress_token);
     } else {
         ESP_LOGE(TAG, "Method not implemented: %s", method_str.c_str());
         ReplyError(id_int, "Method not implemented: " + method_str);
     }
 }
 
-void McpServer::ReplyResult(int id, const std::string& result) {
+static std::string ResultPayload(int id, const std::string& result) {
     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
     payload += std::to_string(id) + ",\"result\":";
     payload += result;
     payload += "}";
-    Application::GetInstance().SendMcpMessage(payload);
+    return payload;
 }
 
-void McpServer::ReplyError(int id, const std::string& message) {
+static std::string ErrorPayload(int id, const std::string& message) {
     std::string payload = "{\"jsonrpc\":\"2.0\",\"id\":";
     payload += std::to_string(id);
     payload += ",\"error\":{\"message\":\"";
     payload += message;
     payload += "\"}}";
+    return payload;
+}
+
+void McpServer::ReplyResult(int id, const std::string& result) {
+    SendResponse(ResultPayload(id, result));
+}
+
+void McpServer::ReplyError(int id, const std::string& message) {
+    SendResponse(ErrorPayload(id, message));
+}
+
+// Replies made while a batch is parsed go into the batch
+void McpServer::SendResponse(const std::string& payload) {
+    if (parsing_batch_ != nullptr) {
+        std::lock_guard<std::mutex> lock(parsing_batch_->mutex);
+        parsing_batch_->responses.push_back(payload);
+        return;
+    }
     Application::GetInstance().SendMcpMessage(payload);
 }
 
+// Sends the reply of a call once it is finished, an empty payload means there is none
+void McpServer::ReplyToolCall(ToolCall& call, const std::string& payload) {
+    if (call.batch != nullptr) {
+        CompleteBatch(*call.batch, payload);
+    } else if (!payload.empty()) {
+        Application::GetInstance().SendMcpMessage(payload);
+    }
+}
+
+void McpServer::CompleteBatch(ReplyBatch& batch, const std::string& payload) {
+    std::string message;
+    {
+        std::lock_guard<std::mutex> lock(batch.mutex);
+        if (!payload.empty()) {
+            batch.responses.push_back(payload);
+        }
+        if (--batch.pending > 0) {
+            return;
+        }
+        if (batch.responses.empty()) {
+            // Only notifications and cancelled calls, nothing to send
+            return;
+        }
+        message = "[";
+        for (size_t i = 0; i < batch.responses.size(); i++) {
+            if (i > 0) {
+                message += ",";
+            }
+            message += batch.responses[i];
+        }
+        message += "]";
+    }
+    ESP_LOGI(TAG, "Batch of %d requests answered in one message after %d ms, %d round trips saved", batch.requests,
+        (int)((esp_timer_get_time() - batch.start_time) / 1000), batch.requests - 1);
+    Application::GetInstance().SendMcpMessage(message);
+}
+
 void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_only_tools) {
     const int max_payload_size = 8000;
+    if (tools_json_ == nullptr) {
+        BuildToolsListCache();
+    }
     std::string json = "{\"tools\":[";
     
-    bool found_cursor = cursor.empty();
     auto it = tools_.begin();
+    if (!cursor.empty()) {
+        // 从 cursor 指向的 tool 开始，找不到时返回空列表
+        int position = tool_index_.Find(cursor, tools_);
+        it = position >= 0 ? tools_.begin() + position : tools_.end();
+    }
     std::string next_cursor = "";
     
     while (it != tools_.end()) {
-        // 如果我们还没有找到起始位置，继续搜索
-        if (!found_cursor) {
-            if ((*it)->name() == cursor) {
-                found_cursor = true;
-            } else {
-                ++it;
-                continue;
-            }
-        }
-
         if (!list_user_only_tools && (*it)->user_only()) {
             ++it;
             continue;
         }
         
         // 添加tool前检查大小
-        std::string tool_json = (*it)->to_json() + ",";
-        if (json.length() + tool_json.length() + 30 > max_payload_size) {
+        std::string_view tool_json;
+        if (tools_json_ != nullptr) {
+            size_t index = it - tools_.begin();
+            size_t begin = index == 0 ? 0 : tools_json_end_[index - 1];
+            tool_json = std::string_view(tools_json_ + begin, tools_json_end_[index] - begin);
+        } else {
+            // The cache could not be allocated
+            tool_json = (*it)->to_json();
+        }
+        if (json.length() + tool_json.length() + 31 > max_payload_size) {
             // 如果添加这个tool会超出大小限制，设置next_cursor并退出循环
-            next_cursor = (*it)->name();
+            next_cursor = (*it)->name().view();
             break;
         }
         
         json += tool_json;
+        json += ',';
         ++it;
     }
     
@@ -512,19 +748,16 @@ void McpServer::GetToolsList(int id, const std::string& cursor, bool list_user_o
     ReplyResult(id, json);
 }
 
-void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments) {
-    auto tool_iter = std::find_if(tools_.begin(), tools_.end(), 
-                                 [&tool_name](const McpTool* tool) { 
-                                     return tool->name() == tool_name; 
-                                 });
-    
-    if (tool_iter == tools_.end()) {
+void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, const std::string& progress_token) {
+    int position = tool_index_.Find(tool_name, tools_);
+    if (position < 0) {
         ESP_LOGE(TAG, "tools/call: Unknown tool: %s", tool_name.c_str());
         ReplyError(id, "Unknown tool: " + tool_name);
         return;
     }
 
-    PropertyList arguments = (*tool_iter)->properties();
+    auto tool = tools_[position];
+    PropertyList arguments = tool->properties();
     try {
         for (auto& argument : arguments) {
             bool found = false;
@@ -544,7 +777,7 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
 
             if (!argument.has_default_value() && !found) {
                 ESP_LOGE(TAG, "tools/call: Missing valid argument: %s", argument.name().c_str());
-                ReplyError(id, "Missing valid argument: " + argument.name());
+                ReplyError(id, "Missing valid argument: " + std::string(argument.name().view()));
                 return;
             }
         }
@@ -554,14 +787,233 @@ void McpServer::DoToolCall(int id, const std::string& tool_name, const cJSON* to
         return;
     }
 
-    // Use main thread to call the tool
-    auto& app = Application::GetInstance();
-    app.Schedule([this, id, tool_iter, arguments = std::move(arguments)]() {
-        try {
-            ReplyResult(id, (*tool_iter)->Call(arguments));
-        } catch (const std::exception& e) {
-            ESP_LOGE(TAG, "tools/call: %s", e.what());
-            ReplyError(id, e.what());
+    auto call = std::make_shared<ToolCall>();
+    call->id = id;
+    call->tool = tool;
+    call->arguments = std::move(arguments);
+    call->deadline = esp_timer_get_time() + tool->timeout_ms() * 1000LL;
+    call->progress_token = progress_token;
+    call->batch = parsing_batch_;
+    bool on_worker = tool->policy() != kMcpToolPolicyMainThread;
+    std::unique_lock<std::mutex> lock(calls_mutex_);
+    if (on_worker && queued_calls_.size() >= MCP_TOOL_QUEUE_SIZE) {
+        lock.unlock();
+        ESP_LOGE(TAG, "tools/call: Too many calls waiting, rejecting %s", tool->name().c_str());
+        ReplyError(id, "Too many tool calls in progress");
+        return;
+    }
+    active_calls_.push_back(call);
+    if (call->batch != nullptr) {
+        // The batch is sent after this call replies
+        std::lock_guard<std::mutex> batch_lock(call->batch->mutex);
+        call->batch->pending++;
+    }
+    if (deadline_timer_ == nullptr) {
+        esp_timer_create_args_t timer_args = {
+            .callback = [](void* arg) {
+                ((McpServer*)arg)->CheckToolCallDeadlines();
+            },
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "mcp_deadline",
+            .skip_unhandled_events = true
+        };
+        esp_timer_create(&timer_args, &deadline_timer_);
+    }
+    if (!deadline_timer_running_) {
+        esp_timer_start_periodic(deadline_timer_, 500 * 1000);
+        deadline_timer_running_ = true;
+    }
+
+    if (on_worker) {
+        queued_calls_.push_back(call);
+        if (idle_workers_ > 0) {
+            calls_cv_.notify_all();
+        } else if (running_workers_ < MCP_TOOL_WORKERS) {
+            running_workers_++;
+            auto result = xTaskCreate([](void* arg) {
+                ((McpServer*)arg)->ToolWorker();
+                vTaskDelete(NULL);
+            }, "mcp_tool", MCP_TOOL_WORKER_STACK_SIZE, this, 2, nullptr);
+            if (result != pdPASS) {
+                // The call waits for a running worker or its deadline
+                ESP_LOGE(TAG, "tools/call: Failed to start a tool worker");
+                running_workers_--;
+            }
         }
+        return;
+    }
+    lock.unlock();
+
+    // Use main thread to call the tool
+    Application::GetInstance().Schedule([this, call]() {
+        RunToolCall(*call);
     });
 }
+
+void McpServer::RunToolCall(ToolCall& call) {
+    int expected = kToolCallQueued;
+    if (!call.state.compare_exchange_strong(expected, kToolCallRunning)) {
+        // Timed out or cancelled before it started
+        return;
+    }
+
+    std::string result;
+    std::string error;
+    current_call_ = &call;
+    try {
+        result = call.tool->Call(call.arguments);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    current_call_ = nullptr;
+
+    if (!FinishToolCall(call)) {
+        ESP_LOGW(TAG, "tools/call: %s returned after it timed out or was cancelled", call.tool->name().c_str());
+        return;
+    }
+    if (!error.empty()) {
+        ESP_LOGE(TAG, "tools/call: %s", error.c_str());
+        ReplyToolCall(call, ErrorPayload(call.id, error));
+        return;
+    }
+    ReplyToolCall(call, ResultPayload(call.id, result));
+}
+
+// Returns true for the one caller that finishes the call, it sends the reply if there is one
+bool McpServer::FinishToolCall(ToolCall& call) {
+    if (call.state.exchange(kToolCallFinished) == kToolCallFinished) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(calls_mutex_);
+    active_calls_.erase(std::remove_if(active_calls_.begin(), active_calls_.end(),
+        [&call](const std::shared_ptr<ToolCall>& c) { return c.get() == &call; }), active_calls_.end());
+    // A waiting worker may drop the call from the queue
+    calls_cv_.notify_all();
+    return true;
+}
+
+bool McpServer::IsToolCallCancelled() {
+    return current_call_ != nullptr && current_call_->state == kToolCallFinished;
+}
+
+void McpServer::ReportProgress(int progress, int total, const std::string& message) {
+    auto call = current_call_;
+    if (call == nullptr || call->progress_token.empty() || call->state != kToolCallRunning) {
+        return;
+    }
+    std::string payload = "{\"jsonrpc\":\"2.0\",\"method\":\"notifications/progress\",\"params\":{\"progressToken\":";
+    payload += call->progress_token;
+    payload += ",\"progress\":" + std::to_string(progress);
+    if (total > 0) {
+        payload += ",\"total\":" + std::to_string(total);
+    }
+    if (!message.empty()) {
+        auto text = cJSON_CreateString(message.c_str());
+        auto text_str = cJSON_PrintUnformatted(text);
+        payload += ",\"message\":";
+        payload += text_str;
+        cJSON_free(text_str);
+        cJSON_Delete(text);
+    }
+    payload += "}}";
+    // Queued on the main loop like the reply, so it always arrives before the result
+    Application::GetInstance().SendMcpMessage(payload);
+}
+
+void McpServer::CancelToolCall(int id) {
+    std::shared_ptr<ToolCall> call;
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        auto it = std::find_if(active_calls_.begin(), active_calls_.end(),
+            [id](const std::shared_ptr<ToolCall>& c) { return c->id == id; });
+        if (it == active_calls_.end()) {
+            return;
+        }
+        call = *it;
+    }
+    // The server expects no response to a cancelled request
+    if (FinishToolCall(*call)) {
+        ESP_LOGI(TAG, "tools/call: %s cancelled", call->tool->name().c_str());
+        ReplyToolCall(*call, "");
+    }
+}
+
+// Runs in the esp_timer task
+void McpServer::CheckToolCallDeadlines() {
+    int64_t now = esp_timer_get_time();
+    std::vector<std::shared_ptr<ToolCall>> expired;
+    {
+        std::lock_guard<std::mutex> lock(calls_mutex_);
+        for (auto& call : active_calls_) {
+            if (now >= call->deadline) {
+                expired.push_back(call);
+            }
+        }
+        if (expired.size() == active_calls_.size()) {
+            esp_timer_stop(deadline_timer_);
+            deadline_timer_running_ = false;
+        }
+    }
+    for (auto& call : expired) {
+        if (FinishToolCall(*call)) {
+            ESP_LOGW(TAG, "tools/call: %s timed out after %d ms", call->tool->name().c_str(), call->tool->timeout_ms());
+            ReplyToolCall(*call, ErrorPayload(call->id, "Tool call timed out: " + std::string(call->tool->name().view())));
+        }
+    }
+}
+
+void McpServer::ToolWorker() {
+    std::unique_lock<std::mutex> lock(calls_mutex_);
+    while (true) {
+        auto call = TakeRunnableToolCall();
+        if (call == nullptr) {
+            if (queued_calls_.empty()) {
+                break;
+            }
+            // The calls left wait for a resource that another worker holds
+            idle_workers_++;
+            calls_cv_.wait(lock);
+            idle_workers_--;
+            continue;
+        }
+
+        lock.unlock();
+        RunToolCall(*call);
+        lock.lock();
+        if (call->tool->policy() == kMcpToolPolicyExclusive) {
+            auto resource = call->tool->resource() ? call->tool->resource() : call->tool->name().c_str();
+            busy_resources_.erase(std::find_if(busy_resources_.begin(), busy_resources_.end(),
+                [resource](const char* r) { return strcmp(r, resource) == 0; }));
+            calls_cv_.notify_all();
+        }
+    }
+    running_workers_--;
+}
+
+// Must be called with calls_mutex_ held
+std::shared_ptr<McpServer::ToolCall> McpServer::TakeRunnableToolCall() {
+    for (auto it = queued_calls_.begin(); it != queued_calls_.end();) {
+        auto call = *it;
+        if (call->state != kToolCallQueued) {
+            // Timed out or cancelled while waiting
+            it = queued_calls_.erase(it);
+            continue;
+        }
+        const char* resource = nullptr;
+        if (call->tool->policy() == kMcpToolPolicyExclusive) {
+            // Without a resource name the tool excludes only itself
+            resource = call->tool->resource() ? call->tool->resource() : call->tool->name().c_str();
+            bool busy = std::any_of(busy_resources_.begin(), busy_resources_.end(),
+                [resource](const char* r) { return strcmp(r, resource) == 0; });
+            if (busy) {
+                ++it;
+                continue;
+            }
+            busy_resources_.push_back(resource);
+        }
+        queued_calls_.erase(it);
+        return call;
+    }
+    return nullptr;
+}
@@ -8,8 +8,17 @@
 #include <variant>
 #include <optional>
 #include <stdexcept>
+#include <string_view>
 #include <thread>
+#include <memory>
+#include <cstring>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
 #include <mbedtls/base64.h>
+#include <esp_memory_utils.h>
+#include <esp_timer.h>
 
 #include <cJSON.h>
 
@@ -46,6 +55,70 @@ public:
     }
 };
 
+// FNV-1a, indexes tools and properties by name and fingerprints the tool catalog
+inline uint32_t Fnv1aHash(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : name) {
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Name or description of a tool or property. String literals live in flash (rodata) for the
+ * lifetime of the firmware, so they are only referenced; any other text is copied to the heap.
+ * Tool lists of dozens of tools with long descriptions then cost a pointer per string instead of
+ * a heap copy in internal SRAM.
+ */
+class McpText {
+public:
+    McpText(std::string_view text = "") { Assign(text); }
+    McpText(const McpText& other) { Assign(other.view()); }
+    McpText(McpText&& other) noexcept : data_(other.data_), size_(other.size_), owned_(std::move(other.owned_)) {
+        other.data_ = "";
+        other.size_ = 0;
+    }
+    McpText& operator=(const McpText& other) {
+        if (this != &other) {
+            Assign(other.view());
+        }
+        return *this;
+    }
+
+    inline const char* c_str() const { return data_; }
+    inline size_t size() const { return size_; }
+    inline std::string_view view() const { return std::string_view(data_, size_); }
+    inline operator std::string_view() const { return view(); }
+    inline bool operator==(std::string_view other) const { return view() == other; }
+    inline bool in_flash() const { return owned_ == nullptr; }
+
+private:
+    const char* data_;
+    size_t size_;
+    std::unique_ptr<char[]> owned_;
+
+    // PSRAM is mapped into the same data window as flash on the ESP32-S3, large heap strings land there
+    static bool InFlash(const char* p) {
+        return esp_ptr_in_drom(p) && !esp_ptr_external_ram(p);
+    }
+
+    void Assign(std::string_view text) {
+        size_ = text.size();
+        // Only whole literals, a view into the middle of one is not terminated. The terminator is
+        // only read once it is known to be in flash too
+        const char* end = text.data() + size_;
+        if (InFlash(text.data()) && InFlash(end) && *end == '\0') {
+            owned_.reset();
+            data_ = text.data();
+            return;
+        }
+        owned_.reset(new char[size_ + 1]);
+        memcpy(owned_.get(), text.data(), size_);
+        owned_[size_] = '\0';
+        data_ = owned_.get();
+    }
+};
+
 // 添加类型别名
 using ReturnValue = std::variant<bool, int, std::string, cJSON*, ImageContent*>;
 
@@ -57,7 +130,8 @@ enum PropertyType {
 
 class Property {
 private:
-    std::string name_;
+    McpText name_;
+    uint32_t name_hash_;
     PropertyType type_;
     std::variant<bool, int, std::string> value_;
     bool has_default_value_;
@@ -66,25 +140,25 @@ private:
 
 public:
     // Required field constructor
-    Property(const std::string& name, PropertyType type)
-        : name_(name), type_(type), has_default_value_(false) {}
+    Property(std::string_view name, PropertyType type)
+        : name_(name), name_hash_(Fnv1aHash(name)), type_(type), has_default_value_(false) {}
 
     // Optional field constructor with default value
     template<typename T>
-    Property(const std::string& name, PropertyType type, const T& default_value)
-        : name_(name), type_(type), has_default_value_(true) {
+    Property(std::string_view name, PropertyType type, const T& default_value)
+        : name_(name), name_hash_(Fnv1aHash(name)), type_(type), has_default_value_(true) {
         value_ = default_value;
     }
 
-    Property(const std::string& name, PropertyType type, int min_value, int max_value)
-        : name_(name), type_(type), has_default_value_(false), min_value_(min_value), max_value_(max_value) {
+    Property(std::string_view name, PropertyType type, int min_value, int max_value)
+        : name_(name), name_hash_(Fnv1aHash(name)), type_(type), has_default_value_(false), min_value_(min_value), max_value_(max_value) {
         if (type != kPropertyTypeInteger) {
             throw std::invalid_argument("Range limits only apply to integer properties");
         }
     }
 
-    Property(const std::string& name, PropertyType type, int default_value, int min_value, int max_value)
-        : name_(name), type_(type), has_default_value_(true), min_value_(min_value), max_value_(max_value) {
+    Property(std::string_view name, PropertyType type, int default_value, int min_value, int max_value)
+        : name_(name), name_hash_(Fnv1aHash(name)), type_(type), has_default_value_(true), min_value_(min_value), max_value_(max_value) {
         if (type != kPropertyTypeInteger) {
             throw std::invalid_argument("Range limits only apply to integer properties");
         }
@@ -94,7 +168,8 @@ public:
         value_ = default_value;
     }
 
-    inline const std::string& name() const { return name_; }
+    inline const McpText& name() const { return name_; }
+    inline uint32_t name_hash() const { return name_hash_; }
     inline PropertyType type() const { return type_; }
     inline bool has_default_value() const { return has_default_value_; }
     inline bool has_range() const { return min_value_.has_value() && max_value_.has_value(); }
@@ -167,8 +242,10 @@ public:
     }
 
     const Property& operator[](const std::string& name) const {
+        // Compare the hashes computed when the properties were declared before the names
+        uint32_t hash = Fnv1aHash(name);
         for (const auto& property : properties_) {
-            if (property.name() == name) {
+            if (property.name_hash() == hash && property.name() == name) {
                 return property;
             }
         }
@@ -177,12 +254,14 @@ public:
 
     auto begin() { return properties_.begin(); }
     auto end() { return properties_.end(); }
+    auto begin() const { return properties_.begin(); }
+    auto end() const { return properties_.end(); }
 
     std::vector<std::string> GetRequired() const {
         std::vector<std::string> required;
         for (auto& property : properties_) {
             if (!property.has_default_value()) {
-                required.push_back(property.name());
+                required.push_back(std::string(property.name().view()));
             }
         }
         return required;
@@ -205,17 +284,49 @@ public:
     }
 };
 
+/*
+ * Where a tools/call runs. Main thread tools run on the main loop like before and may touch the
+ * device state, the display and the audio service. Pooled and exclusive tools run on one of up to
+ * MCP_TOOL_WORKERS short-lived worker tasks, so a slow tool does not hold up the main loop;
+ * exclusive tools sharing a resource name run one at a time.
+ *
+ * Every call has a deadline. When it passes, or the server sends notifications/cancelled, the
+ * call is finished: a queued call is dropped, a running one keeps running but its result is
+ * discarded. Long tools can check McpServer::IsToolCallCancelled() between steps.
+ *
+ * When the request carries params._meta.progressToken, a tool can report progress and partial
+ * text with McpServer::ReportProgress(), which sends notifications/progress ahead of the result.
+ *
+ * A JSON-RPC batch is handled request by request as above, so its tool calls run side by side as
+ * far as their policies allow. The responses are collected and sent as one array when the last
+ * call in the batch has replied.
+ */
+#define MCP_TOOL_WORKERS 2
+#define MCP_TOOL_WORKER_STACK_SIZE (4096 * 2)
+#define MCP_TOOL_QUEUE_SIZE 8  // Calls waiting for a worker
+#define MCP_TOOL_DEFAULT_TIMEOUT_MS 15000
+
+enum McpToolPolicy {
+    kMcpToolPolicyMainThread,
+    kMcpToolPolicyPooled,
+    kMcpToolPolicyExclusive
+};
+
 class McpTool {
 private:
-    std::string name_;
-    std::string description_;
+    McpText name_;
+    McpText description_;
     PropertyList properties_;
     std::function<ReturnValue(const PropertyList&)> callback_;
     bool user_only_ = false;
+    McpToolPolicy policy_ = kMcpToolPolicyMainThread;
+    const char* resource_ = nullptr;
+    int timeout_ms_ = MCP_TOOL_DEFAULT_TIMEOUT_MS;
+    mutable std::string json_;  // Serialized schema, built once and cleared when the tool changes
 
 public:
-    McpTool(const std::string& name, 
-            const std::string& description, 
+    McpTool(std::string_view name, 
+            std::string_view description, 
             const PropertyList& properties, 
             std::function<ReturnValue(const PropertyList&)> callback)
         : name_(name), 
@@ -223,13 +334,37 @@ public:
         properties_(properties), 
         callback_(callback) {}
 
-    void set_user_only(bool user_only) { user_only_ = user_only; }
-    inline const std::string& name() const { return name_; }
-    inline const std::string& description() const { return description_; }
+    void set_user_only(bool user_only) {
+        user_only_ = user_only;
+        json_.clear();
+    }
+    // `resource` names what exclusive tools share, it must outlive the tool
+    void set_policy(McpToolPolicy policy, const char* resource = nullptr) {
+        policy_ = policy;
+        resource_ = resource;
+    }
+    void set_timeout_ms(int timeout_ms) { timeout_ms_ = timeout_ms; }
+    inline const McpText& name() const { return name_; }
+    inline const McpText& description() const { return description_; }
     inline const PropertyList& properties() const { return properties_; }
     inline bool user_only() const { return user_only_; }
+    inline McpToolPolicy policy() const { return policy_; }
+    inline const char* resource() const { return resource_; }
+    inline int timeout_ms() const { return timeout_ms_; }
 
-    std::string to_json() const {
+    const std::string& to_json() const {
+        if (json_.empty()) {
+            json_ = BuildJson();
+        }
+        return json_;
+    }
+
+    // Drops the serialized schema once the tool catalog holds a copy, to_json() builds it again
+    void ReleaseJson() {
+        std::string().swap(json_);
+    }
+
+    std::string BuildJson() const {
         std::vector<std::string> required = properties_.GetRequired();
         
         cJSON *json = cJSON_CreateObject();
@@ -311,6 +446,69 @@ public:
     }
 };
 
+// Open-addressing index from tool name to position in the tool list, with linear probing
+class McpToolIndex {
+public:
+    void Insert(std::string_view name, int position) {
+        if ((count_ + 1) * 2 > (int)slots_.size()) {
+            Grow();
+        }
+        Place({Fnv1aHash(name), position});
+        count_++;
+    }
+
+    void Rebuild(const std::vector<McpTool*>& tools) {
+        slots_.clear();
+        count_ = 0;
+        for (size_t i = 0; i < tools.size(); i++) {
+            Insert(tools[i]->name(), i);
+        }
+    }
+
+    // Returns the position of the tool, or -1
+    int Find(std::string_view name, const std::vector<McpTool*>& tools) const {
+        if (slots_.empty()) {
+            return -1;
+        }
+        uint32_t hash = Fnv1aHash(name);
+        size_t mask = slots_.size() - 1;
+        for (size_t i = hash & mask; slots_[i].position >= 0; i = (i + 1) & mask) {
+            if (slots_[i].hash == hash && tools[slots_[i].position]->name() == name) {
+                return slots_[i].position;
+            }
+        }
+        return -1;
+    }
+
+private:
+    struct Slot {
+        uint32_t hash;
+        int position;
+    };
+
+    std::vector<Slot> slots_;  // Size is a power of two, at most half full
+    int count_ = 0;
+
+    void Place(const Slot& slot) {
+        size_t mask = slots_.size() - 1;
+        size_t i = slot.hash & mask;
+        while (slots_[i].position >= 0) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = slot;
+    }
+
+    void Grow() {
+        std::vector<Slot> old_slots = std::move(slots_);
+        slots_.assign(old_slots.empty() ? 16 : old_slots.size() * 2, Slot{0, -1});
+        for (auto& slot : old_slots) {
+            if (slot.position >= 0) {
+                Place(slot);
+            }
+        }
+    }
+};
+
 class McpServer {
 public:
     static McpServer& GetInstance() {
@@ -321,24 +519,89 @@ public:
     void AddCommonTools();
     void AddUserOnlyTools();
     void AddTool(McpTool* tool);
-    void AddTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
-    void AddUserOnlyTool(const std::string& name, const std::string& description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddTool(std::string_view name, std::string_view description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
+    void AddUserOnlyTool(std::string_view name, std::string_view description, const PropertyList& properties, std::function<ReturnValue(const PropertyList&)> callback);
     void ParseMessage(const cJSON* json);
     void ParseMessage(const std::string& message);
+    // Serializes the tool catalog once, call it after all tools are added
+    void BuildToolsListCache();
+    uint32_t GetToolsHash();
+    // From inside a tool callback: true once the call timed out or the server cancelled it
+    bool IsToolCallCancelled();
+    // From inside a tool callback: sends notifications/progress if the caller asked for it.
+    // `progress` must increase with every report, `message` may carry partial text
+    void ReportProgress(int progress, int total = 0, const std::string& message = "");
 
 private:
     McpServer();
     ~McpServer();
 
+    enum ToolCallState {
+        kToolCallQueued,
+        kToolCallRunning,
+        kToolCallFinished
+    };
+
+    // Responses to one JSON-RPC batch
+    struct ReplyBatch {
+        std::mutex mutex;
+        int pending = 1;  // Calls still running, plus one while the batch is parsed
+        int requests = 0;
+        int64_t start_time = 0;
+        std::vector<std::string> responses;
+    };
+
+    struct ToolCall {
+        int id;
+        McpTool* tool;
+        PropertyList arguments;
+        int64_t deadline;
+        std::string progress_token;  // Serialized JSON, a number or a string, empty if not requested
+        std::atomic<int> state{kToolCallQueued};
+        std::shared_ptr<ReplyBatch> batch;  // Null unless the call came in a batch
+    };
+
+    // The call the current task is running
+    static thread_local ToolCall* current_call_;
+    // The batch the current task is parsing, replies made while parsing go into it
+    static thread_local std::shared_ptr<ReplyBatch> parsing_batch_;
+
     void ParseCapabilities(const cJSON* capabilities);
 
+    void ParseBatch(const cJSON* json);
     void ReplyResult(int id, const std::string& result);
     void ReplyError(int id, const std::string& message);
+    void SendResponse(const std::string& payload);
+    void ReplyToolCall(ToolCall& call, const std::string& payload);
+    void CompleteBatch(ReplyBatch& batch, const std::string& payload);
 
     void GetToolsList(int id, const std::string& cursor, bool list_user_only_tools);
-    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments);
+    void DoToolCall(int id, const std::string& tool_name, const cJSON* tool_arguments, const std::string& progress_token);
+    void RunToolCall(ToolCall& call);
+    bool FinishToolCall(ToolCall& call);
+    void CancelToolCall(int id);
+    void CheckToolCallDeadlines();
+    void ToolWorker();
+    std::shared_ptr<ToolCall> TakeRunnableToolCall();
+    void ReleaseToolsListCache();
 
     std::vector<McpTool*> tools_;
+    McpToolIndex tool_index_;
+    // Serialized tools back to back, preferably in PSRAM, tools_json_end_[i] is where tools_[i] ends
+    char* tools_json_ = nullptr;
+    std::vector<uint32_t> tools_json_end_;
+    uint32_t tools_hash_ = 0;
+
+    // Unfinished calls, queued_calls_ holds the ones waiting for a worker
+    std::mutex calls_mutex_;
+    std::condition_variable calls_cv_;
+    std::vector<std::shared_ptr<ToolCall>> active_calls_;
+    std::deque<std::shared_ptr<ToolCall>> queued_calls_;
+    std::vector<const char*> busy_resources_;
+    int running_workers_ = 0;
+    int idle_workers_ = 0;
+    esp_timer_handle_t deadline_timer_ = nullptr;
+    bool deadline_timer_running_ = false;
 };
 
 #endif // MCP_SERVER_H
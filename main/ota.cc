@@ -38,6 +38,8 @@ Ota::Ota() {
 }
 
 Ota::~Ota() {
+    cJSON_Delete(pending_mqtt_config_);
+    cJSON_Delete(pending_websocket_config_);
 }
 
 std::string Ota::GetCheckVersionUrl() {
@@ -86,6 +88,18 @@ bool Ota::CheckVersion() {
     }
 
     auto http = SetupHttp();
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    not_modified_ = false;
+    config_changed_ = true;
+    bool cache_valid = IsCacheValid(url);
+    if (cache_valid) {
+        Settings cache("ota", false);
+        auto etag = cache.GetString("etag");
+        if (!etag.empty()) {
+            http->SetHeader("If-None-Match", etag);
+        }
+    }
+#endif
 
     std::string data = board.GetSystemInfoJson();
     std::string method = data.length() > 0 ? "POST" : "GET";
@@ -97,12 +111,26 @@ bool Ota::CheckVersion() {
     }
 
     auto status_code = http->GetStatusCode();
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    // The config we run with is still current, nothing to parse
+    if (status_code == 304 && cache_valid) {
+        not_modified_ = true;
+        config_changed_ = false;
+        SetServerTimeFromDate(http->GetResponseHeader("Date"));
+        http->Close();
+        ESP_LOGI(TAG, "Config not modified");
+        return true;
+    }
+#endif
     if (status_code != 200) {
         ESP_LOGE(TAG, "Failed to check version, status code: %d", status_code);
         return false;
     }
 
     data = http->ReadAll();
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    auto etag = http->GetResponseHeader("ETag");
+#endif
     http->Close();
 
     // Response: { "firmware": { "version": "1.0.0", "url": "http://" } }
@@ -115,6 +143,32 @@ bool Ota::CheckVersion() {
         return false;
     }
 
+    ParseResponse(root, false);
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    SaveCachedConfig(root, url, etag);
+#endif
+    cJSON_Delete(root);
+    return true;
+}
+
+void Ota::SaveSettings(const char* ns, const cJSON* section) {
+    Settings settings(ns, true);
+    cJSON *item = NULL;
+    cJSON_ArrayForEach(item, section) {
+        if (cJSON_IsString(item)) {
+            if (settings.GetString(item->string) != item->valuestring) {
+                settings.SetString(item->string, item->valuestring);
+            }
+        } else if (cJSON_IsNumber(item)) {
+            if (settings.GetInt(item->string) != item->valueint) {
+                settings.SetInt(item->string, item->valueint);
+            }
+        }
+    }
+}
+
+// A cached response only restores the protocol config, time and firmware info are never reused
+void Ota::ParseResponse(const cJSON* root, bool cached) {
     has_activation_code_ = false;
     has_activation_challenge_ = false;
     cJSON *activation = cJSON_GetObjectItem(root, "activation");
@@ -142,18 +196,11 @@ bool Ota::CheckVersion() {
     has_mqtt_config_ = false;
     cJSON *mqtt = cJSON_GetObjectItem(root, "mqtt");
     if (cJSON_IsObject(mqtt)) {
-        Settings settings("mqtt", true);
-        cJSON *item = NULL;
-        cJSON_ArrayForEach(item, mqtt) {
-            if (cJSON_IsString(item)) {
-                if (settings.GetString(item->string) != item->valuestring) {
-                    settings.SetString(item->string, item->valuestring);
-                }
-            } else if (cJSON_IsNumber(item)) {
-                if (settings.GetInt(item->string) != item->valueint) {
-                    settings.SetInt(item->string, item->valueint);
-                }
-            }
+        if (defer_protocol_config_) {
+            cJSON_Delete(pending_mqtt_config_);
+            pending_mqtt_config_ = cJSON_Duplicate(mqtt, true);
+        } else {
+            SaveSettings("mqtt", mqtt);
         }
         has_mqtt_config_ = true;
     } else {
@@ -163,18 +210,11 @@ bool Ota::CheckVersion() {
     has_websocket_config_ = false;
     cJSON *websocket = cJSON_GetObjectItem(root, "websocket");
     if (cJSON_IsObject(websocket)) {
-        Settings settings("websocket", true);
-        cJSON *item = NULL;
-        cJSON_ArrayForEach(item, websocket) {
-            if (cJSON_IsString(item)) {
-                if (settings.GetString(item->string) != item->valuestring) {
-                    settings.SetString(item->string, item->valuestring);
-                }
-            } else if (cJSON_IsNumber(item)) {
-                if (settings.GetInt(item->string) != item->valueint) {
-                    settings.SetInt(item->string, item->valueint);
-                }
-            }
+        if (defer_protocol_config_) {
+            cJSON_Delete(pending_websocket_config_);
+            pending_websocket_config_ = cJSON_Duplicate(websocket, true);
+        } else {
+            SaveSettings("websocket", websocket);
         }
         has_websocket_config_ = true;
     } else {
@@ -183,7 +223,9 @@ bool Ota::CheckVersion() {
 
     has_server_time_ = false;
     cJSON *server_time = cJSON_GetObjectItem(root, "server_time");
-    if (cJSON_IsObject(server_time)) {
+    if (cached) {
+        // Stripped before caching
+    } else if (cJSON_IsObject(server_time)) {
         cJSON *timestamp = cJSON_GetObjectItem(server_time, "timestamp");
         cJSON *timezone_offset = cJSON_GetObjectItem(server_time, "timezone_offset");
         
@@ -208,7 +250,9 @@ bool Ota::CheckVersion() {
 
     has_new_version_ = false;
     cJSON *firmware = cJSON_GetObjectItem(root, "firmware");
-    if (cJSON_IsObject(firmware)) {
+    if (cached) {
+        // Left to the background check
+    } else if (cJSON_IsObject(firmware)) {
         cJSON *version = cJSON_GetObjectItem(firmware, "version");
         if (cJSON_IsString(version)) {
             firmware_version_ = version->valuestring;
@@ -235,11 +279,126 @@ bool Ota::CheckVersion() {
     } else {
         ESP_LOGW(TAG, "No firmware section found!");
     }
+}
 
+#if CONFIG_USE_CACHED_OTA_CONFIG
+// The cache belongs to one check URL and one firmware version, the server may answer others differently
+bool Ota::IsCacheValid(const std::string& url) {
+    Settings cache("ota", false);
+    return !cache.GetString("config").empty() && cache.GetString("url") == url &&
+        cache.GetString("version") == esp_app_get_description()->version;
+}
+
+void Ota::SaveProtocolConfig() {
+    if (pending_mqtt_config_ != nullptr) {
+        SaveSettings("mqtt", pending_mqtt_config_);
+    }
+    if (pending_websocket_config_ != nullptr) {
+        SaveSettings("websocket", pending_websocket_config_);
+    }
+}
+
+bool Ota::LoadCachedConfig() {
+    current_version_ = esp_app_get_description()->version;
+    if (!IsCacheValid(GetCheckVersionUrl())) {
+        return false;
+    }
+    Settings cache("ota", false);
+    auto config = cache.GetString("config");
+    cJSON* root = cJSON_Parse(config.c_str());
+    if (root == nullptr) {
+        ESP_LOGE(TAG, "Failed to parse the cached config");
+        return false;
+    }
+    ParseResponse(root, true);
     cJSON_Delete(root);
-    return true;
+    ESP_LOGI(TAG, "Using the cached config, %u bytes", config.size());
+    return has_mqtt_config_ || has_websocket_config_;
 }
 
+void Ota::SaveCachedConfig(const cJSON* root, const std::string& url, const std::string& etag) {
+    Settings cache("ota", true);
+    // An activation code is only good once, such a response is never reused
+    if (has_activation_code_ || has_activation_challenge_) {
+        cache.EraseAll();
+        return;
+    }
+
+    // The timestamp changes with every response, only the time zone is kept for 304 responses
+    auto config = cJSON_Duplicate(root, true);
+    auto server_time = cJSON_GetObjectItem(config, "server_time");
+    if (cJSON_IsObject(server_time)) {
+        auto timezone_offset = cJSON_GetObjectItem(server_time, "timezone_offset");
+        int offset = cJSON_IsNumber(timezone_offset) ? timezone_offset->valueint : 0;
+        if (!cache.GetBool("server_time") || cache.GetInt("timezone_offset") != offset) {
+            cache.SetBool("server_time", true);
+            cache.SetInt("timezone_offset", offset);
+        }
+        cJSON_DeleteItemFromObject(config, "server_time");
+    } else if (cache.GetBool("server_time")) {
+        cache.SetBool("server_time", false);
+    }
+    auto text = cJSON_PrintUnformatted(config);
+    std::string config_text = text;
+    cJSON_free(text);
+    cJSON_Delete(config);
+
+    if (config_text.size() > OTA_CONFIG_CACHE_MAX_SIZE) {
+        ESP_LOGW(TAG, "Config of %u bytes is too large to cache", config_text.size());
+        cache.EraseAll();
+        return;
+    }
+
+    config_changed_ = !IsCacheValid(url) || cache.GetString("config") != config_text;
+    if (config_changed_) {
+        cache.SetString("config", config_text);
+        cache.SetString("url", url);
+        cache.SetString("version", current_version_);
+    }
+    if (cache.GetString("etag") != etag) {
+        cache.SetString("etag", etag);
+    }
+}
+
+// Date: Sun, 06 Nov 1994 08:49:37 GMT
+void Ota::SetServerTimeFromDate(const std::string& date) {
+    Settings cache("ota", false);
+    if (!cache.GetBool("server_time")) {
+        return;
+    }
+    static const char* const MONTHS = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    int day, year, hour, minute, second;
+    char month_name[4] = {0};
+    if (sscanf(date.c_str(), "%*3s, %d %3s %d %d:%d:%d", &day, month_name, &year, &hour, &minute, &second) != 6) {
+        ESP_LOGW(TAG, "Invalid Date header: %s", date.c_str());
+        return;
+    }
+    auto month_pos = strstr(MONTHS, month_name);
+    if (month_pos == nullptr || strlen(month_name) != 3) {
+        return;
+    }
+    int month = (month_pos - MONTHS) / 3 + 1;
+
+    // Days since 1970-01-01 in the proleptic Gregorian calendar, newlib has no timegm()
+    int y = year - (month <= 2);
+    int era = y / 400;
+    int year_of_era = y - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    int64_t days = (int64_t)era * 146097 + day_of_era - 719468;
+
+    // Same convention as server_time: the time zone offset in minutes is added to UTC
+    int64_t seconds = days * 86400 + hour * 3600 + minute * 60 + second;
+    seconds += cache.GetInt("timezone_offset") * 60;
+    struct timeval tv = {
+        .tv_sec = (time_t)seconds,
+        .tv_usec = 0,
+    };
+    settimeofday(&tv, NULL);
+    has_server_time_ = true;
+}
+#endif
+
 void Ota::MarkCurrentVersionValid() {
     auto partition = esp_ota_get_running_partition();
     if (strcmp(partition->label, "factory") == 0) {
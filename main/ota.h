@@ -5,14 +5,29 @@
 #include <string>
 
 #include <esp_err.h>
+#include <cJSON.h>
 #include "board.h"
 
+// NVS strings are limited to 4000 bytes
+#define OTA_CONFIG_CACHE_MAX_SIZE 3072
+
 class Ota {
 public:
     Ota();
     ~Ota();
 
     bool CheckVersion();
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    // Restores the protocol config of the last successful check, false if there is none to use
+    bool LoadCachedConfig();
+    // The server answered 304 to the last check
+    bool IsNotModified() { return not_modified_; }
+    // The last check returned a config that differs from the cached one
+    bool HasConfigChanged() { return config_changed_; }
+    // Keeps the mqtt and websocket settings of the next check until SaveProtocolConfig(), the running protocol still uses them
+    void DeferProtocolConfig() { defer_protocol_config_ = true; }
+    void SaveProtocolConfig();
+#endif
     esp_err_t Activate();
     bool HasActivationChallenge() { return has_activation_challenge_; }
     bool HasNewVersion() { return has_new_version_; }
@@ -47,6 +62,11 @@ private:
     std::string activation_challenge_;
     std::string serial_number_;
     int activation_timeout_ms_ = 30000;
+    bool not_modified_ = false;
+    bool config_changed_ = true;
+    bool defer_protocol_config_ = false;
+    cJSON* pending_mqtt_config_ = nullptr;
+    cJSON* pending_websocket_config_ = nullptr;
 
     bool Upgrade(const std::string& firmware_url);
     std::function<void(int progress, size_t speed)> upgrade_callback_;
@@ -54,6 +74,13 @@ private:
     bool IsNewVersionAvailable(const std::string& currentVersion, const std::string& newVersion);
     std::string GetActivationPayload();
     std::unique_ptr<Http> SetupHttp();
+    void ParseResponse(const cJSON* root, bool cached);
+    void SaveSettings(const char* ns, const cJSON* section);
+#if CONFIG_USE_CACHED_OTA_CONFIG
+    bool IsCacheValid(const std::string& url);
+    void SaveCachedConfig(const cJSON* root, const std::string& url, const std::string& etag);
+    void SetServerTimeFromDate(const std::string& date);
+#endif
 };
 
 #endif // _OTA_H
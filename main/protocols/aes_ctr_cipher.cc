@@ -0,0 +1,35 @@
+#include "aes_ctr_cipher.h"
+
+#include <esp_log.h>
+#include <cstring>
+
+#define TAG "AesCtrCipher"
+
+AesCtrCipher::AesCtrCipher() {
+    mbedtls_aes_init(&ctx_);
+}
+
+AesCtrCipher::~AesCtrCipher() {
+    mbedtls_aes_free(&ctx_);
+}
+
+bool AesCtrCipher::SetKey(const uint8_t* key, size_t key_bits) {
+    int ret = mbedtls_aes_setkey_enc(&ctx_, key, key_bits);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to set key, ret: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+bool AesCtrCipher::Crypt(const uint8_t* nonce, const uint8_t* input, uint8_t* output, size_t size) {
+    // mbedtls advances the counter, so every packet starts from a copy of its nonce
+    memcpy(counter_, nonce, sizeof(counter_));
+    size_t nc_off = 0;
+    int ret = mbedtls_aes_crypt_ctr(&ctx_, size, &nc_off, counter_, stream_block_, input, output);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Failed to crypt %u bytes, ret: %d", size, ret);
+        return false;
+    }
+    return true;
+}
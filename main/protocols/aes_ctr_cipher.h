@@ -0,0 +1,38 @@
+#ifndef AES_CTR_CIPHER_H
+#define AES_CTR_CIPHER_H
+
+#include <mbedtls/aes.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#define AES_CTR_NONCE_SIZE 16
+
+/*
+ * AES-CTR for the UDP audio channel.
+ *
+ * The key schedule is expanded once per session and the counter and stream blocks are
+ * members, so a packet costs one mbedtls call and no heap traffic. `input` and `output`
+ * may point to the same buffer, which lets the caller encrypt a packet where it was built.
+ * With CONFIG_MBEDTLS_HARDWARE_AES the ESP-IDF port runs this on the AES peripheral and
+ * switches to DMA transfers for larger blocks on chips that support it.
+ *
+ * Not thread safe, use one instance per direction.
+ */
+class AesCtrCipher {
+public:
+    AesCtrCipher();
+    ~AesCtrCipher();
+    AesCtrCipher(const AesCtrCipher&) = delete;
+    AesCtrCipher& operator=(const AesCtrCipher&) = delete;
+
+    bool SetKey(const uint8_t* key, size_t key_bits);
+    bool Crypt(const uint8_t* nonce, const uint8_t* input, uint8_t* output, size_t size);
+
+private:
+    mbedtls_aes_context ctx_;
+    uint8_t counter_[AES_CTR_NONCE_SIZE];
+    uint8_t stream_block_[AES_CTR_NONCE_SIZE];
+};
+
+#endif // AES_CTR_CIPHER_H
@@ -0,0 +1,100 @@
+#include "audio_frame_batcher.h"
+#include "audio_service.h"
+
+#include <esp_log.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "AudioFrameBatcher"
+
+#ifndef CONFIG_AUDIO_BATCH_LATENCY_BUDGET_MS
+#define CONFIG_AUDIO_BATCH_LATENCY_BUDGET_MS (OPUS_FRAME_DURATION_MS * 3)
+#endif
+
+AudioFrameBatcher::AudioFrameBatcher() : latency_budget_ms_(CONFIG_AUDIO_BATCH_LATENCY_BUDGET_MS) {
+    frames_.reserve(AUDIO_BATCH_MAX_FRAMES);
+}
+
+void AudioFrameBatcher::SetLatencyBudget(int budget_ms) {
+    latency_budget_ms_ = budget_ms;
+    UpdateFramesPerMessage();
+}
+
+void AudioFrameBatcher::SetLinkRtt(int rtt_ms) {
+    link_rtt_ms_ = rtt_ms;
+    UpdateFramesPerMessage();
+}
+
+void AudioFrameBatcher::UpdateFramesPerMessage() {
+    // One more frame per 100ms of RTT, a fast link gets no batching at all
+    int max_frames = std::clamp(latency_budget_ms_ / OPUS_FRAME_DURATION_MS, 1, AUDIO_BATCH_MAX_FRAMES);
+    int frames = std::clamp(1 + link_rtt_ms_ / 100, 1, max_frames);
+    // Called for every QoS report, only a change is worth a line
+    if (frames != frames_per_message_) {
+        ESP_LOGI(TAG, "RTT %d ms, budget %d ms, %d frames per message", link_rtt_ms_, latency_budget_ms_, frames);
+    }
+    frames_per_message_ = frames;
+}
+
+bool AudioFrameBatcher::Add(std::unique_ptr<AudioStreamPacket> packet) {
+    frames_.push_back(std::move(packet));
+    return (int)frames_.size() >= frames_per_message_;
+}
+
+void AudioFrameBatcher::Clear() {
+    frames_.clear();
+}
+
+uint32_t AudioFrameBatcher::Serialize(std::string& out) {
+    if (frames_.empty()) {
+        return 0;
+    }
+    uint32_t timestamp = frames_.front()->timestamp;
+    size_t table_offset = out.size();
+    size_t data_size = 0;
+    for (auto& frame : frames_) {
+        data_size += frame->payload.size();
+    }
+    out.resize(table_offset + frames_.size() * sizeof(AudioBatchEntry) + data_size);
+
+    auto entry = (AudioBatchEntry*)&out[table_offset];
+    auto data = (uint8_t*)&out[table_offset + frames_.size() * sizeof(AudioBatchEntry)];
+    uint16_t offset = 0;
+    for (auto& frame : frames_) {
+        entry->length = htons(frame->payload.size());
+        // Device frames carry no timestamp unless server AEC is enabled, derive it from the frame position
+        if (frame->timestamp != 0 && timestamp != 0) {
+            offset = frame->timestamp - timestamp;
+        }
+        entry->timestamp_offset = htons(offset);
+        memcpy(data, frame->payload.data(), frame->payload.size());
+        data += frame->payload.size();
+        offset += frame->frame_duration > 0 ? frame->frame_duration : OPUS_FRAME_DURATION_MS;
+        entry++;
+    }
+    frames_.clear();
+    return timestamp;
+}
+
+bool AudioFrameBatcher::Parse(const uint8_t* data, size_t size, int frame_count, uint32_t timestamp,
+    std::function<void(const uint8_t* frame, size_t length, uint32_t timestamp)> callback) {
+    size_t table_size = frame_count * sizeof(AudioBatchEntry);
+    if (frame_count <= 0 || table_size > size) {
+        ESP_LOGE(TAG, "Invalid batch: %d frames in %u bytes", frame_count, size);
+        return false;
+    }
+
+    auto entry = (const AudioBatchEntry*)data;
+    size_t offset = table_size;
+    for (int i = 0; i < frame_count; i++, entry++) {
+        size_t length = ntohs(entry->length);
+        if (offset + length > size) {
+            ESP_LOGE(TAG, "Frame %d overflows the batch", i);
+            return false;
+        }
+        callback(data + offset, length, timestamp + ntohs(entry->timestamp_offset));
+        offset += length;
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef AUDIO_FRAME_BATCHER_H
+#define AUDIO_FRAME_BATCHER_H
+
+#include "protocol.h"
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <functional>
+
+/*
+ * Packs several Opus frames into one transport message.
+ *
+ * Batch layout (all fields big endian):
+ * |frame_count x {length 2u, timestamp_offset 2u}|frame data ...|
+ *
+ * The timestamp of frame i is the message timestamp plus its timestamp_offset in milliseconds.
+ * The number of frames per message follows the link RTT and is capped by the latency budget,
+ * so a LAN link keeps sending one frame per message while a 4G link trades a little latency
+ * for fewer radio wakeups. The RTT comes from the hello, then from every QoS report if qos is
+ * negotiated. A batch that stops filling is sent once its first frame is a budget old.
+ */
+#define AUDIO_BATCH_MAX_FRAMES 8
+
+struct AudioBatchEntry {
+    uint16_t length;
+    uint16_t timestamp_offset;
+} __attribute__((packed));
+
+class AudioFrameBatcher {
+public:
+    AudioFrameBatcher();
+
+    void SetLatencyBudget(int budget_ms);
+    void SetLinkRtt(int rtt_ms);
+    int frames_per_message() const { return frames_per_message_; }
+    int latency_budget() const { return latency_budget_ms_; }
+    int link_rtt() const { return link_rtt_ms_; }
+
+    // Returns true when the batch is ready to be sent
+    bool Add(std::unique_ptr<AudioStreamPacket> packet);
+    bool empty() const { return frames_.empty(); }
+    size_t frame_count() const { return frames_.size(); }
+    void Clear();
+
+    // Appends the batch to `out` and returns the timestamp of the first frame
+    uint32_t Serialize(std::string& out);
+    static bool Parse(const uint8_t* data, size_t size, int frame_count, uint32_t timestamp,
+        std::function<void(const uint8_t* frame, size_t length, uint32_t timestamp)> callback);
+
+private:
+    std::vector<std::unique_ptr<AudioStreamPacket>> frames_;
+    int latency_budget_ms_;
+    int link_rtt_ms_ = 0;
+    int frames_per_message_ = 1;
+
+    void UpdateFramesPerMessage();
+};
+
+#endif // AUDIO_FRAME_BATCHER_H
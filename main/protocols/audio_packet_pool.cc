@@ -0,0 +1,72 @@
+#include "audio_packet_pool.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+
+#define TAG "AudioPacketPool"
+
+AudioPacketPool& AudioPacketPool::GetInstance() {
+    static AudioPacketPool instance;
+    return instance;
+}
+
+AudioPacketPool::AudioPacketPool() {
+    free_packets_.reserve(AUDIO_PACKET_POOL_MAX_PACKETS);
+    last_stats_time_us_ = esp_timer_get_time();
+}
+
+std::unique_ptr<AudioStreamPacket> AudioPacketPool::Acquire(size_t payload_size) {
+    std::unique_ptr<AudioStreamPacket> packet;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        acquire_count_++;
+        if (!free_packets_.empty()) {
+            packet = std::move(free_packets_.back());
+            free_packets_.pop_back();
+        } else {
+            allocation_count_++;
+        }
+        if (packet && packet->payload.capacity() < payload_size) {
+            allocation_count_++;
+        }
+    }
+
+    if (!packet) {
+        packet = std::make_unique<AudioStreamPacket>();
+        packet->payload.reserve(std::max(payload_size, (size_t)AUDIO_PACKET_POOL_PAYLOAD_RESERVE));
+    }
+    packet->payload.resize(payload_size);
+    return packet;
+}
+
+void AudioPacketPool::Release(std::unique_ptr<AudioStreamPacket> packet) {
+    if (!packet) {
+        return;
+    }
+    packet->sample_rate = 0;
+    packet->frame_duration = 0;
+    packet->timestamp = 0;
+    packet->payload.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_packets_.size() < AUDIO_PACKET_POOL_MAX_PACKETS) {
+        free_packets_.push_back(std::move(packet));
+    }
+}
+
+void AudioPacketPool::PrintStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = esp_timer_get_time();
+    auto elapsed_ms = (now - last_stats_time_us_) / 1000;
+    if (elapsed_ms <= 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "rx packets: %lu/s, rx allocations: %lu/s, pooled: %u",
+        (unsigned long)(acquire_count_ * 1000 / elapsed_ms),
+        (unsigned long)(allocation_count_ * 1000 / elapsed_ms),
+        free_packets_.size());
+    acquire_count_ = 0;
+    allocation_count_ = 0;
+    last_stats_time_us_ = now;
+}
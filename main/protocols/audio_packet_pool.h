@@ -0,0 +1,45 @@
+#ifndef AUDIO_PACKET_POOL_H
+#define AUDIO_PACKET_POOL_H
+
+#include "protocol.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Recycles AudioStreamPacket objects on the receive path.
+ *
+ * The transport hands a packet buffer to the protocol, the protocol parses (and decrypts) the
+ * frame straight into a pooled packet, and the packet travels through the decode queue.
+ * After the Opus decoder has consumed it, AudioService returns it here with its payload
+ * capacity intact, so the steady state does not touch the heap.
+ */
+#define AUDIO_PACKET_POOL_MAX_PACKETS 24
+#define AUDIO_PACKET_POOL_PAYLOAD_RESERVE 512
+
+class AudioPacketPool {
+public:
+    static AudioPacketPool& GetInstance();
+    AudioPacketPool(const AudioPacketPool&) = delete;
+    AudioPacketPool& operator=(const AudioPacketPool&) = delete;
+
+    // The returned packet has payload.size() == payload_size, content is undefined
+    std::unique_ptr<AudioStreamPacket> Acquire(size_t payload_size);
+    void Release(std::unique_ptr<AudioStreamPacket> packet);
+    void PrintStats();
+
+private:
+    AudioPacketPool();
+    ~AudioPacketPool() = default;
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> free_packets_;
+
+    // Counters since the last PrintStats()
+    uint32_t acquire_count_ = 0;
+    uint32_t allocation_count_ = 0;
+    int64_t last_stats_time_us_ = 0;
+};
+
+#endif // AUDIO_PACKET_POOL_H
@@ -0,0 +1,46 @@
+#include "bitrate_controller.h"
+
+#include <algorithm>
+
+// Settle on multiples of this so small swings do not reconfigure the encoder every report
+#define BITRATE_STEP 500
+
+BitrateController::BitrateController(int min_bitrate, int max_bitrate, int start_bitrate)
+    : min_bitrate_(min_bitrate), max_bitrate_(max_bitrate), start_bitrate_(start_bitrate) {
+    Reset();
+}
+
+void BitrateController::Reset() {
+    bitrate_ = start_bitrate_;
+    min_bitrate_seen_ = start_bitrate_;
+    packet_loss_ = 0;
+}
+
+bool BitrateController::OnReport(const QosReport& report, int rtt_ms) {
+    int target = bitrate_;
+    int fraction_lost = report.fraction_lost;
+    if (fraction_lost > 256 / 10) {
+        // bitrate * (1 - loss / 2)
+        target = bitrate_ * (512 - fraction_lost) / 512;
+    } else if (fraction_lost < 256 / 50 && (rtt_ms < 0 || rtt_ms < QOS_RTT_HOLD_MS)) {
+        target = bitrate_ + std::max(bitrate_ * 8 / 100, BITRATE_STEP);
+    }
+
+    int max_bitrate = max_bitrate_;
+    if (report.max_bitrate > 0) {
+        max_bitrate = std::min(max_bitrate, report.max_bitrate);
+    }
+    target = target / BITRATE_STEP * BITRATE_STEP;
+    target = std::clamp(target, min_bitrate_, std::max(min_bitrate_, max_bitrate));
+
+    int packet_loss = 0;
+    if (fraction_lost > 256 / 100 && target >= QOS_FEC_MIN_BITRATE) {
+        packet_loss = std::min((fraction_lost * 100 + 255) / 256, 30);
+    }
+
+    bool changed = target != bitrate_ || packet_loss != packet_loss_;
+    bitrate_ = target;
+    packet_loss_ = packet_loss;
+    min_bitrate_seen_ = std::min(min_bitrate_seen_, bitrate_);
+    return changed;
+}
@@ -0,0 +1,44 @@
+#ifndef BITRATE_CONTROLLER_H
+#define BITRATE_CONTROLLER_H
+
+#include "qos_monitor.h"
+
+/*
+ * Loss based Opus bitrate and in-band FEC control, one instance per audio direction.
+ *
+ * Each receiver report moves the target: above 10% loss it backs off by half the loss fraction,
+ * below 2% it probes up by 8% unless the round trip is already above QOS_RTT_HOLD_MS, and in
+ * between it holds. A bitrate cap requested by the receiver always wins. With more than 1% loss
+ * the expected loss is handed to the encoder, which then spends part of the bitrate on FEC.
+ */
+#define QOS_UPLINK_MIN_BITRATE 8000
+#define QOS_UPLINK_MAX_BITRATE 32000
+#define QOS_UPLINK_START_BITRATE 16000
+#define QOS_DOWNLINK_MIN_BITRATE 12000
+#define QOS_DOWNLINK_MAX_BITRATE 48000
+#define QOS_FEC_MIN_BITRATE 12000
+#define QOS_RTT_HOLD_MS 400
+
+class BitrateController {
+public:
+    BitrateController(int min_bitrate, int max_bitrate, int start_bitrate);
+
+    void Reset();
+    // Returns true if the bitrate or the expected loss changed
+    bool OnReport(const QosReport& report, int rtt_ms);
+
+    int bitrate() const { return bitrate_; }
+    int min_bitrate_seen() const { return min_bitrate_seen_; }
+    // Expected packet loss in percent for OPUS_SET_PACKET_LOSS_PERC, 0 keeps FEC off
+    int packet_loss() const { return packet_loss_; }
+
+private:
+    int min_bitrate_;
+    int max_bitrate_;
+    int start_bitrate_;
+    int bitrate_;
+    int min_bitrate_seen_;
+    int packet_loss_ = 0;
+};
+
+#endif // BITRATE_CONTROLLER_H
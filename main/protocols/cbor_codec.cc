@@ -0,0 +1,527 @@
+#include "cbor_codec.h"
+
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cmath>
+
+#define CBOR_MAJOR_UNSIGNED 0
+#define CBOR_MAJOR_NEGATIVE 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+#define CBOR_MAJOR_SIMPLE 7
+
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_NULL 0xF6
+#define CBOR_FLOAT32 0xFA
+#define CBOR_FLOAT64 0xFB
+#define CBOR_BREAK 0xFF
+#define CBOR_INDEFINITE 31
+
+static size_t HeadSize(uint64_t value) {
+    if (value < 24) return 1;
+    if (value <= 0xFF) return 2;
+    if (value <= 0xFFFF) return 3;
+    if (value <= 0xFFFFFFFF) return 5;
+    return 9;
+}
+
+// Writes the head of a data item in its shortest form at `out`, which has HeadSize(value) bytes
+static void PutHead(uint8_t* out, int major, uint64_t value) {
+    size_t size = HeadSize(value);
+    static const uint8_t kInfo[] = {0, 0, 24, 25, 0, 26, 0, 0, 0, 27};
+    out[0] = (major << 5) | (size == 1 ? value : kInfo[size]);
+    for (size_t i = 1; i < size; i++) {
+        out[i] = value >> (8 * (size - 1 - i));
+    }
+}
+
+static void AppendHead(std::string& out, int major, uint64_t value) {
+    uint8_t head[9];
+    PutHead(head, major, value);
+    out.append((const char*)head, HeadSize(value));
+}
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool ReadHex4(const char* p, const char* end, uint32_t& value) {
+    if (end - p < 4) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        int v = HexValue(p[i]);
+        if (v < 0) {
+            return false;
+        }
+        value = (value << 4) | v;
+    }
+    return true;
+}
+
+static int EncodeUtf8(uint32_t code_point, char* out) {
+    if (code_point < 0x80) {
+        out[0] = code_point;
+        return 1;
+    } else if (code_point < 0x800) {
+        out[0] = 0xC0 | (code_point >> 6);
+        out[1] = 0x80 | (code_point & 0x3F);
+        return 2;
+    } else if (code_point < 0x10000) {
+        out[0] = 0xE0 | (code_point >> 12);
+        out[1] = 0x80 | ((code_point >> 6) & 0x3F);
+        out[2] = 0x80 | (code_point & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (code_point >> 18);
+    out[1] = 0x80 | ((code_point >> 12) & 0x3F);
+    out[2] = 0x80 | ((code_point >> 6) & 0x3F);
+    out[3] = 0x80 | (code_point & 0x3F);
+    return 4;
+}
+
+class JsonToCbor {
+public:
+    JsonToCbor(std::string_view json, std::string& out) : p_(json.data()), end_(json.data() + json.size()), out_(out) {}
+
+    bool Run() {
+        if (!Value(0)) {
+            return false;
+        }
+        SkipSpace();
+        return p_ == end_;
+    }
+
+private:
+    const char* p_;
+    const char* end_;
+    std::string& out_;
+
+    void SkipSpace() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+            p_++;
+        }
+    }
+
+    bool Expect(char c) {
+        SkipSpace();
+        if (p_ >= end_ || *p_ != c) {
+            return false;
+        }
+        p_++;
+        return true;
+    }
+
+    // Decodes the escape sequence at `r` (just after the backslash) into `buffer`, returns its size or -1
+    static int Unescape(const char*& r, const char* stop, char* buffer) {
+        switch (*r++) {
+            case '"': buffer[0] = '"'; return 1;
+            case '\\': buffer[0] = '\\'; return 1;
+            case '/': buffer[0] = '/'; return 1;
+            case 'b': buffer[0] = '\b'; return 1;
+            case 'f': buffer[0] = '\f'; return 1;
+            case 'n': buffer[0] = '\n'; return 1;
+            case 'r': buffer[0] = '\r'; return 1;
+            case 't': buffer[0] = '\t'; return 1;
+            case 'u': {
+                uint32_t code_point;
+                if (!ReadHex4(r, stop, code_point)) {
+                    return -1;
+                }
+                r += 4;
+                if (code_point >= 0xD800 && code_point < 0xDC00) {
+                    uint32_t low;
+                    if (stop - r < 6 || r[0] != '\\' || r[1] != 'u' || !ReadHex4(r + 2, stop, low) ||
+                        low < 0xDC00 || low >= 0xE000) {
+                        return -1;
+                    }
+                    r += 6;
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                }
+                return EncodeUtf8(code_point, buffer);
+            }
+            default:
+                return -1;
+        }
+    }
+
+    // p_ points at the opening quote. The first pass finds the end and the unescaped length,
+    // so the head can be written before the bytes.
+    bool String() {
+        const char* start = ++p_;
+        size_t length = 0;
+        bool escaped = false;
+        char buffer[4];
+        while (p_ < end_ && *p_ != '"') {
+            if ((uint8_t)*p_ < 0x20) {
+                return false;
+            }
+            if (*p_ == '\\') {
+                escaped = true;
+                p_++;
+                int n = Unescape(p_, end_, buffer);
+                if (n < 0) {
+                    return false;
+                }
+                length += n;
+            } else {
+                length++;
+                p_++;
+            }
+        }
+        if (p_ >= end_) {
+            return false;
+        }
+        const char* stop = p_++;
+
+        AppendHead(out_, CBOR_MAJOR_TEXT, length);
+        if (!escaped) {
+            out_.append(start, stop - start);
+            return true;
+        }
+        for (const char* r = start; r < stop;) {
+            if (*r != '\\') {
+                out_.push_back(*r++);
+                continue;
+            }
+            r++;
+            int n = Unescape(r, stop, buffer);
+            out_.append(buffer, n);
+        }
+        return true;
+    }
+
+    bool Number() {
+        const char* start = p_;
+        bool integer = true;
+        while (p_ < end_ && ((*p_ >= '0' && *p_ <= '9') || *p_ == '-' || *p_ == '+' || *p_ == '.' ||
+            *p_ == 'e' || *p_ == 'E')) {
+            if (*p_ == '.' || *p_ == 'e' || *p_ == 'E') {
+                integer = false;
+            }
+            p_++;
+        }
+        char text[40];
+        size_t size = p_ - start;
+        if (size == 0 || size >= sizeof(text)) {
+            return false;
+        }
+        memcpy(text, start, size);
+        text[size] = '\0';
+
+        char* stop;
+        if (integer) {
+            errno = 0;
+            long long value = strtoll(text, &stop, 10);
+            if (*stop == '\0' && errno == 0) {
+                if (value >= 0) {
+                    AppendHead(out_, CBOR_MAJOR_UNSIGNED, value);
+                } else {
+                    AppendHead(out_, CBOR_MAJOR_NEGATIVE, (uint64_t)(-1 - value));
+                }
+                return true;
+            }
+        }
+        double value = strtod(text, &stop);
+        if (*stop != '\0') {
+            return false;
+        }
+        float single = (float)value;
+        if ((double)single == value) {
+            uint32_t bits;
+            memcpy(&bits, &single, sizeof(bits));
+            out_.push_back((char)CBOR_FLOAT32);
+            for (int i = 3; i >= 0; i--) {
+                out_.push_back(bits >> (8 * i));
+            }
+        } else {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            out_.push_back((char)CBOR_FLOAT64);
+            for (int i = 7; i >= 0; i--) {
+                out_.push_back(bits >> (8 * i));
+            }
+        }
+        return true;
+    }
+
+    bool Literal(const char* literal, size_t length, uint8_t item) {
+        if ((size_t)(end_ - p_) < length || memcmp(p_, literal, length) != 0) {
+            return false;
+        }
+        p_ += length;
+        out_.push_back(item);
+        return true;
+    }
+
+    // The element count is only known at the end, a one byte head is reserved and widened if needed
+    void PatchHead(size_t position, int major, uint64_t count) {
+        size_t size = HeadSize(count);
+        if (size > 1) {
+            out_.insert(position + 1, size - 1, '\0');
+        }
+        PutHead((uint8_t*)&out_[position], major, count);
+    }
+
+    bool Container(int depth, bool map) {
+        char close = map ? '}' : ']';
+        size_t position = out_.size();
+        out_.push_back(0);
+        p_++;
+        uint64_t count = 0;
+        SkipSpace();
+        if (p_ < end_ && *p_ == close) {
+            p_++;
+        } else {
+            while (true) {
+                if (map) {
+                    SkipSpace();
+                    if (p_ >= end_ || *p_ != '"' || !String() || !Expect(':')) {
+                        return false;
+                    }
+                }
+                if (!Value(depth + 1)) {
+                    return false;
+                }
+                count++;
+                SkipSpace();
+                if (p_ < end_ && *p_ == ',') {
+                    p_++;
+                } else if (p_ < end_ && *p_ == close) {
+                    p_++;
+                    break;
+                } else {
+                    return false;
+                }
+            }
+        }
+        PatchHead(position, map ? CBOR_MAJOR_MAP : CBOR_MAJOR_ARRAY, count);
+        return true;
+    }
+
+    bool Value(int depth) {
+        if (depth >= CBOR_MAX_DEPTH) {
+            return false;
+        }
+        SkipSpace();
+        if (p_ >= end_) {
+            return false;
+        }
+        switch (*p_) {
+            case '{': return Container(depth, true);
+            case '[': return Container(depth, false);
+            case '"': return String();
+            case 't': return Literal("true", 4, CBOR_TRUE);
+            case 'f': return Literal("false", 5, CBOR_FALSE);
+            case 'n': return Literal("null", 4, CBOR_NULL);
+            default: return Number();
+        }
+    }
+};
+
+class CborToJson {
+public:
+    CborToJson(const uint8_t* data, size_t size, std::string& out) : p_(data), end_(data + size), out_(out) {}
+
+    bool Run() {
+        return Item(0) && p_ == end_;
+    }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+    std::string& out_;
+
+    // Reads the head of the next item, `value` is the argument or CBOR_INDEFINITE
+    bool Head(int& major, uint64_t& value, int& info) {
+        if (p_ >= end_) {
+            return false;
+        }
+        major = *p_ >> 5;
+        info = *p_ & 0x1F;
+        p_++;
+        if (info < 24) {
+            value = info;
+            return true;
+        }
+        if (info == CBOR_INDEFINITE) {
+            value = CBOR_INDEFINITE;
+            return true;
+        }
+        if (info > 27) {
+            return false;
+        }
+        size_t size = 1 << (info - 24);
+        if ((size_t)(end_ - p_) < size) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < size; i++) {
+            value = (value << 8) | *p_++;
+        }
+        return true;
+    }
+
+    void Double(double value, int precision) {
+        if (!std::isfinite(value)) {
+            out_ += "null";
+            return;
+        }
+        // Shortest form that reads back to the same value
+        char text[32];
+        snprintf(text, sizeof(text), "%.*g", precision - 2, value);
+        if (strtod(text, nullptr) != value) {
+            snprintf(text, sizeof(text), "%.*g", precision, value);
+        }
+        out_ += text;
+    }
+
+    bool Text(uint64_t length, int info) {
+        if (info == CBOR_INDEFINITE || length > (uint64_t)(end_ - p_)) {
+            return false;
+        }
+        out_.push_back('"');
+        for (const uint8_t* end = p_ + length; p_ < end; p_++) {
+            uint8_t c = *p_;
+            if (c == '"' || c == '\\') {
+                out_.push_back('\\');
+                out_.push_back(c);
+            } else if (c == '\n') {
+                out_ += "\\n";
+            } else if (c == '\r') {
+                out_ += "\\r";
+            } else if (c == '\t') {
+                out_ += "\\t";
+            } else if (c < 0x20) {
+                char escape[8];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                out_ += escape;
+            } else {
+                out_.push_back(c);
+            }
+        }
+        out_.push_back('"');
+        return true;
+    }
+
+    bool AtBreak() {
+        if (p_ < end_ && *p_ == CBOR_BREAK) {
+            p_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool Container(int depth, bool map, uint64_t count, int info) {
+        out_.push_back(map ? '{' : '[');
+        bool indefinite = info == CBOR_INDEFINITE;
+        for (uint64_t i = 0; indefinite || i < count; i++) {
+            if (indefinite && AtBreak()) {
+                break;
+            }
+            if (i > 0) {
+                out_.push_back(',');
+            }
+            if (map) {
+                int major, key_info;
+                uint64_t length;
+                if (!Head(major, length, key_info) || major != CBOR_MAJOR_TEXT || !Text(length, key_info)) {
+                    return false;
+                }
+                out_.push_back(':');
+            }
+            if (!Item(depth + 1)) {
+                return false;
+            }
+        }
+        out_.push_back(map ? '}' : ']');
+        return true;
+    }
+
+    bool Item(int depth) {
+        if (depth >= CBOR_MAX_DEPTH) {
+            return false;
+        }
+        int major, info;
+        uint64_t value;
+        if (!Head(major, value, info)) {
+            return false;
+        }
+        switch (major) {
+            case CBOR_MAJOR_UNSIGNED:
+                out_ += std::to_string(value);
+                return info != CBOR_INDEFINITE;
+            case CBOR_MAJOR_NEGATIVE:
+                if (info == CBOR_INDEFINITE || value == UINT64_MAX) {
+                    return false;
+                }
+                out_.push_back('-');
+                out_ += std::to_string(value + 1);
+                return true;
+            case CBOR_MAJOR_TEXT:
+                return Text(value, info);
+            case CBOR_MAJOR_ARRAY:
+                return Container(depth, false, value, info);
+            case CBOR_MAJOR_MAP:
+                return Container(depth, true, value, info);
+            case CBOR_MAJOR_SIMPLE:
+                if (info == 20) {
+                    out_ += "false";
+                } else if (info == 21) {
+                    out_ += "true";
+                } else if (info == 22) {
+                    out_ += "null";
+                } else if (info == 25) {
+                    // Half precision
+                    int exponent = (value >> 10) & 0x1F;
+                    double mantissa = value & 0x3FF;
+                    double half = exponent == 0 ? std::ldexp(mantissa, -24) :
+                        exponent == 31 ? (mantissa == 0 ? INFINITY : NAN) : std::ldexp(mantissa + 1024, exponent - 25);
+                    Double((value & 0x8000) ? -half : half, 9);
+                } else if (info == 26) {
+                    uint32_t bits = value;
+                    float single;
+                    memcpy(&single, &bits, sizeof(single));
+                    Double(single, 9);
+                } else if (info == 27) {
+                    double number;
+                    memcpy(&number, &value, sizeof(number));
+                    Double(number, 17);
+                } else {
+                    return false;
+                }
+                return true;
+            default:
+                // Byte strings and tags have no JSON counterpart
+                return false;
+        }
+    }
+};
+
+bool CborCodec::FromJson(std::string_view json, std::string& out) {
+    size_t size = out.size();
+    if (!JsonToCbor(json, out).Run()) {
+        out.resize(size);
+        return false;
+    }
+    return true;
+}
+
+bool CborCodec::ToJson(const uint8_t* data, size_t size, std::string& out) {
+    size_t original_size = out.size();
+    if (!CborToJson(data, size, out).Run()) {
+        out.resize(original_size);
+        return false;
+    }
+    return true;
+}
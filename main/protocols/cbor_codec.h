@@ -0,0 +1,31 @@
+#ifndef CBOR_CODEC_H
+#define CBOR_CODEC_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Streaming JSON <-> CBOR (RFC 8949) transcoder for control and MCP messages.
+ *
+ * Messages are still built and consumed as JSON text, the codec converts them at the transport
+ * boundary without building a tree: FromJson() appends CBOR to a reused send buffer and ToJson()
+ * appends JSON text to a reused receive buffer. The transcode is extra CPU on top of the JSON path,
+ * traded for fewer bytes on the air. Containers are written with definite lengths,
+ * the decoder also accepts indefinite ones. Byte strings, tags and undefined have no JSON
+ * counterpart and are rejected.
+ */
+#define CBOR_MAX_DEPTH 16
+
+class CborCodec {
+public:
+    // Appends the CBOR encoding of `json` to `out`, false if `json` is malformed
+    static bool FromJson(std::string_view json, std::string& out);
+    // Appends the JSON text of the CBOR data item to `out`, false if it is malformed or has trailing bytes
+    static bool ToJson(const uint8_t* data, size_t size, std::string& out);
+    // A CBOR map header, which a JSON object never starts with
+    static bool IsCborMap(uint8_t first_byte) { return (first_byte & 0xE0) == 0xA0; }
+};
+
+#endif // CBOR_CODEC_H
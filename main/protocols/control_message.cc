@@ -0,0 +1,88 @@
+#include "control_message.h"
+
+#include <cstdint>
+
+struct ControlMessageTypeEntry {
+    std::string_view name;
+    ControlMessageType type;
+};
+
+// ((type[0] << 1) + type[1] + length) & 15 is collision free for the known types
+static constexpr size_t HashControlMessageType(std::string_view type) {
+    return (((uint8_t)type[0] << 1) + (uint8_t)type[1] + type.size()) & 15;
+}
+
+static constexpr ControlMessageTypeEntry kTypeTable[16] = {
+    {"mcp", kControlMessageMcp},            // 0
+    {"custom", kControlMessageCustom},      // 1
+    {},
+    {"alert", kControlMessageAlert},        // 3
+    {"goodbye", kControlMessageGoodbye},    // 4
+    {"system", kControlMessageSystem},      // 5
+    {},
+    {"llm", kControlMessageLlm},            // 7
+    {},
+    {},
+    {"hello", kControlMessageHello},        // 10
+    {},
+    {},
+    {"stt", kControlMessageStt},            // 13
+    {},
+    {"tts", kControlMessageTts},            // 15
+};
+
+static constexpr bool CheckTypeTable() {
+    for (size_t i = 0; i < 16; i++) {
+        if (!kTypeTable[i].name.empty() && HashControlMessageType(kTypeTable[i].name) != i) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert(CheckTypeTable(), "Control message types must sit at their hash");
+
+ControlMessageType LookupControlMessageType(std::string_view type) {
+    if (type.size() < 2) {
+        return kControlMessageUnknown;
+    }
+    auto& entry = kTypeTable[HashControlMessageType(type)];
+    return entry.name == type ? entry.type : kControlMessageUnknown;
+}
+
+bool ScanControlMessage(std::string_view json, JsonArena& arena, ControlMessage& message) {
+    arena.Reset();
+    message = ControlMessage();
+
+    JsonScanner scanner(json, arena);
+    std::string_view key;
+    JsonToken value;
+    while (scanner.Next(key, value)) {
+        if (value.type == kJsonString) {
+            if (key == "type") {
+                message.type = LookupControlMessageType(value.text);
+            } else if (key == "state") {
+                message.state = value.text;
+            } else if (key == "text") {
+                message.text = value.text;
+            } else if (key == "emotion") {
+                message.emotion = value.text;
+            }
+        } else if ((value.type == kJsonObject || value.type == kJsonArray) && key == "payload") {
+            message.payload = value.text;
+        }
+    }
+    if (!scanner.ok()) {
+        return false;
+    }
+
+    switch (message.type) {
+        case kControlMessageTts:
+        case kControlMessageStt:
+        case kControlMessageLlm:
+            return true;
+        case kControlMessageMcp:
+            return !message.payload.empty();
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef CONTROL_MESSAGE_H
+#define CONTROL_MESSAGE_H
+
+#include "json_scanner.h"
+
+#include <string_view>
+
+enum ControlMessageType {
+    kControlMessageUnknown,
+    kControlMessageHello,
+    kControlMessageGoodbye,
+    kControlMessageTts,
+    kControlMessageStt,
+    kControlMessageLlm,
+    kControlMessageMcp,
+    kControlMessageSystem,
+    kControlMessageAlert,
+    kControlMessageCustom,
+};
+
+// Fields of the hot server messages, the views point into the message text or the arena
+struct ControlMessage {
+    ControlMessageType type = kControlMessageUnknown;
+    std::string_view state;
+    std::string_view text;
+    std::string_view emotion;
+    std::string_view payload;   // Raw JSON of the mcp payload, an object or a batch array
+};
+
+// Perfect hash lookup of the "type" field, kControlMessageUnknown for anything else
+ControlMessageType LookupControlMessageType(std::string_view type);
+
+// Scans a tts, stt, llm or mcp message in place. Returns false for other types and for
+// malformed messages, those go through cJSON as before.
+bool ScanControlMessage(std::string_view json, JsonArena& arena, ControlMessage& message);
+
+#endif // CONTROL_MESSAGE_H
@@ -0,0 +1,257 @@
+#include "json_scanner.h"
+
+#include <cstring>
+#include <cstdint>
+
+char* JsonArena::Allocate(size_t size) {
+    if (size > JSON_ARENA_SIZE - used_) {
+        return nullptr;
+    }
+    char* p = buffer_ + used_;
+    used_ += size;
+    return p;
+}
+
+JsonScanner::JsonScanner(std::string_view json, JsonArena& arena)
+    : p_(json.data()), end_(json.data() + json.size()), arena_(arena) {
+}
+
+bool JsonScanner::Fail() {
+    ok_ = false;
+    return false;
+}
+
+void JsonScanner::SkipSpace() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+        p_++;
+    }
+}
+
+static int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool ReadHex4(const char* p, uint32_t& value) {
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        int v = HexValue(p[i]);
+        if (v < 0) {
+            return false;
+        }
+        value = (value << 4) | v;
+    }
+    return true;
+}
+
+static char* EncodeUtf8(uint32_t code_point, char* out) {
+    if (code_point < 0x80) {
+        *out++ = code_point;
+    } else if (code_point < 0x800) {
+        *out++ = 0xC0 | (code_point >> 6);
+        *out++ = 0x80 | (code_point & 0x3F);
+    } else if (code_point < 0x10000) {
+        *out++ = 0xE0 | (code_point >> 12);
+        *out++ = 0x80 | ((code_point >> 6) & 0x3F);
+        *out++ = 0x80 | (code_point & 0x3F);
+    } else {
+        *out++ = 0xF0 | (code_point >> 18);
+        *out++ = 0x80 | ((code_point >> 12) & 0x3F);
+        *out++ = 0x80 | ((code_point >> 6) & 0x3F);
+        *out++ = 0x80 | (code_point & 0x3F);
+    }
+    return out;
+}
+
+// p_ points at the opening quote
+bool JsonScanner::ReadString(std::string_view& out) {
+    const char* start = ++p_;
+    bool escaped = false;
+    while (p_ < end_ && *p_ != '"') {
+        if ((uint8_t)*p_ < 0x20) {
+            return Fail();
+        }
+        if (*p_ == '\\') {
+            escaped = true;
+            p_++;
+        }
+        p_++;
+    }
+    if (p_ >= end_) {
+        return Fail();
+    }
+    const char* stop = p_++;
+    if (!escaped) {
+        out = std::string_view(start, stop - start);
+        return true;
+    }
+
+    // Unescaping never makes a string longer, \uXXXX takes at most 4 bytes as UTF-8 and so do surrogate pairs
+    char* buffer = arena_.Allocate(stop - start);
+    if (buffer == nullptr) {
+        return Fail();
+    }
+    char* w = buffer;
+    for (const char* r = start; r < stop; r++) {
+        if (*r != '\\') {
+            *w++ = *r;
+            continue;
+        }
+        switch (*++r) {
+            case '"': *w++ = '"'; break;
+            case '\\': *w++ = '\\'; break;
+            case '/': *w++ = '/'; break;
+            case 'b': *w++ = '\b'; break;
+            case 'f': *w++ = '\f'; break;
+            case 'n': *w++ = '\n'; break;
+            case 'r': *w++ = '\r'; break;
+            case 't': *w++ = '\t'; break;
+            case 'u': {
+                uint32_t code_point;
+                if (stop - r < 5 || !ReadHex4(r + 1, code_point)) {
+                    return Fail();
+                }
+                r += 4;
+                if (code_point >= 0xD800 && code_point < 0xDC00) {
+                    uint32_t low;
+                    if (stop - r < 7 || r[1] != '\\' || r[2] != 'u' || !ReadHex4(r + 3, low) ||
+                        low < 0xDC00 || low >= 0xE000) {
+                        return Fail();
+                    }
+                    r += 6;
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                }
+                w = EncodeUtf8(code_point, w);
+                break;
+            }
+            default:
+                return Fail();
+        }
+    }
+    out = std::string_view(buffer, w - buffer);
+    return true;
+}
+
+// p_ points at the opening bracket, strings are skipped so brackets inside them do not count
+bool JsonScanner::SkipContainer() {
+    int depth = 0;
+    while (p_ < end_) {
+        char c = *p_;
+        if (c == '"') {
+            p_++;
+            while (p_ < end_ && *p_ != '"') {
+                if (*p_ == '\\') {
+                    p_++;
+                }
+                p_++;
+            }
+            if (p_ >= end_) {
+                return Fail();
+            }
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                p_++;
+                return true;
+            }
+        }
+        p_++;
+    }
+    return Fail();
+}
+
+bool JsonScanner::ReadLiteral(const char* literal, size_t length) {
+    if ((size_t)(end_ - p_) < length || memcmp(p_, literal, length) != 0) {
+        return Fail();
+    }
+    p_ += length;
+    return true;
+}
+
+bool JsonScanner::Next(std::string_view& key, JsonToken& value) {
+    if (done_ || !ok_) {
+        return false;
+    }
+
+    SkipSpace();
+    if (!started_) {
+        if (p_ >= end_ || *p_ != '{') {
+            return Fail();
+        }
+        p_++;
+        started_ = true;
+        SkipSpace();
+        if (p_ < end_ && *p_ == '}') {
+            done_ = true;
+            return false;
+        }
+    } else if (p_ < end_ && *p_ == ',') {
+        p_++;
+        SkipSpace();
+    } else if (p_ < end_ && *p_ == '}') {
+        done_ = true;
+        return false;
+    } else {
+        return Fail();
+    }
+
+    if (p_ >= end_ || *p_ != '"' || !ReadString(key)) {
+        return Fail();
+    }
+    SkipSpace();
+    if (p_ >= end_ || *p_ != ':') {
+        return Fail();
+    }
+    p_++;
+    SkipSpace();
+    if (p_ >= end_) {
+        return Fail();
+    }
+
+    const char* start = p_;
+    switch (*p_) {
+        case '"':
+            value.type = kJsonString;
+            return ReadString(value.text);
+        case '{':
+        case '[':
+            value.type = *p_ == '{' ? kJsonObject : kJsonArray;
+            if (!SkipContainer()) {
+                return false;
+            }
+            break;
+        case 't':
+            value.type = kJsonTrue;
+            if (!ReadLiteral("true", 4)) {
+                return false;
+            }
+            break;
+        case 'f':
+            value.type = kJsonFalse;
+            if (!ReadLiteral("false", 5)) {
+                return false;
+            }
+            break;
+        case 'n':
+            value.type = kJsonNull;
+            if (!ReadLiteral("null", 4)) {
+                return false;
+            }
+            break;
+        default:
+            if (*p_ != '-' && (*p_ < '0' || *p_ > '9')) {
+                return Fail();
+            }
+            value.type = kJsonNumber;
+            while (p_ < end_ && ((*p_ >= '0' && *p_ <= '9') || *p_ == '-' || *p_ == '+' || *p_ == '.' ||
+                *p_ == 'e' || *p_ == 'E')) {
+                p_++;
+            }
+            break;
+    }
+    value.text = std::string_view(start, p_ - start);
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef JSON_SCANNER_H
+#define JSON_SCANNER_H
+
+#include <string_view>
+#include <cstddef>
+
+/*
+ * In-place tokenizer for the members of a flat JSON object.
+ *
+ * Nothing is allocated: keys and string values are views into the message text, only strings
+ * with escape sequences are unescaped into a JsonArena. Nested objects and arrays are returned
+ * as raw JSON slices. Malformed input makes Next() return false with ok() == false, callers
+ * then fall back to cJSON.
+ */
+#define JSON_ARENA_SIZE 2048
+
+class JsonArena {
+public:
+    void Reset() { used_ = 0; }
+    // Returns nullptr if the arena is full
+    char* Allocate(size_t size);
+
+private:
+    char buffer_[JSON_ARENA_SIZE];
+    size_t used_ = 0;
+};
+
+enum JsonTokenType {
+    kJsonString,
+    kJsonNumber,
+    kJsonTrue,
+    kJsonFalse,
+    kJsonNull,
+    kJsonObject,
+    kJsonArray,
+};
+
+struct JsonToken {
+    JsonTokenType type;
+    std::string_view text;  // Unescaped for strings, raw JSON for everything else
+};
+
+class JsonScanner {
+public:
+    // Views returned by Next() stay valid as long as `json` and `arena` are untouched
+    JsonScanner(std::string_view json, JsonArena& arena);
+
+    // Reads the next member of the top level object, false at the end or on malformed input
+    bool Next(std::string_view& key, JsonToken& value);
+    bool ok() const { return ok_; }
+
+private:
+    const char* p_;
+    const char* end_;
+    JsonArena& arena_;
+    bool ok_ = true;
+    bool started_ = false;
+    bool done_ = false;
+
+    void SkipSpace();
+    bool ReadString(std::string_view& out);
+    bool SkipContainer();
+    bool ReadLiteral(const char* literal, size_t length);
+    bool Fail();
+};
+
+#endif // JSON_SCANNER_H
@@ -2,6 +2,7 @@
 #include "board.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
 
 #include <esp_log.h>
 #include <cstring>
@@ -10,9 +11,17 @@
 
 #define TAG "MQTT"
 
-MqttProtocol::MqttProtocol() {
+MqttProtocol::MqttProtocol() : reorder_window_(CONFIG_UDP_REORDER_WINDOW_SIZE, CONFIG_UDP_REORDER_HOLD_MS) {
     event_group_handle_ = xEventGroupCreate();
 
+    reorder_window_.OnRelease([this](std::unique_ptr<AudioStreamPacket> packet) {
+        if (on_incoming_audio_ != nullptr) {
+            on_incoming_audio_(std::move(packet));
+        } else {
+            AudioPacketPool::GetInstance().Release(std::move(packet));
+        }
+    });
+
     // Initialize reconnect timer
     esp_timer_create_args_t reconnect_timer_args = {
         .callback = [](void* arg) {
@@ -32,6 +41,8 @@ MqttProtocol::MqttProtocol() {
 
 MqttProtocol::~MqttProtocol() {
     ESP_LOGI(TAG, "MqttProtocol deinit");
+    // The sender task writes to mqtt_ and udp_, stop it while the members are still there
+    sender_.Stop();
     if (reconnect_timer_ != nullptr) {
         esp_timer_stop(reconnect_timer_);
         esp_timer_delete(reconnect_timer_);
@@ -50,10 +61,7 @@ bool MqttProtocol::Start() {
 }
 
 bool MqttProtocol::StartMqttClient(bool report_error) {
-    if (mqtt_ != nullptr) {
-        ESP_LOGW(TAG, "Mqtt client already started");
-        mqtt_.reset();
-    }
+    ResetMqttClient();
 
     Settings settings("mqtt", false);
     auto endpoint = settings.GetString("endpoint");
@@ -61,7 +69,7 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     auto username = settings.GetString("username");
     auto password = settings.GetString("password");
     int keepalive_interval = settings.GetInt("keepalive", 240);
-    publish_topic_ = settings.GetString("publish_topic");
+    auto publish_topic = settings.GetString("publish_topic");
 
     if (endpoint.empty()) {
         ESP_LOGW(TAG, "MQTT endpoint is not specified");
@@ -71,11 +79,12 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         return false;
     }
 
+    // Set up and connected before it is published to mqtt_, the sender task only sees a ready client
     auto network = Board::GetInstance().GetNetwork();
-    mqtt_ = network->CreateMqtt(0);
-    mqtt_->SetKeepAlive(keepalive_interval);
+    auto mqtt = network->CreateMqtt(0);
+    mqtt->SetKeepAlive(keepalive_interval);
 
-    mqtt_->OnDisconnected([this]() {
+    mqtt->OnDisconnected([this]() {
         if (on_disconnected_ != nullptr) {
             on_disconnected_();
         }
@@ -83,17 +92,31 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         esp_timer_start_once(reconnect_timer_, MQTT_RECONNECT_INTERVAL_MS * 1000);
     });
 
-    mqtt_->OnConnected([this]() {
+    mqtt->OnConnected([this]() {
         if (on_connected_ != nullptr) {
             on_connected_();
         }
         esp_timer_stop(reconnect_timer_);
     });
 
-    mqtt_->OnMessage([this](const std::string& topic, const std::string& payload) {
-        cJSON* root = cJSON_Parse(payload.c_str());
+    mqtt->OnMessage([this](const std::string& topic, const std::string& payload) {
+        // A CBOR map never starts like a JSON object, decode it back to JSON text
+        const std::string* json = &payload;
+        if (!payload.empty() && CborCodec::IsCborMap(payload[0])) {
+            rx_text_buffer_.clear();
+            if (!CborCodec::ToJson((const uint8_t*)payload.data(), payload.size(), rx_text_buffer_)) {
+                ESP_LOGE(TAG, "Failed to decode CBOR message, %u bytes", payload.size());
+                return;
+            }
+            json = &rx_text_buffer_;
+        }
+        if (on_incoming_text_ != nullptr && on_incoming_text_(*json)) {
+            last_incoming_time_ = std::chrono::steady_clock::now();
+            return;
+        }
+        cJSON* root = cJSON_Parse(json->c_str());
         if (root == nullptr) {
-            ESP_LOGE(TAG, "Failed to parse json message %s", payload.c_str());
+            ESP_LOGE(TAG, "Failed to parse json message %s", json->c_str());
             return;
         }
         cJSON* type = cJSON_GetObjectItem(root, "type");
@@ -108,11 +131,13 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
         } else if (strcmp(type->valuestring, "goodbye") == 0) {
             auto session_id = cJSON_GetObjectItem(root, "session_id");
             ESP_LOGI(TAG, "Received goodbye message, session_id: %s", session_id ? session_id->valuestring : "null");
-            if (session_id == nullptr || session_id_ == session_id->valuestring) {
+            if (session_id == nullptr || this->session_id() == session_id->valuestring) {
                 Application::GetInstance().Schedule([this]() {
                     CloseAudioChannel();
                 });
             }
+        } else if (strcmp(type->valuestring, "qos") == 0) {
+            OnQosReport(root);
         } else if (on_incoming_json_ != nullptr) {
             on_incoming_json_(root);
         }
@@ -130,21 +155,51 @@ bool MqttProtocol::StartMqttClient(bool report_error) {
     } else {
         broker_address = endpoint;
     }
-    if (!mqtt_->Connect(broker_address, broker_port, client_id, username, password)) {
+    if (!mqtt->Connect(broker_address, broker_port, client_id, username, password)) {
         ESP_LOGE(TAG, "Failed to connect to endpoint");
         SetError(Lang::Strings::SERVER_NOT_CONNECTED);
         return false;
     }
 
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        mqtt.swap(mqtt_);
+        publish_topic_ = publish_topic;
+    }
     ESP_LOGI(TAG, "Connected to endpoint");
     return true;
 }
 
+// Destroys the client outside mqtt_mutex_, its disconnect callback must not wait on a publisher
+void MqttProtocol::ResetMqttClient() {
+    std::unique_ptr<Mqtt> mqtt;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        mqtt = std::move(mqtt_);
+    }
+}
+
 bool MqttProtocol::SendText(const std::string& text) {
-    if (publish_topic_.empty()) {
+    {
+        // Audio queued before this message must reach the server first
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        if (udp_ != nullptr && audio_batch_enabled_) {
+            SendAudioBatch();
+        }
+    }
+    std::lock_guard<std::mutex> lock(mqtt_mutex_);
+    if (mqtt_ == nullptr || publish_topic_.empty()) {
         return false;
     }
-    if (!mqtt_->Publish(publish_topic_, text)) {
+    // Once negotiated, messages go out as CBOR, anything that is not valid JSON is published as is
+    const std::string* payload = &text;
+    if (cbor_enabled_) {
+        cbor_buffer_.clear();
+        if (CborCodec::FromJson(text, cbor_buffer_)) {
+            payload = &cbor_buffer_;
+        }
+    }
+    if (!mqtt_->Publish(publish_topic_, *payload)) {
         ESP_LOGE(TAG, "Failed to publish message: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
@@ -158,45 +213,125 @@ bool MqttProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
         return false;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(packet->payload.size());
-    *(uint32_t*)&nonce[8] = htonl(packet->timestamp);
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
+    if (audio_batch_enabled_) {
+        bool first = audio_batcher_.empty();
+        if (!audio_batcher_.Add(std::move(packet))) {
+            if (first) {
+                // FlushAudioBatch() sends it if the stream stops before the batch is full
+                sender_.SetIdleDeadline(esp_timer_get_time() + audio_batcher_.latency_budget() * 1000);
+            }
+            return true;
+        }
+        return SendAudioBatch();
+    }
+    udp_send_buffer_.resize(AES_CTR_NONCE_SIZE + packet->payload.size());
+    return SendEncrypted(0x01, 0, packet->timestamp, packet->payload.data());
+}
+
+void MqttProtocol::OnLinkRtt(int rtt_ms) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (audio_batch_enabled_) {
+        audio_batcher_.SetLinkRtt(rtt_ms);
+    }
+}
+
+void MqttProtocol::FlushAudioBatch() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (udp_ != nullptr && audio_batch_enabled_) {
+        SendAudioBatch();
+    }
+}
 
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + packet->payload.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
+// Must be called with channel_mutex_ held
+bool MqttProtocol::SendAudioBatch() {
+    if (audio_batcher_.empty()) {
+        return true;
+    }
+    // Serialize right after the header and encrypt the batch where it lies
+    uint8_t frame_count = audio_batcher_.frame_count();
+    udp_send_buffer_.resize(AES_CTR_NONCE_SIZE);
+    auto timestamp = audio_batcher_.Serialize(udp_send_buffer_);
+    return SendEncrypted(0x02, frame_count, timestamp, (const uint8_t*)&udp_send_buffer_[AES_CTR_NONCE_SIZE]);
+}
 
-    size_t nc_off = 0;
-    uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, packet->payload.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)packet->payload.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+// Must be called with channel_mutex_ held. udp_send_buffer_ is already sized for the header
+// and the payload, `plaintext` may point into it to encrypt in place.
+bool MqttProtocol::SendEncrypted(uint8_t type, uint8_t flags, uint32_t timestamp, const uint8_t* plaintext) {
+    auto header = (uint8_t*)udp_send_buffer_.data();
+    size_t size = udp_send_buffer_.size() - AES_CTR_NONCE_SIZE;
+    memcpy(header, aes_nonce_.data(), AES_CTR_NONCE_SIZE);
+    header[0] = type;
+    header[1] = flags;
+    *(uint16_t*)&header[2] = htons(size);
+    *(uint32_t*)&header[8] = htonl(timestamp);
+    *(uint32_t*)&header[12] = htonl(++local_sequence_);
+
+    if (!tx_cipher_.Crypt(header, plaintext, header + AES_CTR_NONCE_SIZE, size)) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return false;
     }
+    return udp_->Send(udp_send_buffer_) > 0;
+}
 
-    return udp_->Send(encrypted) > 0;
+void MqttProtocol::InterruptOpenAudioChannel() {
+    xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_OPEN_CANCELLED_EVENT);
 }
 
 void MqttProtocol::CloseAudioChannel() {
-    {
-        std::lock_guard<std::mutex> lock(channel_mutex_);
-        udp_.reset();
+    if (udp_ != nullptr && !error_occurred_) {
+        SendQosReport(true);
     }
+    qos_enabled_ = false;
 
+    // Queued behind the audio and the final report, the server closes the UDP channel on it
     std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
+    message += "\"session_id\":\"" + session_id() + "\",";
     message += "\"type\":\"goodbye\"";
     message += "}";
-    SendText(message);
+    sender_.PushText(std::move(message), kSendClassControl);
+    if (!sender_.Flush(SEND_FLUSH_TIMEOUT_MS)) {
+        ESP_LOGW(TAG, "Closing with messages still queued");
+        sender_.Clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        udp_.reset();
+    }
+
+    auto stats = reorder_window_.stats();
+    if (stats.received > 0) {
+        ESP_LOGI(TAG, "UDP downlink: received %lu, reordered %lu, lost %lu, late %lu, duplicate %lu",
+            stats.received, stats.reordered, stats.lost, stats.late, stats.duplicate);
+    }
+    reorder_window_.Reset(remote_sequence_ + 1);
+
+    // Closed on purpose, the session is over and cannot be resumed
+    SetSessionId("");
 
     if (on_audio_channel_closed_ != nullptr) {
         on_audio_channel_closed_();
     }
 }
 
+// The MQTT client goes too, OpenAudioChannel() connects it again over the current network
+void MqttProtocol::DropConnections() {
+    qos_enabled_ = false;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        udp_.reset();
+    }
+    ResetMqttClient();
+    // Not the reconnect the disconnect callback schedules, the caller decides when to connect
+    esp_timer_stop(reconnect_timer_);
+}
+
 bool MqttProtocol::OpenAudioChannel() {
-    if (mqtt_ == nullptr || !mqtt_->IsConnected()) {
+    bool connected;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex_);
+        connected = mqtt_ != nullptr && mqtt_->IsConnected();
+    }
+    if (!connected) {
         ESP_LOGI(TAG, "MQTT is not connected, try to connect now");
         if (!StartMqttClient(true)) {
             return false;
@@ -204,16 +339,31 @@ bool MqttProtocol::OpenAudioChannel() {
     }
 
     error_occurred_ = false;
-    session_id_ = "";
-    xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
+    cbor_enabled_ = false;
+    qos_enabled_ = false;
+    if (!resume_pending_) {
+        SetSessionId("");
+    }
+    {
+        // The sender task reads the negotiated format under the same lock
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        audio_batch_enabled_ = false;
+        audio_batcher_.Clear();
+    }
+    xEventGroupClearBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT | MQTT_PROTOCOL_OPEN_CANCELLED_EVENT);
 
     auto message = GetHelloMessage();
+    auto hello_time = esp_timer_get_time();
     if (!SendText(message)) {
         return false;
     }
 
     // 等待服务器响应
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT | MQTT_PROTOCOL_OPEN_CANCELLED_EVENT,
+        pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+    if (bits & MQTT_PROTOCOL_OPEN_CANCELLED_EVENT) {
+        return false;
+    }
     if (!(bits & MQTT_PROTOCOL_SERVER_HELLO_EVENT)) {
         ESP_LOGE(TAG, "Failed to receive server hello");
         SetError(Lang::Strings::SERVER_TIMEOUT);
@@ -221,6 +371,11 @@ bool MqttProtocol::OpenAudioChannel() {
     }
 
     std::lock_guard<std::mutex> lock(channel_mutex_);
+    // The hello round trip is our first estimate of the link RTT
+    if (audio_batch_enabled_) {
+        audio_batcher_.SetLinkRtt((esp_timer_get_time() - hello_time) / 1000);
+    }
+    reorder_window_.Reset(remote_sequence_ + 1);
     auto network = Board::GetInstance().GetNetwork();
     udp_ = network->CreateUdp(2);
     udp_->OnMessage([this](const std::string& data) {
@@ -228,44 +383,59 @@ bool MqttProtocol::OpenAudioChannel() {
          * UDP Encrypted OPUS Packet Format:
          * |type 1u|flags 1u|payload_len 2u|ssrc 4u|timestamp 4u|sequence 4u|
          * |payload payload_len|
+         * Type 0x02 carries a batch of flags frames, see AudioFrameBatcher
          */
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < AES_CTR_NONCE_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %u", data.size());
             return;
         }
-        if (data[0] != 0x01) {
+        if (data[0] != 0x01 && data[0] != 0x02) {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
         uint32_t timestamp = ntohl(*(uint32_t*)&data[8]);
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
-            return;
-        }
-        if (sequence != remote_sequence_ + 1) {
-            ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
+
+        // Decrypt straight from the datagram into a pooled packet, no intermediate buffer
+        auto nonce = (const uint8_t*)data.data();
+        auto encrypted = nonce + AES_CTR_NONCE_SIZE;
+        size_t decrypted_size = data.size() - AES_CTR_NONCE_SIZE;
+        if (data[0] == 0x02) {
+            // Batched frames, the frame count is carried in the flags byte
+            rx_batch_buffer_.resize(decrypted_size);
+            if (!rx_cipher_.Crypt(nonce, encrypted, rx_batch_buffer_.data(), decrypted_size)) {
+                return;
+            }
+            AudioFrameBatcher::Parse(rx_batch_buffer_.data(), rx_batch_buffer_.size(), (uint8_t)data[1], timestamp,
+                [this](const uint8_t* frame, size_t length, uint32_t frame_timestamp) {
+                    auto packet = AudioPacketPool::GetInstance().Acquire(length);
+                    packet->sample_rate = server_sample_rate_;
+                    packet->frame_duration = server_frame_duration_;
+                    packet->timestamp = frame_timestamp;
+                    memcpy(packet->payload.data(), frame, length);
+                    rx_frames_.push_back(std::move(packet));
+                });
+        } else {
+            auto packet = AudioPacketPool::GetInstance().Acquire(decrypted_size);
+            packet->sample_rate = server_sample_rate_;
+            packet->frame_duration = server_frame_duration_;
+            packet->timestamp = timestamp;
+            if (!rx_cipher_.Crypt(nonce, encrypted, packet->payload.data(), decrypted_size)) {
+                AudioPacketPool::GetInstance().Release(std::move(packet));
+                return;
+            }
+            rx_frames_.push_back(std::move(packet));
         }
 
-        size_t decrypted_size = data.size() - aes_nonce_.size();
-        size_t nc_off = 0;
-        uint8_t stream_block[16] = {0};
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        auto packet = std::make_unique<AudioStreamPacket>();
-        packet->sample_rate = server_sample_rate_;
-        packet->frame_duration = server_frame_duration_;
-        packet->timestamp = timestamp;
-        packet->payload.resize(decrypted_size);
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)packet->payload.data());
-        if (ret != 0) {
-            ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
-            return;
+        // The window releases the frames in sequence order, or conceals the ones that never arrive
+        reorder_window_.Push(sequence, rx_frames_, server_sample_rate_, server_frame_duration_);
+        rx_frames_.clear();
+        if (qos_enabled_) {
+            downlink_qos_.OnPacket(sequence, timestamp);
         }
-        if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(packet));
+        if (sequence > remote_sequence_) {
+            remote_sequence_ = sequence;
         }
-        remote_sequence_ = sequence;
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
 
@@ -288,7 +458,27 @@ std::string MqttProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+#if CONFIG_USE_AUDIO_FRAME_BATCHING
+    cJSON_AddBoolToObject(features, "audio_batch", true);
+#endif
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    cJSON_AddBoolToObject(features, "keep_warm", true);
+#endif
+#if CONFIG_USE_CBOR_MESSAGES
+    cJSON_AddBoolToObject(features, "cbor", true);
+#endif
+#if CONFIG_USE_QOS_FEEDBACK
+    cJSON_AddBoolToObject(features, "qos", true);
+#endif
     cJSON_AddItemToObject(root, "features", features);
+    if (resume_pending_) {
+        // Ask the server to continue the timed out session and replay the packets after last_received_seq
+        cJSON* resume = cJSON_CreateObject();
+        cJSON_AddStringToObject(resume, "session_id", this->session_id().c_str());
+        cJSON_AddNumberToObject(resume, "last_received_seq", remote_sequence_);
+        cJSON_AddNumberToObject(resume, "last_sent_seq", local_sequence_);
+        cJSON_AddItemToObject(root, "resume", resume);
+    }
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
@@ -311,8 +501,8 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
 
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
-        session_id_ = session_id->valuestring;
-        ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
+        SetSessionId(session_id->valuestring);
+        ESP_LOGI(TAG, "Session ID: %s", session_id->valuestring);
     }
 
     // Get sample rate from hello message
@@ -341,10 +531,44 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     // auto encryption = cJSON_GetObjectItem(udp, "encryption")->valuestring;
     // ESP_LOGI(TAG, "UDP server: %s, port: %d, encryption: %s", udp_server_.c_str(), udp_port_, encryption);
     aes_nonce_ = DecodeHexString(nonce);
-    mbedtls_aes_init(&aes_ctx_);
-    mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
-    local_sequence_ = 0;
-    remote_sequence_ = 0;
+    if (aes_nonce_.size() != AES_CTR_NONCE_SIZE) {
+        ESP_LOGE(TAG, "Invalid nonce size: %u", aes_nonce_.size());
+        return;
+    }
+    // Both directions share the key, each keeps its own counter state
+    auto aes_key = DecodeHexString(key);
+    tx_cipher_.SetKey((const uint8_t*)aes_key.data(), 128);
+    rx_cipher_.SetKey((const uint8_t*)aes_key.data(), 128);
+    // A resumed session keeps counting, so the nonces of the new key never repeat either
+    session_resumed_ = resume_pending_ && cJSON_IsTrue(cJSON_GetObjectItem(root, "resumed"));
+    if (session_resumed_) {
+        ESP_LOGI(TAG, "Session resumed at local sequence %lu, remote sequence %lu", local_sequence_, remote_sequence_);
+    } else {
+        local_sequence_ = 0;
+        remote_sequence_ = 0;
+    }
+
+    [[maybe_unused]] auto features = cJSON_GetObjectItem(root, "features");
+#if CONFIG_USE_AUDIO_FRAME_BATCHING
+    // The server accepts batching by echoing the feature, audio then goes out as type 0x02 packets
+    if (cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "audio_batch"))) {
+        ESP_LOGI(TAG, "Audio batching enabled");
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        audio_batch_enabled_ = true;
+    }
+#endif
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    // The server lets us park the channel between sessions
+    server_keep_warm_ = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "keep_warm"));
+#endif
+#if CONFIG_USE_CBOR_MESSAGES
+    // Control and MCP messages switch to CBOR in both directions
+    cbor_enabled_ = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "cbor"));
+#endif
+#if CONFIG_USE_QOS_FEEDBACK
+    // Reports on the UDP audio travel over MQTT, the packet sequence numbers make the loss exact
+    StartQos(cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "qos")));
+#endif
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
@@ -3,10 +3,13 @@
 
 
 #include "protocol.h"
+#include "audio_frame_batcher.h"
+#include "aes_ctr_cipher.h"
+#include "reorder_window.h"
+#include "cbor_codec.h"
 #include <mqtt.h>
 #include <udp.h>
 #include <cJSON.h>
-#include <mbedtls/aes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <esp_timer.h>
@@ -20,6 +23,7 @@
 #define MQTT_RECONNECT_INTERVAL_MS 60000
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define MQTT_PROTOCOL_OPEN_CANCELLED_EVENT (1 << 1)
 
 class MqttProtocol : public Protocol {
 public:
@@ -30,6 +34,7 @@ public:
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
+    void DropConnections() override;
     bool IsAudioChannelOpened() const override;
 
 private:
@@ -38,21 +43,38 @@ private:
     std::string publish_topic_;
 
     std::mutex channel_mutex_;
+    // Held while publishing, the sender task publishes while other tasks restart the client
+    std::mutex mqtt_mutex_;
     std::unique_ptr<Mqtt> mqtt_;
     std::unique_ptr<Udp> udp_;
-    mbedtls_aes_context aes_ctx_;
+    AesCtrCipher tx_cipher_;
+    AesCtrCipher rx_cipher_;
     std::string aes_nonce_;
     std::string udp_server_;
     int udp_port_;
-    uint32_t local_sequence_;
-    uint32_t remote_sequence_;
+    uint32_t local_sequence_ = 0;
+    uint32_t remote_sequence_ = 0;
     esp_timer_handle_t reconnect_timer_;
+    bool audio_batch_enabled_ = false;
+    AudioFrameBatcher audio_batcher_;
+    std::string udp_send_buffer_;
+    std::vector<uint8_t> rx_batch_buffer_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> rx_frames_;
+    ReorderWindow reorder_window_;
+    std::string cbor_buffer_;
+    std::string rx_text_buffer_;
 
     bool StartMqttClient(bool report_error=false);
+    void ResetMqttClient();
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
+    bool SendEncrypted(uint8_t type, uint8_t flags, uint32_t timestamp, const uint8_t* plaintext);
+    bool SendAudioBatch();
 
     bool SendText(const std::string& text) override;
+    void OnLinkRtt(int rtt_ms) override;
+    void FlushAudioBatch() override;
+    void InterruptOpenAudioChannel() override;
     std::string GetHelloMessage();
 };
 
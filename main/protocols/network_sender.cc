@@ -0,0 +1,216 @@
+#include "network_sender.h"
+#include "protocol.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <chrono>
+
+#define TAG "NetworkSender"
+
+static const char* const SEND_CLASS_NAMES[] = {"audio", "control", "bulk"};
+
+NetworkSender::NetworkSender(std::function<bool(std::unique_ptr<AudioStreamPacket> packet)> send_audio,
+    std::function<bool(const std::string& text)> send_text)
+    : send_audio_(send_audio), send_text_(send_text) {
+    // TLS writes run on this task, so it needs the same stack as the main loop that used to do them
+    xTaskCreate([](void* arg) {
+        ((NetworkSender*)arg)->Run();
+        vTaskDelete(NULL);
+    }, "network_sender", 2048 * 4, this, 4, &task_handle_);
+}
+
+NetworkSender::~NetworkSender() {
+    Stop();
+}
+
+void NetworkSender::Stop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_ = false;
+    cv_.notify_all();
+    cv_.wait(lock, [this]() { return task_handle_ == nullptr; });
+}
+
+void NetworkSender::OnAudioRoom(std::function<void()> callback) {
+    on_audio_room_ = callback;
+}
+
+void NetworkSender::OnIdleDeadline(std::function<void()> callback) {
+    on_idle_deadline_ = callback;
+}
+
+void NetworkSender::SetIdleDeadline(int64_t time_us) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_deadline_ = time_us;
+    cv_.notify_all();
+}
+
+bool NetworkSender::HasAudioRoom() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queues_[kSendClassAudio].size() < SEND_AUDIO_QUEUE_SIZE;
+}
+
+void NetworkSender::PushAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues_[kSendClassAudio].push_back({next_sequence_++, esp_timer_get_time(), std::move(packet), {}});
+    cv_.notify_all();
+}
+
+void NetworkSender::PushText(std::string text, SendClass send_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queues_[send_class].push_back({next_sequence_++, esp_timer_get_time(), nullptr, std::move(text)});
+    cv_.notify_all();
+}
+
+void NetworkSender::PushFront(std::vector<Message> messages) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Number them just below the oldest waiting audio or control message, so NextClass() takes them first
+    uint32_t first = next_sequence_;
+    for (int i = kSendClassAudio; i <= kSendClassControl; i++) {
+        if (!queues_[i].empty() && (int32_t)(queues_[i].front().sequence - first) < 0) {
+            first = queues_[i].front().sequence;
+        }
+    }
+    uint32_t sequence = first - messages.size();
+    auto now = esp_timer_get_time();
+    auto audio_it = queues_[kSendClassAudio].begin();
+    auto control_it = queues_[kSendClassControl].begin();
+    for (auto& message : messages) {
+        if (message.packet != nullptr) {
+            audio_it = queues_[kSendClassAudio].insert(audio_it, {sequence++, now, std::move(message.packet), {}}) + 1;
+        } else {
+            control_it = queues_[kSendClassControl].insert(control_it, {sequence++, now, nullptr, std::move(message.text)}) + 1;
+        }
+    }
+    cv_.notify_all();
+}
+
+bool NetworkSender::Flush(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this]() { return Idle() && !writing_; });
+}
+
+void NetworkSender::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& queue : queues_) {
+        queue.clear();
+    }
+    idle_deadline_ = 0;
+    cv_.notify_all();
+}
+
+// Must be called with mutex_ held
+bool NetworkSender::Idle() const {
+    for (auto& queue : queues_) {
+        if (!queue.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Must be called with mutex_ held and at least one message queued
+SendClass NetworkSender::NextClass() const {
+    auto& audio = queues_[kSendClassAudio];
+    auto& control = queues_[kSendClassControl];
+    if (!audio.empty() && (control.empty() || (int32_t)(audio.front().sequence - control.front().sequence) < 0)) {
+        return kSendClassAudio;
+    }
+    if (!control.empty()) {
+        return kSendClassControl;
+    }
+    return kSendClassBulk;
+}
+
+void NetworkSender::Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto has_work = [this]() { return !running_ || !Idle(); };
+    while (true) {
+        if (idle_deadline_ != 0 && !has_work()) {
+            auto deadline = idle_deadline_;
+            cv_.wait_for(lock, std::chrono::microseconds(deadline - esp_timer_get_time()),
+                [&]() { return has_work() || idle_deadline_ != deadline; });
+            if (!has_work() && idle_deadline_ == deadline && esp_timer_get_time() >= deadline) {
+                idle_deadline_ = 0;
+                writing_ = true;
+                lock.unlock();
+                if (on_idle_deadline_) {
+                    on_idle_deadline_();
+                }
+                lock.lock();
+                writing_ = false;
+                cv_.notify_all();
+            }
+            continue;
+        }
+        cv_.wait(lock, has_work);
+        if (!running_) {
+            break;
+        }
+
+        auto send_class = NextClass();
+        auto item = std::move(queues_[send_class].front());
+        queues_[send_class].pop_front();
+        writing_ = true;
+        lock.unlock();
+
+        int64_t wait_us = esp_timer_get_time() - item.queued_time;
+        size_t size;
+        bool sent;
+        if (send_class == kSendClassAudio) {
+            size = item.packet->payload.size();
+            sent = send_audio_(std::move(item.packet));
+            if (on_audio_room_) {
+                on_audio_room_();
+            }
+        } else {
+            size = item.text.size();
+            sent = send_text_(item.text);
+        }
+
+        lock.lock();
+        writing_ = false;
+        auto& counters = counters_[send_class];
+        if (sent) {
+            counters.sent++;
+            counters.bytes += size;
+        } else {
+            counters.failed++;
+        }
+        counters.wait_sum_us += wait_us;
+        if (wait_us > counters.wait_max_us) {
+            counters.wait_max_us = wait_us;
+        }
+        if (Idle()) {
+            cv_.notify_all();
+        }
+    }
+    task_handle_ = nullptr;
+    cv_.notify_all();
+}
+
+SendClassStats NetworkSender::GetStats(SendClass send_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& counters = counters_[send_class];
+    SendClassStats stats;
+    stats.sent = counters.sent;
+    stats.failed = counters.failed;
+    stats.bytes = counters.bytes;
+    uint32_t count = counters.sent + counters.failed;
+    stats.wait_avg_ms = count > 0 ? (uint32_t)(counters.wait_sum_us / count / 1000) : 0;
+    stats.wait_max_ms = (uint32_t)(counters.wait_max_us / 1000);
+    return stats;
+}
+
+// Logs the classes that had traffic since the last call and starts over
+void NetworkSender::PrintStats() {
+    for (int i = 0; i < kSendClassCount; i++) {
+        auto stats = GetStats((SendClass)i);
+        if (stats.sent + stats.failed == 0) {
+            continue;
+        }
+        ESP_LOGI(TAG, "%s: sent %lu (%lu bytes), failed %lu, queue wait avg %lu ms, max %lu ms", SEND_CLASS_NAMES[i],
+            stats.sent, stats.bytes, stats.failed, stats.wait_avg_ms, stats.wait_max_ms);
+        std::lock_guard<std::mutex> lock(mutex_);
+        counters_[i] = Counters();
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef NETWORK_SENDER_H
+#define NETWORK_SENDER_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct AudioStreamPacket;
+
+/*
+ * The task that writes everything the device sends, so that no caller blocks on a slow TLS write.
+ *
+ * Messages are queued by class. Audio and control messages leave in the order they were queued,
+ * which keeps "listen stop" behind the frames captured before it, and both go ahead of bulk
+ * messages such as MCP replies carrying images. A bulk message is written whole once nothing
+ * else is waiting: WebSocket does not allow other data frames inside a fragmented message and an
+ * MQTT publish is atomic, so the fairness unit is the message.
+ *
+ * The audio queue is short on purpose. The backlog stays in the AudioService send queue, which
+ * holds off the encoder when full, and OnAudioRoom() tells the producer when to refill.
+ */
+#define SEND_AUDIO_QUEUE_SIZE 4
+// MCP payloads above this size are sent as bulk
+#define SEND_BULK_THRESHOLD 1024
+
+enum SendClass {
+    kSendClassAudio,
+    kSendClassControl,
+    kSendClassBulk,
+    kSendClassCount
+};
+
+struct SendClassStats {
+    uint32_t sent = 0;
+    uint32_t failed = 0;
+    uint32_t bytes = 0;
+    uint32_t wait_avg_ms = 0;  // Time from queueing to the start of the write
+    uint32_t wait_max_ms = 0;
+};
+
+class NetworkSender {
+public:
+    // An audio packet, or a control message if there is none
+    struct Message {
+        std::unique_ptr<AudioStreamPacket> packet;
+        std::string text;
+    };
+
+    NetworkSender(std::function<bool(std::unique_ptr<AudioStreamPacket> packet)> send_audio,
+        std::function<bool(const std::string& text)> send_text);
+    ~NetworkSender();
+
+    // Ends the task, the owner calls it before the transport the callbacks write to goes away
+    void Stop();
+
+    bool HasAudioRoom();
+    void PushAudio(std::unique_ptr<AudioStreamPacket> packet);
+    void PushText(std::string text, SendClass send_class);
+    // Queues the messages in order ahead of everything that is waiting, for a resend
+    void PushFront(std::vector<Message> messages);
+    // Waits until everything queued so far is written, false on timeout
+    bool Flush(int timeout_ms);
+    void Clear();
+    // Called from the sender task each time an audio packet leaves the queue
+    void OnAudioRoom(std::function<void()> callback);
+    // Calls the idle callback from the sender task if nothing is queued by `time_us`, replacing the previous deadline
+    void SetIdleDeadline(int64_t time_us);
+    void OnIdleDeadline(std::function<void()> callback);
+
+    SendClassStats GetStats(SendClass send_class);
+    void PrintStats();
+
+private:
+    struct Item {
+        uint32_t sequence;
+        int64_t queued_time;
+        std::unique_ptr<AudioStreamPacket> packet;
+        std::string text;
+    };
+
+    struct Counters {
+        uint32_t sent = 0;
+        uint32_t failed = 0;
+        uint32_t bytes = 0;
+        int64_t wait_sum_us = 0;
+        int64_t wait_max_us = 0;
+    };
+
+    std::function<bool(std::unique_ptr<AudioStreamPacket> packet)> send_audio_;
+    std::function<bool(const std::string& text)> send_text_;
+    std::function<void()> on_audio_room_;
+    std::function<void()> on_idle_deadline_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Item> queues_[kSendClassCount];
+    Counters counters_[kSendClassCount];
+    uint32_t next_sequence_ = 0;
+    int64_t idle_deadline_ = 0;
+    bool writing_ = false;
+    bool running_ = true;
+    TaskHandle_t task_handle_ = nullptr;
+
+    void Run();
+    bool Idle() const;
+    SendClass NextClass() const;
+};
+
+#endif // NETWORK_SENDER_H
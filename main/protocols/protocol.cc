@@ -1,13 +1,26 @@
 #include "protocol.h"
 
+#include <algorithm>
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
 
 #define TAG "Protocol"
 
+Protocol::Protocol()
+    : sender_([this](std::unique_ptr<AudioStreamPacket> packet) { return SendAudio(std::move(packet)); },
+        [this](const std::string& text) { return SendText(text); }) {
+    sender_.OnIdleDeadline([this]() { FlushAudioBatch(); });
+}
+
 void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
+void Protocol::OnIncomingText(std::function<bool(std::string_view json)> callback) {
+    on_incoming_text_ = callback;
+}
+
 void Protocol::OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback) {
     on_incoming_audio_ = callback;
 }
@@ -32,6 +45,65 @@ void Protocol::OnDisconnected(std::function<void()> callback) {
     on_disconnected_ = callback;
 }
 
+void Protocol::OnUplinkQosChanged(std::function<void(int bitrate, int packet_loss)> callback) {
+    on_uplink_qos_changed_ = callback;
+}
+
+void Protocol::OpenAudioChannelAsync(std::function<void(bool success)> callback) {
+    if (opening_) {
+        ESP_LOGW(TAG, "Audio channel is already opening");
+        return;
+    }
+    opening_ = true;
+    open_cancelled_ = false;
+    on_open_done_ = callback;
+
+    // The TLS handshake runs in this task, give it the same stack as the main event loop
+    xTaskCreate([](void* arg) {
+        auto protocol = (Protocol*)arg;
+        bool success = protocol->OpenAudioChannel();
+        if (protocol->open_cancelled_) {
+            ESP_LOGI(TAG, "Audio channel open cancelled");
+            if (success) {
+                protocol->CloseAudioChannel();
+            }
+            success = false;
+        }
+        auto callback = std::move(protocol->on_open_done_);
+        protocol->on_open_done_ = nullptr;
+        protocol->opening_ = false;
+        if (callback) {
+            callback(success);
+        }
+        vTaskDelete(NULL);
+    }, "open_channel", 2048 * 4, this, 3, nullptr);
+}
+
+bool Protocol::ResumeAudioChannelAsync(std::function<void(bool success)> callback) {
+    // A deliberate close clears the session id, only dropped sessions can be resumed
+    auto session_id = this->session_id();
+    if (session_id.empty() || opening_) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Resuming session %s", session_id.c_str());
+    resume_pending_ = true;
+    OpenAudioChannelAsync([this, callback](bool success) {
+        resume_pending_ = false;
+        if (callback) {
+            callback(success);
+        }
+    });
+    return true;
+}
+
+void Protocol::CancelOpenAudioChannel() {
+    if (!opening_) {
+        return;
+    }
+    open_cancelled_ = true;
+    InterruptOpenAudioChannel();
+}
+
 void Protocol::SetError(const std::string& message) {
     error_occurred_ = true;
     if (on_network_error_ != nullptr) {
@@ -40,22 +112,22 @@ void Protocol::SetError(const std::string& message) {
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    std::string message = "{\"session_id\":\"" + session_id() + "\",\"type\":\"abort\"";
     if (reason == kAbortReasonWakeWordDetected) {
         message += ",\"reason\":\"wake_word_detected\"";
     }
     message += "}";
-    SendText(message);
+    sender_.PushText(std::move(message), kSendClassControl);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
+    std::string json = "{\"session_id\":\"" + session_id() + 
                       "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    sender_.PushText(std::move(json), kSendClassControl);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
+    std::string message = "{\"session_id\":\"" + session_id() + "\"";
     message += ",\"type\":\"listen\",\"state\":\"start\"";
     if (mode == kListeningModeRealtime) {
         message += ",\"mode\":\"realtime\"";
@@ -65,17 +137,113 @@ void Protocol::SendStartListening(ListeningMode mode) {
         message += ",\"mode\":\"manual\"";
     }
     message += "}";
-    SendText(message);
+    sender_.PushText(std::move(message), kSendClassControl);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
-    SendText(message);
+    std::string message = "{\"session_id\":\"" + session_id() + "\",\"type\":\"listen\",\"state\":\"stop\"}";
+    sender_.PushText(std::move(message), kSendClassControl);
 }
 
 void Protocol::SendMcpMessage(const std::string& payload) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
-    SendText(message);
+    std::string message = "{\"session_id\":\"" + session_id() + "\",\"type\":\"mcp\",\"payload\":" + payload + "}";
+    // Large replies, such as tool results with images, must not hold up audio and control messages
+    sender_.PushText(std::move(message), payload.size() > SEND_BULK_THRESHOLD ? kSendClassBulk : kSendClassControl);
+}
+
+// Keeps a parked audio channel alive between sessions, only sent if the server accepted keep_warm
+void Protocol::SendKeepalive() {
+    std::string message = "{\"session_id\":\"" + session_id() + "\",\"type\":\"keepalive\"}";
+    sender_.PushText(std::move(message), kSendClassControl);
+}
+
+void Protocol::StartQos(bool enabled) {
+    qos_enabled_ = enabled;
+    if (session_resumed_) {
+        return;
+    }
+    downlink_qos_.Reset();
+    uplink_bitrate_.Reset();
+    downlink_bitrate_.Reset();
+    uplink_received_ = 0;
+    uplink_lost_ = 0;
+    last_rtt_ = -1;
+    uplink_fraction_lost_ = 0;
+    downlink_fraction_lost_ = 0;
+    // A new session starts from the default encoder settings, adapted or not
+    if (on_uplink_qos_changed_ != nullptr) {
+        on_uplink_qos_changed_(uplink_bitrate_.bitrate(), uplink_bitrate_.packet_loss());
+    }
+}
+
+// The server's receiver report on our uplink
+void Protocol::OnQosReport(const cJSON* root) {
+    QosReport report;
+    if (!qos_enabled_ || !QosReport::FromJson(root, report)) {
+        return;
+    }
+    int rtt = downlink_qos_.OnPeerReport(report);
+    if (rtt >= 0) {
+        last_rtt_ = rtt;
+        OnLinkRtt(rtt);
+    }
+    uplink_received_ = report.received;
+    uplink_lost_ = report.lost;
+    uplink_fraction_lost_ = report.fraction_lost;
+    if (uplink_bitrate_.OnReport(report, last_rtt_)) {
+        ESP_LOGI(TAG, "Uplink bitrate %d, expected loss %d%%, reported loss %d/256, rtt %d ms",
+            uplink_bitrate_.bitrate(), uplink_bitrate_.packet_loss(), report.fraction_lost, last_rtt_);
+        if (on_uplink_qos_changed_ != nullptr) {
+            on_uplink_qos_changed_(uplink_bitrate_.bitrate(), uplink_bitrate_.packet_loss());
+        }
+    }
+}
+
+int Protocol::packet_loss_percent() const {
+    return std::max(uplink_fraction_lost_, downlink_fraction_lost_) * 100 / 256;
+}
+
+void Protocol::SendQosReport(bool final) {
+    if (!qos_enabled_) {
+        return;
+    }
+    auto report = downlink_qos_.MakeReport();
+    downlink_fraction_lost_ = report.fraction_lost;
+    downlink_bitrate_.OnReport(report, last_rtt_);
+    // Only ask the server for less once the downlink has shown loss
+    if (downlink_bitrate_.bitrate() < QOS_DOWNLINK_MAX_BITRATE) {
+        report.max_bitrate = downlink_bitrate_.bitrate();
+    }
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "session_id", session_id().c_str());
+    cJSON_AddStringToObject(root, "type", "qos");
+    report.ToJson(root);
+    if (final) {
+        ESP_LOGI(TAG, "QoS downlink: received %lu, lost %lu, jitter %lu ms; uplink: received %lu, lost %lu, bitrate %d (min %d); rtt %d/%d/%d ms",
+            report.received, report.lost, report.jitter, uplink_received_, uplink_lost_,
+            uplink_bitrate_.bitrate(), uplink_bitrate_.min_bitrate_seen(),
+            downlink_qos_.rtt_min(), downlink_qos_.rtt_avg(), downlink_qos_.rtt_max());
+        cJSON* summary = cJSON_CreateObject();
+        cJSON* uplink = cJSON_CreateObject();
+        cJSON_AddNumberToObject(uplink, "received", uplink_received_);
+        cJSON_AddNumberToObject(uplink, "lost", uplink_lost_);
+        cJSON_AddNumberToObject(uplink, "bitrate", uplink_bitrate_.bitrate());
+        cJSON_AddNumberToObject(uplink, "min_bitrate", uplink_bitrate_.min_bitrate_seen());
+        cJSON_AddItemToObject(summary, "uplink", uplink);
+        cJSON* rtt = cJSON_CreateObject();
+        cJSON_AddNumberToObject(rtt, "min", downlink_qos_.rtt_min());
+        cJSON_AddNumberToObject(rtt, "avg", downlink_qos_.rtt_avg());
+        cJSON_AddNumberToObject(rtt, "max", downlink_qos_.rtt_max());
+        cJSON_AddItemToObject(summary, "rtt", rtt);
+        cJSON_AddItemToObject(root, "summary", summary);
+        cJSON_AddBoolToObject(root, "final", true);
+    }
+    auto json = cJSON_PrintUnformatted(root);
+    // The final one is flushed by CloseAudioChannel() before the transport goes away
+    sender_.PushText(json, kSendClassControl);
+    cJSON_free(json);
+    cJSON_Delete(root);
 }
 
 bool Protocol::IsTimeout() const {
@@ -3,9 +3,16 @@
 
 #include <cJSON.h>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <chrono>
 #include <vector>
+#include <atomic>
+#include <mutex>
+
+#include "qos_monitor.h"
+#include "bitrate_controller.h"
+#include "network_sender.h"
 
 struct AudioStreamPacket {
     int sample_rate = 0;
@@ -14,9 +21,12 @@ struct AudioStreamPacket {
     std::vector<uint8_t> payload;
 };
 
+// Binary message type of a CBOR encoded control message, see CborCodec
+#define BINARY_PROTOCOL_TYPE_CBOR 2
+
 struct BinaryProtocol2 {
     uint16_t version;
-    uint16_t type;          // Message type (0: OPUS, 1: JSON)
+    uint16_t type;          // Message type (0: OPUS, 1: JSON, 2: CBOR)
     uint32_t reserved;      // Reserved for future use
     uint32_t timestamp;     // Timestamp in milliseconds (used for server-side AEC)
     uint32_t payload_size;  // Payload size in bytes
@@ -30,6 +40,14 @@ struct BinaryProtocol3 {
     uint8_t payload[];
 } __attribute__((packed));
 
+struct BinaryProtocol4 {
+    uint8_t type;           // Message type (0: OPUS)
+    uint8_t frame_count;    // Number of Opus frames in the payload
+    uint16_t payload_size;  // Payload size in bytes
+    uint32_t timestamp;     // Timestamp of the first frame in milliseconds
+    uint8_t payload[];      // Frame table followed by frame data, see AudioFrameBatcher
+} __attribute__((packed));
+
 enum AbortReason {
     kAbortReasonNone,
     kAbortReasonWakeWordDetected
@@ -41,8 +59,12 @@ enum ListeningMode {
     kListeningModeRealtime // 需要 AEC 支持
 };
 
+// How long closing the channel waits for queued messages to go out
+#define SEND_FLUSH_TIMEOUT_MS 1000
+
 class Protocol {
 public:
+    Protocol();
     virtual ~Protocol() = default;
 
     inline int server_sample_rate() const {
@@ -51,21 +73,50 @@ public:
     inline int server_frame_duration() const {
         return server_frame_duration_;
     }
-    inline const std::string& session_id() const {
+    // A copy, the id is written by the hello on the network tasks
+    inline std::string session_id() const {
+        std::lock_guard<std::mutex> lock(session_mutex_);
         return session_id_;
     }
+    inline bool server_keep_warm() const {
+        return server_keep_warm_;
+    }
+    inline bool session_resumed() const {
+        return session_resumed_;
+    }
+    // Link figures from the QoS reports, -1 and 0 while qos is not negotiated
+    inline int last_rtt() const {
+        return last_rtt_;
+    }
+    int packet_loss_percent() const;
+    // Every message but the hello is written by the sender task, audio is queued there directly
+    inline NetworkSender& sender() {
+        return sender_;
+    }
 
     void OnIncomingAudio(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
+    // Sees every text message before it is parsed, returning true consumes it
+    void OnIncomingText(std::function<bool(std::string_view json)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
     void OnNetworkError(std::function<void(const std::string& message)> callback);
     void OnConnected(std::function<void()> callback);
     void OnDisconnected(std::function<void()> callback);
+    // Uplink encoder settings driven by the server's receiver reports, `packet_loss` in percent
+    void OnUplinkQosChanged(std::function<void(int bitrate, int packet_loss)> callback);
 
     virtual bool Start() = 0;
     virtual bool OpenAudioChannel() = 0;
+    // Runs OpenAudioChannel() in its own task, `callback` is called from that task when done
+    void OpenAudioChannelAsync(std::function<void(bool success)> callback);
+    void CancelOpenAudioChannel();
+    bool IsAudioChannelOpening() const { return opening_; }
+    // Reopens a dropped audio channel and asks the server to continue the session, false if there is none
+    bool ResumeAudioChannelAsync(std::function<void(bool success)> callback);
     virtual void CloseAudioChannel() = 0;
+    // Tears the connections down but keeps the session, the next resume reconnects over the current network
+    virtual void DropConnections() = 0;
     virtual bool IsAudioChannelOpened() const = 0;
     virtual bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) = 0;
     virtual void SendWakeWordDetected(const std::string& wake_word);
@@ -73,25 +124,67 @@ public:
     virtual void SendStopListening();
     virtual void SendAbortSpeaking(AbortReason reason);
     virtual void SendMcpMessage(const std::string& message);
+    virtual void SendKeepalive();
+    // Receiver report on the downlink, only sent if the server accepted qos. The final one carries the session summary
+    void SendQosReport(bool final = false);
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
+    std::function<bool(std::string_view json)> on_incoming_text_;
     std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
     std::function<void()> on_connected_;
     std::function<void()> on_disconnected_;
+    std::function<void(int bitrate, int packet_loss)> on_uplink_qos_changed_;
 
     int server_sample_rate_ = 24000;
     int server_frame_duration_ = 60;
     bool error_occurred_ = false;
-    std::string session_id_;
+    bool server_keep_warm_ = false;
+    std::atomic<bool> cbor_enabled_ = false;
+    // Set while the hello carries the resume request, session_resumed_ tells if the server took it
+    std::atomic<bool> resume_pending_ = false;
+    bool session_resumed_ = false;
     std::chrono::time_point<std::chrono::steady_clock> last_incoming_time_;
+    std::atomic<bool> opening_ = false;
+    std::atomic<bool> open_cancelled_ = false;
+    std::function<void(bool success)> on_open_done_;
+
+    // Receiver reports in both directions, see QosMonitor
+    bool qos_enabled_ = false;
+    QosMonitor downlink_qos_;
+    BitrateController uplink_bitrate_{QOS_UPLINK_MIN_BITRATE, QOS_UPLINK_MAX_BITRATE, QOS_UPLINK_START_BITRATE};
+    BitrateController downlink_bitrate_{QOS_DOWNLINK_MIN_BITRATE, QOS_DOWNLINK_MAX_BITRATE, QOS_DOWNLINK_MAX_BITRATE};
+    uint32_t uplink_received_ = 0;
+    uint32_t uplink_lost_ = 0;
+    int last_rtt_ = -1;
+    uint8_t uplink_fraction_lost_ = 0;
+    uint8_t downlink_fraction_lost_ = 0;
+    // Its task writes through the derived class, whose destructor must call sender_.Stop() first
+    NetworkSender sender_;
 
     virtual bool SendText(const std::string& text) = 0;
+    // Wakes up a pending OpenAudioChannel() after CancelOpenAudioChannel()
+    virtual void InterruptOpenAudioChannel() {}
     virtual void SetError(const std::string& message);
     virtual bool IsTimeout() const;
+    // Audio batching: a new RTT sample from the QoS reports, and a partial batch whose flush deadline passed
+    virtual void OnLinkRtt(int rtt_ms) {}
+    virtual void FlushAudioBatch() {}
+    // Called while parsing the server hello, after session_resumed_ is known
+    void StartQos(bool enabled);
+    void OnQosReport(const cJSON* root);
+    void SetSessionId(const std::string& session_id) {
+        std::lock_guard<std::mutex> lock(session_mutex_);
+        session_id_ = session_id;
+    }
+
+private:
+    // Set by the hello on the open and receive tasks, read by the senders on the main task
+    mutable std::mutex session_mutex_;
+    std::string session_id_;
 };
 
 #endif // PROTOCOL_H
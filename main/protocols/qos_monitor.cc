@@ -0,0 +1,165 @@
+#include "qos_monitor.h"
+
+#include <esp_timer.h>
+
+QosMonitor::QosMonitor() {
+    Reset();
+}
+
+uint32_t QosMonitor::Now() {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void QosMonitor::Reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    started_ = false;
+    base_sequence_ = 0;
+    max_sequence_ = 0;
+    received_ = 0;
+    expected_prior_ = 0;
+    received_prior_ = 0;
+    has_transit_ = false;
+    transit_ = 0;
+    jitter_q4_ = 0;
+    peer_report_timestamp_ = 0;
+    peer_report_arrival_ = 0;
+    rtt_min_ = 0;
+    rtt_max_ = 0;
+    rtt_sum_ = 0;
+    rtt_count_ = 0;
+}
+
+void QosMonitor::OnPacket(uint32_t sequence, uint32_t timestamp) {
+    uint32_t arrival = Now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!started_) {
+        started_ = true;
+        base_sequence_ = sequence;
+        max_sequence_ = sequence;
+    } else if ((int32_t)(sequence - max_sequence_) > 0) {
+        max_sequence_ = sequence;
+    }
+    received_++;
+
+    if (timestamp == 0) {
+        return;
+    }
+    int32_t transit = (int32_t)(arrival - timestamp);
+    if (has_transit_) {
+        int32_t d = transit - transit_;
+        if (d < 0) {
+            d = -d;
+        }
+        // J += (|D| - J) / 16, kept in 1/16 ms as in RFC 3550 A.8
+        jitter_q4_ += d - ((jitter_q4_ + 8) >> 4);
+    }
+    transit_ = transit;
+    has_transit_ = true;
+}
+
+// Must be called with mutex_ held
+uint32_t QosMonitor::Lost() const {
+    if (!started_) {
+        return 0;
+    }
+    uint32_t expected = max_sequence_ - base_sequence_ + 1;
+    // Duplicates can make received exceed expected
+    return expected > received_ ? expected - received_ : 0;
+}
+
+int QosMonitor::OnPeerReport(const QosReport& report) {
+    uint32_t now = Now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    peer_report_timestamp_ = report.timestamp;
+    peer_report_arrival_ = now;
+    if (report.last_report == 0) {
+        return -1;
+    }
+    int rtt = (int32_t)(now - report.last_report - report.delay_since_last_report);
+    if (rtt < 0) {
+        return -1;
+    }
+    if (rtt_count_ == 0 || rtt < rtt_min_) {
+        rtt_min_ = rtt;
+    }
+    if (rtt_count_ == 0 || rtt > rtt_max_) {
+        rtt_max_ = rtt;
+    }
+    rtt_sum_ += rtt;
+    rtt_count_++;
+    return rtt;
+}
+
+QosReport QosMonitor::MakeReport() {
+    QosReport report;
+    report.timestamp = Now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    report.received = received_;
+    report.lost = Lost();
+    report.jitter = jitter_q4_ >> 4;
+
+    uint32_t expected = started_ ? max_sequence_ - base_sequence_ + 1 : 0;
+    uint32_t expected_interval = expected - expected_prior_;
+    uint32_t received_interval = received_ - received_prior_;
+    expected_prior_ = expected;
+    received_prior_ = received_;
+    if (expected_interval > 0 && expected_interval > received_interval) {
+        report.fraction_lost = ((expected_interval - received_interval) << 8) / expected_interval;
+    }
+
+    if (peer_report_timestamp_ != 0) {
+        report.last_report = peer_report_timestamp_;
+        report.delay_since_last_report = report.timestamp - peer_report_arrival_;
+    }
+    return report;
+}
+
+uint32_t QosMonitor::received() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return received_;
+}
+
+uint32_t QosMonitor::lost() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Lost();
+}
+
+uint32_t QosMonitor::jitter() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jitter_q4_ >> 4;
+}
+
+void QosReport::ToJson(cJSON* root) const {
+    cJSON_AddNumberToObject(root, "timestamp", timestamp);
+    cJSON_AddNumberToObject(root, "received", received);
+    cJSON_AddNumberToObject(root, "lost", lost);
+    cJSON_AddNumberToObject(root, "fraction_lost", fraction_lost);
+    cJSON_AddNumberToObject(root, "jitter", jitter);
+    if (last_report != 0) {
+        cJSON_AddNumberToObject(root, "lsr", last_report);
+        cJSON_AddNumberToObject(root, "dlsr", delay_since_last_report);
+    }
+    if (max_bitrate > 0) {
+        cJSON_AddNumberToObject(root, "max_bitrate", max_bitrate);
+    }
+}
+
+bool QosReport::FromJson(const cJSON* root, QosReport& report) {
+    auto timestamp = cJSON_GetObjectItem(root, "timestamp");
+    if (!cJSON_IsNumber(timestamp)) {
+        return false;
+    }
+    auto number = [root](const char* name) -> double {
+        auto item = cJSON_GetObjectItem(root, name);
+        return cJSON_IsNumber(item) ? item->valuedouble : 0;
+    };
+    report.timestamp = (uint32_t)timestamp->valuedouble;
+    report.received = (uint32_t)number("received");
+    report.lost = (uint32_t)number("lost");
+    report.fraction_lost = (uint8_t)number("fraction_lost");
+    report.jitter = (uint32_t)number("jitter");
+    report.last_report = (uint32_t)number("lsr");
+    report.delay_since_last_report = (uint32_t)number("dlsr");
+    report.max_bitrate = (int)number("max_bitrate");
+    return true;
+}
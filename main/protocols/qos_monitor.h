@@ -0,0 +1,79 @@
+#ifndef QOS_MONITOR_H
+#define QOS_MONITOR_H
+
+#include <cJSON.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/*
+ * RTCP style receiver statistics of one audio direction (RFC 3550 §6.4.1, A.3 and A.8).
+ *
+ * The receiver counts the packets that arrived against the sequence range it saw, derives the
+ * loss fraction since its previous report and the interarrival jitter, and echoes the timestamp
+ * of the peer's last report together with the time it held it, so the peer can measure the
+ * round trip as now - last_report - delay_since_last_report without synchronized clocks.
+ *
+ * Reports travel as "qos" control messages on either transport. WebSocket frames carry no
+ * sequence number, so there the frame counter is used and only jitter and RTT are meaningful.
+ */
+#define QOS_REPORT_INTERVAL_MS 2000
+
+struct QosReport {
+    uint32_t timestamp = 0;                 // Sender clock in ms when the report was made
+    uint32_t received = 0;                  // Packets received in the session
+    uint32_t lost = 0;                      // Cumulative packets lost in the session
+    uint8_t fraction_lost = 0;              // Lost since the previous report, in 1/256
+    uint32_t jitter = 0;                    // Interarrival jitter in ms
+    uint32_t last_report = 0;               // Timestamp of the peer's last report, 0 if none arrived yet
+    uint32_t delay_since_last_report = 0;   // ms between receiving that report and making this one
+    int max_bitrate = 0;                    // Bitrate the receiver asks the peer to stay under, 0 for no limit
+
+    void ToJson(cJSON* root) const;
+    static bool FromJson(const cJSON* root, QosReport& report);
+};
+
+class QosMonitor {
+public:
+    QosMonitor();
+
+    void Reset();
+    // `sequence` counts from 1 in sending order, `timestamp` is the sender media clock in ms or 0 if unknown
+    void OnPacket(uint32_t sequence, uint32_t timestamp);
+    // Takes the peer's report on our stream, returns the round trip time in ms or -1 if it cannot tell yet
+    int OnPeerReport(const QosReport& report);
+    QosReport MakeReport();
+
+    uint32_t received();
+    uint32_t lost();
+    uint32_t jitter();
+    // Round trip statistics of the session, -1 without samples
+    int rtt_min() const { return rtt_count_ > 0 ? rtt_min_ : -1; }
+    int rtt_max() const { return rtt_count_ > 0 ? rtt_max_ : -1; }
+    int rtt_avg() const { return rtt_count_ > 0 ? (int)(rtt_sum_ / rtt_count_) : -1; }
+
+    static uint32_t Now();
+
+private:
+    std::mutex mutex_;
+    bool started_ = false;
+    uint32_t base_sequence_ = 0;
+    uint32_t max_sequence_ = 0;
+    uint32_t received_ = 0;
+    uint32_t expected_prior_ = 0;
+    uint32_t received_prior_ = 0;
+    bool has_transit_ = false;
+    int32_t transit_ = 0;
+    uint32_t jitter_q4_ = 0;  // Jitter in 1/16 ms, the RFC 3550 estimator without floating point
+    uint32_t peer_report_timestamp_ = 0;
+    uint32_t peer_report_arrival_ = 0;
+    int rtt_min_ = 0;
+    int rtt_max_ = 0;
+    int64_t rtt_sum_ = 0;
+    int rtt_count_ = 0;
+
+    uint32_t Lost() const;
+};
+
+#endif // QOS_MONITOR_H
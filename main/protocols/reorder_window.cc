@@ -0,0 +1,230 @@
+#include "reorder_window.h"
+#include "audio_packet_pool.h"
+
+#include <esp_log.h>
+
+#define TAG "ReorderWindow"
+
+ReorderWindow::ReorderWindow(size_t size, int hold_ms) : slots_(size > 0 ? size : 1), hold_ms_(hold_ms) {
+    esp_timer_create_args_t gap_timer_args = {
+        .callback = [](void* arg) {
+            ((ReorderWindow*)arg)->OnGapTimeout();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "reorder_gap",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&gap_timer_args, &gap_timer_);
+}
+
+ReorderWindow::~ReorderWindow() {
+    if (gap_timer_ != nullptr) {
+        esp_timer_stop(gap_timer_);
+        esp_timer_delete(gap_timer_);
+        gap_timer_ = nullptr;
+    }
+    Reset(1);
+}
+
+void ReorderWindow::OnRelease(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_release_ = callback;
+}
+
+void ReorderWindow::Reset(uint32_t next_sequence) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (gap_timer_ != nullptr) {
+        esp_timer_stop(gap_timer_);
+    }
+    for (auto& packet : ready_) {
+        AudioPacketPool::GetInstance().Release(std::move(packet));
+    }
+    ready_.clear();
+    for (auto& slot : slots_) {
+        for (auto& frame : slot.frames) {
+            AudioPacketPool::GetInstance().Release(std::move(frame));
+        }
+        slot.frames.clear();
+        slot.used = false;
+    }
+    expected_sequence_ = next_sequence;
+    highest_sequence_ = next_sequence - 1;
+    lost_history_ = 0;
+    gap_start_time_ = 0;
+    held_count_ = 0;
+    stats_ = ReorderStats();
+}
+
+ReorderStats ReorderWindow::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void ReorderWindow::Push(uint32_t sequence, std::vector<std::unique_ptr<AudioStreamPacket>>& frames,
+    int sample_rate, int frame_duration) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stats_.received++;
+    last_sample_rate_ = sample_rate;
+    last_frame_duration_ = frame_duration;
+
+    auto drop = [&frames]() {
+        for (auto& frame : frames) {
+            AudioPacketPool::GetInstance().Release(std::move(frame));
+        }
+        frames.clear();
+    };
+
+    if (sequence < expected_sequence_) {
+        uint32_t age = expected_sequence_ - 1 - sequence;
+        if (age < 32 && (lost_history_ & (1u << age))) {
+            // It did arrive, but concealment already played in its place
+            lost_history_ &= ~(1u << age);
+            stats_.late++;
+        } else {
+            stats_.duplicate++;
+        }
+        drop();
+        return;
+    }
+
+    if (sequence - expected_sequence_ >= 32) {
+        // The sender jumped ahead, there is nothing useful left to conceal
+        Resync(sequence);
+    }
+    // Too far ahead to hold, give up on everything that would fall out of the window
+    while (sequence >= expected_sequence_ + slots_.size()) {
+        SkipExpected();
+    }
+
+    auto& slot = slots_[sequence % slots_.size()];
+    if (slot.used) {
+        stats_.duplicate++;
+        drop();
+        return;
+    }
+    if (sequence < highest_sequence_) {
+        stats_.reordered++;
+    } else {
+        highest_sequence_ = sequence;
+    }
+    slot.used = true;
+    slot.sequence = sequence;
+    slot.frames = std::move(frames);
+    frames.clear();
+    held_count_++;
+
+    ReleaseReady();
+    Deliver(lock);
+}
+
+// Must be called with mutex_ held
+void ReorderWindow::Release(std::unique_ptr<AudioStreamPacket> packet) {
+    ready_.push_back(std::move(packet));
+}
+
+// Hands the released packets over without holding mutex_. The UDP task and the gap timer both
+// release, whichever comes while the other is delivering leaves its packets to it, so the
+// order is kept. on_release_ is set before the first packet arrives
+void ReorderWindow::Deliver(std::unique_lock<std::mutex>& lock) {
+    if (delivery_running_) {
+        return;
+    }
+    delivery_running_ = true;
+    while (!ready_.empty()) {
+        delivering_.swap(ready_);
+        lock.unlock();
+        for (auto& packet : delivering_) {
+            if (on_release_ != nullptr) {
+                on_release_(std::move(packet));
+            } else {
+                AudioPacketPool::GetInstance().Release(std::move(packet));
+            }
+        }
+        delivering_.clear();
+        lock.lock();
+    }
+    delivery_running_ = false;
+}
+
+// Releases the expected sequence if it is there, otherwise declares it lost
+void ReorderWindow::SkipExpected() {
+    auto& slot = slots_[expected_sequence_ % slots_.size()];
+    if (slot.used && slot.sequence == expected_sequence_) {
+        for (auto& frame : slot.frames) {
+            Release(std::move(frame));
+        }
+        slot.frames.clear();
+        slot.used = false;
+        held_count_--;
+        lost_history_ <<= 1;
+    } else {
+        stats_.lost++;
+        lost_history_ = (lost_history_ << 1) | 1;
+        // An empty payload makes the decoder conceal one frame
+        auto packet = AudioPacketPool::GetInstance().Acquire(0);
+        packet->sample_rate = last_sample_rate_;
+        packet->frame_duration = last_frame_duration_;
+        Release(std::move(packet));
+    }
+    expected_sequence_++;
+}
+
+// Flushes whatever is held in order and continues from `sequence` without concealment
+void ReorderWindow::Resync(uint32_t sequence) {
+    ESP_LOGW(TAG, "Sequence jumped from %lu to %lu", expected_sequence_, sequence);
+    uint32_t released = 0;
+    for (size_t i = 0; i < slots_.size() && held_count_ > 0; i++) {
+        auto& slot = slots_[(expected_sequence_ + i) % slots_.size()];
+        if (slot.used && slot.sequence == expected_sequence_ + i) {
+            for (auto& frame : slot.frames) {
+                Release(std::move(frame));
+            }
+            slot.frames.clear();
+            slot.used = false;
+            held_count_--;
+            released++;
+        }
+    }
+    stats_.lost += sequence - expected_sequence_ - released;
+    expected_sequence_ = sequence;
+    lost_history_ = 0;
+    gap_start_time_ = 0;
+}
+
+void ReorderWindow::ReleaseReady() {
+    while (true) {
+        auto& slot = slots_[expected_sequence_ % slots_.size()];
+        if (slot.used && slot.sequence == expected_sequence_) {
+            SkipExpected();
+            gap_start_time_ = 0;
+            continue;
+        }
+        if (held_count_ == 0) {
+            gap_start_time_ = 0;
+            esp_timer_stop(gap_timer_);
+            return;
+        }
+
+        // A gap with newer packets waiting behind it
+        auto now = esp_timer_get_time();
+        if (gap_start_time_ == 0) {
+            gap_start_time_ = now;
+        }
+        int64_t waited_ms = (now - gap_start_time_) / 1000;
+        if (waited_ms >= hold_ms_ || slots_.size() == 1) {
+            // Keep the gap start, the packets behind a run of losses have waited long enough
+            SkipExpected();
+            continue;
+        }
+        esp_timer_stop(gap_timer_);
+        esp_timer_start_once(gap_timer_, (hold_ms_ - waited_ms) * 1000);
+        return;
+    }
+}
+
+void ReorderWindow::OnGapTimeout() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ReleaseReady();
+    Deliver(lock);
+}
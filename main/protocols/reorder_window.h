@@ -0,0 +1,79 @@
+#ifndef REORDER_WINDOW_H
+#define REORDER_WINDOW_H
+
+#include "protocol.h"
+
+#include <esp_timer.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <functional>
+
+/*
+ * Puts the UDP downlink back in sequence order.
+ *
+ * A packet that arrives ahead of the expected sequence is held for at most `hold_ms` or
+ * until `size` newer packets are waiting. If the gap is still open by then, the missing
+ * sequence is declared lost and an empty packet is released in its place, which the Opus
+ * decoder turns into packet loss concealment. A packet for a sequence that was already
+ * declared lost is counted as late and dropped, `lost` counts the concealed sequences.
+ *
+ * A window of size 1 releases everything immediately, as before, but still reports losses.
+ */
+struct ReorderStats {
+    uint32_t received = 0;
+    uint32_t reordered = 0;
+    uint32_t lost = 0;
+    uint32_t late = 0;
+    uint32_t duplicate = 0;
+};
+
+class ReorderWindow {
+public:
+    ReorderWindow(size_t size, int hold_ms);
+    ~ReorderWindow();
+
+    void OnRelease(std::function<void(std::unique_ptr<AudioStreamPacket> packet)> callback);
+    // Starts a new session, the first expected sequence is `next_sequence`
+    void Reset(uint32_t next_sequence);
+    // A datagram may carry several frames, they share one sequence
+    void Push(uint32_t sequence, std::vector<std::unique_ptr<AudioStreamPacket>>& frames,
+        int sample_rate, int frame_duration);
+    ReorderStats stats();
+
+private:
+    struct Slot {
+        bool used = false;
+        uint32_t sequence = 0;
+        std::vector<std::unique_ptr<AudioStreamPacket>> frames;
+    };
+
+    std::mutex mutex_;
+    std::vector<Slot> slots_;
+    int hold_ms_;
+    uint32_t expected_sequence_ = 1;
+    uint32_t highest_sequence_ = 0;
+    // Bit i is set if sequence expected_sequence_ - 1 - i was declared lost
+    uint32_t lost_history_ = 0;
+    int64_t gap_start_time_ = 0;
+    int held_count_ = 0;
+    int last_sample_rate_ = 0;
+    int last_frame_duration_ = 0;
+    ReorderStats stats_;
+    esp_timer_handle_t gap_timer_ = nullptr;
+    std::function<void(std::unique_ptr<AudioStreamPacket> packet)> on_release_;
+    // Released in order, handed to on_release_ outside mutex_ by one task at a time
+    std::vector<std::unique_ptr<AudioStreamPacket>> ready_;
+    std::vector<std::unique_ptr<AudioStreamPacket>> delivering_;
+    bool delivery_running_ = false;
+
+    void Release(std::unique_ptr<AudioStreamPacket> packet);
+    void Deliver(std::unique_lock<std::mutex>& lock);
+    void ReleaseReady();
+    void SkipExpected();
+    void Resync(uint32_t sequence);
+    void OnGapTimeout();
+};
+
+#endif // REORDER_WINDOW_H
@@ -3,20 +3,45 @@
 #include "system_info.h"
 #include "application.h"
 #include "settings.h"
+#include "audio_packet_pool.h"
 
 #include <cstring>
+#include <algorithm>
 #include <cJSON.h>
 #include <esp_log.h>
 #include <arpa/inet.h>
+#include <esp_timer.h>
 #include "assets/lang_config.h"
 
 #define TAG "WS"
 
 WebsocketProtocol::WebsocketProtocol() {
     event_group_handle_ = xEventGroupCreate();
+
+    esp_timer_create_args_t hello_timer_args = {
+        .callback = [](void* arg) {
+            auto protocol = (WebsocketProtocol*)arg;
+            if (protocol->hello_pending_.exchange(false)) {
+                ESP_LOGE(TAG, "Failed to receive server hello");
+                protocol->SaveOptimisticState(false);
+                protocol->SetError(Lang::Strings::SERVER_TIMEOUT);
+            }
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "ws_hello",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_create(&hello_timer_args, &hello_timer_);
 }
 
 WebsocketProtocol::~WebsocketProtocol() {
+    // The sender task writes to websocket_, stop it while the members are still there
+    sender_.Stop();
+    if (hello_timer_ != nullptr) {
+        esp_timer_stop(hello_timer_);
+        esp_timer_delete(hello_timer_);
+    }
     vEventGroupDelete(event_group_handle_);
 }
 
@@ -26,10 +51,30 @@ bool WebsocketProtocol::Start() {
 }
 
 bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
+    if (audio_batch_enabled_) {
+        bool first = audio_batcher_.empty();
+        if (!audio_batcher_.Add(std::move(packet))) {
+            if (first) {
+                // FlushAudioBatch() sends it if the stream stops before the batch is full
+                sender_.SetIdleDeadline(esp_timer_get_time() + audio_batcher_.latency_budget() * 1000);
+            }
+            return true;
+        }
+        return SendAudioBatch();
+    }
+
+    if (hello_pending_) {
+        // Kept until the server hello, in case it turns the optimistic handshake down
+        std::lock_guard<std::mutex> lock(early_messages_mutex_);
+        early_messages_.push_back({std::make_unique<AudioStreamPacket>(*packet), {}});
+    }
+
+    sent_frames_++;
     if (version_ == 2) {
         std::string serialized;
         serialized.resize(sizeof(BinaryProtocol2) + packet->payload.size());
@@ -57,12 +102,56 @@ bool WebsocketProtocol::SendAudio(std::unique_ptr<AudioStreamPacket> packet) {
     }
 }
 
+void WebsocketProtocol::OnLinkRtt(int rtt_ms) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (audio_batch_enabled_) {
+        audio_batcher_.SetLinkRtt(rtt_ms);
+    }
+}
+
+void WebsocketProtocol::FlushAudioBatch() {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
+    if (websocket_ != nullptr && websocket_->IsConnected() && audio_batch_enabled_) {
+        SendAudioBatch();
+    }
+}
+
+bool WebsocketProtocol::SendAudioBatch() {
+    if (audio_batcher_.empty()) {
+        return true;
+    }
+
+    send_buffer_.resize(sizeof(BinaryProtocol4));
+    auto frame_count = audio_batcher_.frame_count();
+    sent_frames_ += frame_count;
+    auto timestamp = audio_batcher_.Serialize(send_buffer_);
+    auto bp4 = (BinaryProtocol4*)send_buffer_.data();
+    bp4->type = 0;
+    bp4->frame_count = frame_count;
+    bp4->payload_size = htons(send_buffer_.size() - sizeof(BinaryProtocol4));
+    bp4->timestamp = htonl(timestamp);
+    return websocket_->Send(send_buffer_.data(), send_buffer_.size(), true);
+}
+
 bool WebsocketProtocol::SendText(const std::string& text) {
+    std::lock_guard<std::mutex> lock(channel_mutex_);
     if (websocket_ == nullptr || !websocket_->IsConnected()) {
         return false;
     }
 
-    if (!websocket_->Send(text)) {
+    // Audio queued before this message must reach the server first
+    if (audio_batch_enabled_) {
+        SendAudioBatch();
+    }
+
+    if (hello_pending_) {
+        // Kept until the server hello, in case it turns the optimistic handshake down
+        std::lock_guard<std::mutex> lock(early_messages_mutex_);
+        early_messages_.push_back({nullptr, text});
+    }
+
+    bool sent = cbor_enabled_ ? SendCbor(text) : websocket_->Send(text);
+    if (!sent) {
         ESP_LOGE(TAG, "Failed to send text: %s", text.c_str());
         SetError(Lang::Strings::SERVER_ERROR);
         return false;
@@ -75,8 +164,46 @@ bool WebsocketProtocol::IsAudioChannelOpened() const {
     return websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_ && !IsTimeout();
 }
 
+void WebsocketProtocol::InterruptOpenAudioChannel() {
+    xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_OPEN_CANCELLED_EVENT);
+}
+
+// Destroys the websocket outside channel_mutex_, its disconnect callback must not wait on a writer
+void WebsocketProtocol::ResetWebsocket() {
+    std::unique_ptr<WebSocket> websocket;
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket = std::move(websocket_);
+    }
+}
+
 void WebsocketProtocol::CloseAudioChannel() {
-    websocket_.reset();
+    if (websocket_ != nullptr && websocket_->IsConnected() && !error_occurred_) {
+        SendQosReport(true);
+    }
+    qos_enabled_ = false;
+    if (!sender_.Flush(SEND_FLUSH_TIMEOUT_MS)) {
+        ESP_LOGW(TAG, "Closing with messages still queued");
+        sender_.Clear();
+    }
+    hello_pending_ = false;
+    esp_timer_stop(hello_timer_);
+    {
+        std::lock_guard<std::mutex> lock(early_messages_mutex_);
+        early_messages_.clear();
+    }
+    ResetWebsocket();
+    // Closed on purpose, the session is over and cannot be resumed
+    SetSessionId("");
+}
+
+void WebsocketProtocol::DropConnections() {
+    {
+        std::lock_guard<std::mutex> lock(early_messages_mutex_);
+        early_messages_.clear();
+    }
+    qos_enabled_ = false;
+    ResetWebsocket();
 }
 
 bool WebsocketProtocol::OpenAudioChannel() {
@@ -84,14 +211,40 @@ bool WebsocketProtocol::OpenAudioChannel() {
     std::string url = settings.GetString("url");
     std::string token = settings.GetString("token");
     int version = settings.GetInt("version");
-    if (version != 0) {
-        version_ = version;
-    }
 
     error_occurred_ = false;
+    xEventGroupClearBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT | WEBSOCKET_PROTOCOL_OPEN_CANCELLED_EVENT);
+    {
+        // The sender task reads the negotiated format under the same lock
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        version_ = version != 0 ? version : 1;
+        audio_batch_enabled_ = false;
+        audio_batcher_.Clear();
+    }
+    cbor_enabled_ = false;
+    qos_enabled_ = false;
+    url_ = url;
+    if (!resume_pending_) {
+        sent_frames_ = 0;
+        received_frames_ = 0;
+    }
+
+#if CONFIG_USE_OPTIMISTIC_HANDSHAKE
+    // Skip the hello round trip if this server accepted it before, with the audio params it used then
+    // A resume request needs the server answer before any audio goes out
+    optimistic_ = !resume_pending_ && settings.GetString("opt_url") == url;
+    if (optimistic_) {
+        server_sample_rate_ = settings.GetInt("opt_rate", server_sample_rate_);
+        server_frame_duration_ = settings.GetInt("opt_frame", server_frame_duration_);
+    }
+#endif
 
+    ResetWebsocket();
     auto network = Board::GetInstance().GetNetwork();
-    websocket_ = network->CreateWebSocket(1);
+    {
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        websocket_ = network->CreateWebSocket(1);
+    }
     if (websocket_ == nullptr) {
         ESP_LOGE(TAG, "Failed to create websocket");
         return false;
@@ -109,57 +262,67 @@ bool WebsocketProtocol::OpenAudioChannel() {
     websocket_->SetHeader("Client-Id", Board::GetInstance().GetUuid().c_str());
 
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
-        if (binary) {
+        if (binary && IsCborMessage(data, len)) {
+            OnCborMessage(data, len);
+        } else if (binary) {
             if (on_incoming_audio_ != nullptr) {
-                if (version_ == 2) {
-                    BinaryProtocol2* bp2 = (BinaryProtocol2*)data;
-                    bp2->version = ntohs(bp2->version);
-                    bp2->type = ntohs(bp2->type);
-                    bp2->timestamp = ntohl(bp2->timestamp);
-                    bp2->payload_size = ntohl(bp2->payload_size);
-                    auto payload = (uint8_t*)bp2->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = bp2->timestamp,
-                        .payload = std::vector<uint8_t>(payload, payload + bp2->payload_size)
-                    }));
+                // Parse the header in place and copy the payload straight into a pooled packet
+                const uint8_t* payload = (const uint8_t*)data;
+                size_t payload_size = len;
+                uint32_t timestamp = 0;
+                if (version_ == 4) {
+                    auto bp4 = (const BinaryProtocol4*)data;
+                    if (len < sizeof(BinaryProtocol4)) {
+                        ESP_LOGE(TAG, "Invalid binary packet size: %u", len);
+                        return;
+                    }
+                    payload_size = std::min((size_t)ntohs(bp4->payload_size), len - sizeof(BinaryProtocol4));
+                    AudioFrameBatcher::Parse(bp4->payload, payload_size, bp4->frame_count, ntohl(bp4->timestamp),
+                        [this](const uint8_t* frame, size_t length, uint32_t frame_timestamp) {
+                            auto packet = AudioPacketPool::GetInstance().Acquire(length);
+                            packet->sample_rate = server_sample_rate_;
+                            packet->frame_duration = server_frame_duration_;
+                            packet->timestamp = frame_timestamp;
+                            memcpy(packet->payload.data(), frame, length);
+                            uint32_t sequence = ++received_frames_;
+                            if (qos_enabled_) {
+                                downlink_qos_.OnPacket(sequence, frame_timestamp);
+                            }
+                            on_incoming_audio_(std::move(packet));
+                        });
+                    last_incoming_time_ = std::chrono::steady_clock::now();
+                    return;
+                } else if (version_ == 2) {
+                    auto bp2 = (const BinaryProtocol2*)data;
+                    if (len < sizeof(BinaryProtocol2)) {
+                        ESP_LOGE(TAG, "Invalid binary packet size: %u", len);
+                        return;
+                    }
+                    timestamp = ntohl(bp2->timestamp);
+                    payload = bp2->payload;
+                    payload_size = std::min((size_t)ntohl(bp2->payload_size), len - sizeof(BinaryProtocol2));
                 } else if (version_ == 3) {
-                    BinaryProtocol3* bp3 = (BinaryProtocol3*)data;
-                    bp3->type = bp3->type;
-                    bp3->payload_size = ntohs(bp3->payload_size);
-                    auto payload = (uint8_t*)bp3->payload;
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>(payload, payload + bp3->payload_size)
-                    }));
-                } else {
-                    on_incoming_audio_(std::make_unique<AudioStreamPacket>(AudioStreamPacket{
-                        .sample_rate = server_sample_rate_,
-                        .frame_duration = server_frame_duration_,
-                        .timestamp = 0,
-                        .payload = std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)
-                    }));
-                }
-            }
-        } else {
-            // Parse JSON data
-            auto root = cJSON_Parse(data);
-            auto type = cJSON_GetObjectItem(root, "type");
-            if (cJSON_IsString(type)) {
-                if (strcmp(type->valuestring, "hello") == 0) {
-                    ParseServerHello(root);
-                } else {
-                    if (on_incoming_json_ != nullptr) {
-                        on_incoming_json_(root);
+                    auto bp3 = (const BinaryProtocol3*)data;
+                    if (len < sizeof(BinaryProtocol3)) {
+                        ESP_LOGE(TAG, "Invalid binary packet size: %u", len);
+                        return;
                     }
+                    payload = bp3->payload;
+                    payload_size = std::min((size_t)ntohs(bp3->payload_size), len - sizeof(BinaryProtocol3));
+                }
+                auto packet = AudioPacketPool::GetInstance().Acquire(payload_size);
+                packet->sample_rate = server_sample_rate_;
+                packet->frame_duration = server_frame_duration_;
+                packet->timestamp = timestamp;
+                memcpy(packet->payload.data(), payload, payload_size);
+                uint32_t sequence = ++received_frames_;
+                if (qos_enabled_) {
+                    downlink_qos_.OnPacket(sequence, timestamp);
                 }
-            } else {
-                ESP_LOGE(TAG, "Missing message type, data: %s", data);
+                on_incoming_audio_(std::move(packet));
             }
-            cJSON_Delete(root);
+        } else {
+            OnTextMessage(data, len);
         }
         last_incoming_time_ = std::chrono::steady_clock::now();
     });
@@ -180,12 +343,27 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     // Send hello message to describe the client
     auto message = GetHelloMessage();
+    hello_time_ = esp_timer_get_time();
     if (!SendText(message)) {
         return false;
     }
 
+    if (optimistic_) {
+        ESP_LOGI(TAG, "Optimistic handshake, not waiting for the server hello");
+        hello_pending_ = true;
+        esp_timer_start_once(hello_timer_, 10000 * 1000);
+        if (on_audio_channel_opened_ != nullptr) {
+            on_audio_channel_opened_();
+        }
+        return true;
+    }
+
     // Wait for server hello
-    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT, pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+    EventBits_t bits = xEventGroupWaitBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT | WEBSOCKET_PROTOCOL_OPEN_CANCELLED_EVENT,
+        pdTRUE, pdFALSE, pdMS_TO_TICKS(10000));
+    if (bits & WEBSOCKET_PROTOCOL_OPEN_CANCELLED_EVENT) {
+        return false;
+    }
     if (!(bits & WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT)) {
         ESP_LOGE(TAG, "Failed to receive server hello");
         SetError(Lang::Strings::SERVER_TIMEOUT);
@@ -199,6 +377,81 @@ bool WebsocketProtocol::OpenAudioChannel() {
     return true;
 }
 
+void WebsocketProtocol::OnTextMessage(const char* data, size_t len) {
+    if (on_incoming_text_ != nullptr && on_incoming_text_(std::string_view(data, len))) {
+        return;
+    }
+
+    // Parse JSON data
+    auto root = cJSON_ParseWithLength(data, len);
+    auto type = cJSON_GetObjectItem(root, "type");
+    if (cJSON_IsString(type)) {
+        if (strcmp(type->valuestring, "hello") == 0) {
+            ParseServerHello(root);
+        } else if (strcmp(type->valuestring, "qos") == 0) {
+            OnQosReport(root);
+        } else {
+            if (on_incoming_json_ != nullptr) {
+                on_incoming_json_(root);
+            }
+        }
+    } else {
+        ESP_LOGE(TAG, "Missing message type, data: %.*s", (int)len, data);
+    }
+    cJSON_Delete(root);
+}
+
+// Binary versions 2 to 4 tag their messages with a type, version 1 binary frames are all audio
+bool WebsocketProtocol::IsCborMessage(const char* data, size_t len) const {
+    if (version_ == 2) {
+        return len >= sizeof(BinaryProtocol2) && ntohs(((const BinaryProtocol2*)data)->type) == BINARY_PROTOCOL_TYPE_CBOR;
+    } else if (version_ == 3) {
+        return len >= sizeof(BinaryProtocol3) && ((const BinaryProtocol3*)data)->type == BINARY_PROTOCOL_TYPE_CBOR;
+    } else if (version_ == 4) {
+        return len >= sizeof(BinaryProtocol4) && ((const BinaryProtocol4*)data)->type == BINARY_PROTOCOL_TYPE_CBOR;
+    }
+    return false;
+}
+
+void WebsocketProtocol::OnCborMessage(const char* data, size_t len) {
+    size_t header_size = version_ == 2 ? sizeof(BinaryProtocol2) : version_ == 3 ? sizeof(BinaryProtocol3) : sizeof(BinaryProtocol4);
+    rx_text_buffer_.clear();
+    if (!CborCodec::ToJson((const uint8_t*)data + header_size, len - header_size, rx_text_buffer_)) {
+        ESP_LOGE(TAG, "Failed to decode CBOR message, %u bytes", len);
+        return;
+    }
+    OnTextMessage(rx_text_buffer_.data(), rx_text_buffer_.size());
+}
+
+// Sends a control message as CBOR behind the header of the current binary version
+bool WebsocketProtocol::SendCbor(const std::string& text) {
+    size_t header_size = version_ == 2 ? sizeof(BinaryProtocol2) : version_ == 3 ? sizeof(BinaryProtocol3) : sizeof(BinaryProtocol4);
+    cbor_buffer_.assign(header_size, '\0');
+    if (!CborCodec::FromJson(text, cbor_buffer_)) {
+        ESP_LOGW(TAG, "Not valid JSON, sent as text: %s", text.c_str());
+        return websocket_->Send(text);
+    }
+
+    size_t payload_size = cbor_buffer_.size() - header_size;
+    if (version_ == 2) {
+        auto bp2 = (BinaryProtocol2*)cbor_buffer_.data();
+        bp2->version = htons(version_);
+        bp2->type = htons(BINARY_PROTOCOL_TYPE_CBOR);
+        bp2->payload_size = htonl(payload_size);
+    } else if (payload_size > UINT16_MAX) {
+        return websocket_->Send(text);
+    } else if (version_ == 3) {
+        auto bp3 = (BinaryProtocol3*)cbor_buffer_.data();
+        bp3->type = BINARY_PROTOCOL_TYPE_CBOR;
+        bp3->payload_size = htons(payload_size);
+    } else {
+        auto bp4 = (BinaryProtocol4*)cbor_buffer_.data();
+        bp4->type = BINARY_PROTOCOL_TYPE_CBOR;
+        bp4->payload_size = htons(payload_size);
+    }
+    return websocket_->Send(cbor_buffer_.data(), cbor_buffer_.size(), true);
+}
+
 std::string WebsocketProtocol::GetHelloMessage() {
     // keys: message type, version, audio_params (format, sample_rate, channels)
     cJSON* root = cJSON_CreateObject();
@@ -209,8 +462,37 @@ std::string WebsocketProtocol::GetHelloMessage() {
     cJSON_AddBoolToObject(features, "aec", true);
 #endif
     cJSON_AddBoolToObject(features, "mcp", true);
+#if CONFIG_USE_AUDIO_FRAME_BATCHING
+    // Audio is already flowing during an optimistic handshake, so the format cannot change mid-session
+    if (!optimistic_) {
+        cJSON_AddBoolToObject(features, "audio_batch", true);
+    }
+#endif
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    cJSON_AddBoolToObject(features, "keep_warm", true);
+#endif
+#if CONFIG_USE_OPTIMISTIC_HANDSHAKE
+    cJSON_AddBoolToObject(features, "optimistic", true);
+#endif
+#if CONFIG_USE_CBOR_MESSAGES
+    // CBOR messages are told apart from audio by the binary header, version 1 has none
+    if (version_ != 1) {
+        cJSON_AddBoolToObject(features, "cbor", true);
+    }
+#endif
+#if CONFIG_USE_QOS_FEEDBACK
+    cJSON_AddBoolToObject(features, "qos", true);
+#endif
     cJSON_AddItemToObject(root, "features", features);
     cJSON_AddStringToObject(root, "transport", "websocket");
+    if (resume_pending_) {
+        // Ask the server to continue the dropped session and replay the audio we missed
+        cJSON* resume = cJSON_CreateObject();
+        cJSON_AddStringToObject(resume, "session_id", this->session_id().c_str());
+        cJSON_AddNumberToObject(resume, "last_received_seq", received_frames_);
+        cJSON_AddNumberToObject(resume, "last_sent_seq", sent_frames_);
+        cJSON_AddItemToObject(root, "resume", resume);
+    }
     cJSON* audio_params = cJSON_CreateObject();
     cJSON_AddStringToObject(audio_params, "format", "opus");
     cJSON_AddNumberToObject(audio_params, "sample_rate", 16000);
@@ -224,6 +506,24 @@ std::string WebsocketProtocol::GetHelloMessage() {
     return message;
 }
 
+#if CONFIG_USE_OPTIMISTIC_HANDSHAKE
+// Messages sent before the server hello carry the session id from before it
+static std::string WithSessionId(const std::string& text, const std::string& session_id) {
+    auto root = cJSON_Parse(text.c_str());
+    if (root == nullptr) {
+        return text;
+    }
+    if (cJSON_GetObjectItem(root, "session_id") != nullptr) {
+        cJSON_ReplaceItemInObject(root, "session_id", cJSON_CreateString(session_id.c_str()));
+    }
+    auto json = cJSON_PrintUnformatted(root);
+    std::string result(json);
+    cJSON_free(json);
+    cJSON_Delete(root);
+    return result;
+}
+#endif
+
 void WebsocketProtocol::ParseServerHello(const cJSON* root) {
     auto transport = cJSON_GetObjectItem(root, "transport");
     if (transport == nullptr || strcmp(transport->valuestring, "websocket") != 0) {
@@ -233,8 +533,17 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
 
     auto session_id = cJSON_GetObjectItem(root, "session_id");
     if (cJSON_IsString(session_id)) {
-        session_id_ = session_id->valuestring;
-        ESP_LOGI(TAG, "Session ID: %s", session_id_.c_str());
+        SetSessionId(session_id->valuestring);
+        ESP_LOGI(TAG, "Session ID: %s", session_id->valuestring);
+    }
+
+    session_resumed_ = resume_pending_ && cJSON_IsTrue(cJSON_GetObjectItem(root, "resumed"));
+    if (session_resumed_) {
+        ESP_LOGI(TAG, "Session resumed at sent %lu, received %lu", sent_frames_, received_frames_.load());
+    } else if (resume_pending_) {
+        ESP_LOGW(TAG, "Server started a new session instead of resuming");
+        sent_frames_ = 0;
+        received_frames_ = 0;
     }
 
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
@@ -249,5 +558,90 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         }
     }
 
+    [[maybe_unused]] auto features = cJSON_GetObjectItem(root, "features");
+    [[maybe_unused]] auto hello_rtt_ms = (esp_timer_get_time() - hello_time_) / 1000;
+#if CONFIG_USE_AUDIO_FRAME_BATCHING
+    // The server accepts batching by echoing the feature, binary frames switch to version 4
+    if (!optimistic_ && cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "audio_batch"))) {
+        ESP_LOGI(TAG, "Audio batching enabled, binary protocol version 4");
+        // Switched together under the lock, the sender task must not frame audio with half of it
+        std::lock_guard<std::mutex> lock(channel_mutex_);
+        audio_batch_enabled_ = true;
+        version_ = 4;
+        // The hello round trip is our first estimate of the link RTT
+        audio_batcher_.SetLinkRtt(hello_rtt_ms);
+    }
+#endif
+#if CONFIG_USE_OPTIMISTIC_HANDSHAKE
+    bool accepted = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "optimistic"));
+    if (hello_pending_.exchange(false)) {
+        esp_timer_stop(hello_timer_);
+        std::vector<NetworkSender::Message> messages;
+        {
+            std::lock_guard<std::mutex> lock(early_messages_mutex_);
+            messages = std::move(early_messages_);
+            early_messages_.clear();
+        }
+        if (accepted) {
+            ESP_LOGI(TAG, "Server hello after %lld ms, saved by the optimistic handshake", hello_rtt_ms);
+        } else {
+            // Fall back: the server dropped what came before its hello. Send it again under the session id
+            // of the hello, ahead of anything queued since
+            uint32_t audio_frames = 0;
+            auto hello_session_id = this->session_id();
+            for (auto& message : messages) {
+                if (message.packet != nullptr) {
+                    audio_frames++;
+                } else {
+                    message.text = WithSessionId(message.text, hello_session_id);
+                }
+            }
+            {
+                // The server never counted them, they are counted again as the replay goes out
+                std::lock_guard<std::mutex> lock(channel_mutex_);
+                sent_frames_ -= audio_frames;
+            }
+            ESP_LOGW(TAG, "Optimistic handshake rejected, replaying %u messages with %lu audio frames",
+                messages.size(), audio_frames);
+            sender_.PushFront(std::move(messages));
+        }
+    } else {
+        ESP_LOGI(TAG, "Server hello after %lld ms", hello_rtt_ms);
+    }
+    SaveOptimisticState(accepted);
+#endif
+#if CONFIG_USE_AUDIO_CHANNEL_KEEP_WARM
+    // The server lets us park the channel between sessions
+    server_keep_warm_ = cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "keep_warm"));
+#endif
+#if CONFIG_USE_CBOR_MESSAGES
+    // Control and MCP messages switch to CBOR in both directions
+    cbor_enabled_ = version_ != 1 && cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "cbor"));
+#endif
+#if CONFIG_USE_QOS_FEEDBACK
+    // Receiver reports in both directions, the uplink encoder follows the server's
+    StartQos(cJSON_IsObject(features) && cJSON_IsTrue(cJSON_GetObjectItem(features, "qos")));
+#endif
+
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
 }
+
+// Remembers whether this server takes the optimistic handshake, along with its audio params
+void WebsocketProtocol::SaveOptimisticState(bool accepted) {
+    Settings settings("websocket", true);
+    if (!accepted) {
+        if (!settings.GetString("opt_url").empty()) {
+            settings.EraseKey("opt_url");
+        }
+        return;
+    }
+    if (settings.GetString("opt_url") != url_) {
+        settings.SetString("opt_url", url_);
+    }
+    if (settings.GetInt("opt_rate") != server_sample_rate_) {
+        settings.SetInt("opt_rate", server_sample_rate_);
+    }
+    if (settings.GetInt("opt_frame") != server_frame_duration_) {
+        settings.SetInt("opt_frame", server_frame_duration_);
+    }
+}
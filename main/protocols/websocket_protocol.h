@@ -3,12 +3,20 @@
 
 
 #include "protocol.h"
+#include "audio_frame_batcher.h"
+#include "cbor_codec.h"
 
 #include <web_socket.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
+#include <esp_timer.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 #define WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
+#define WEBSOCKET_PROTOCOL_OPEN_CANCELLED_EVENT (1 << 1)
 
 class WebsocketProtocol : public Protocol {
 public:
@@ -19,15 +27,45 @@ public:
     bool SendAudio(std::unique_ptr<AudioStreamPacket> packet) override;
     bool OpenAudioChannel() override;
     void CloseAudioChannel() override;
+    void DropConnections() override;
     bool IsAudioChannelOpened() const override;
 
 private:
     EventGroupHandle_t event_group_handle_;
+    // Held while writing, the sender task and the task opening the channel both write
+    std::mutex channel_mutex_;
     std::unique_ptr<WebSocket> websocket_;
     int version_ = 1;
+    bool audio_batch_enabled_ = false;
+    AudioFrameBatcher audio_batcher_;
+    std::string send_buffer_;
+    std::string cbor_buffer_;
+    std::string rx_text_buffer_;
+    std::string url_;
+    int64_t hello_time_ = 0;
+    // Opus frames sent and received in this session, the sequence numbers of a resume request
+    uint32_t sent_frames_ = 0;
+    std::atomic<uint32_t> received_frames_ = 0;
+
+    // Optimistic handshake: audio and text go out before the server hello arrives
+    bool optimistic_ = false;
+    std::atomic<bool> hello_pending_ = false;
+    std::mutex early_messages_mutex_;
+    std::vector<NetworkSender::Message> early_messages_;
+    esp_timer_handle_t hello_timer_ = nullptr;
 
     void ParseServerHello(const cJSON* root);
+    bool SendAudioBatch();
+    void ResetWebsocket();
+    bool SendCbor(const std::string& text);
+    bool IsCborMessage(const char* data, size_t len) const;
+    void OnCborMessage(const char* data, size_t len);
+    void OnTextMessage(const char* data, size_t len);
     bool SendText(const std::string& text) override;
+    void OnLinkRtt(int rtt_ms) override;
+    void FlushAudioBatch() override;
+    void InterruptOpenAudioChannel() override;
+    void SaveOptimisticState(bool accepted);
     std::string GetHelloMessage();
 };
 
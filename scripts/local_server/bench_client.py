@@ -0,0 +1,381 @@
+"""
+Host stand-in for the device side of the protocol, driven against local_server.py.
+
+Each run opens an audio channel the way Application does after a wake word: hello, wake word
+audio, "listen detect", "listen start" and a paced Opus uplink until the TTS answer arrives.
+It answers the MCP initialize and tools/list requests with a synthetic catalog and can barge in
+with an abort. Latency and throughput are aggregated per protocol variant.
+"""
+
+import argparse
+import asyncio
+import json
+import os
+import statistics
+import sys
+import uuid
+
+import websockets
+
+import opus_stream
+from framing import TYPE_JSON, TYPE_OPUS, UdpCrypto, WebsocketFraming
+from mqtt_lite import MqttClient
+from netem import SequenceStats, StreamStats, now_ms
+
+REPO_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+
+# name: (transport, binary protocol version, audio_batch)
+VARIANTS = {
+    "ws-v1": ("websocket", 1, False),
+    "ws-v2": ("websocket", 2, False),
+    "ws-v3": ("websocket", 3, False),
+    "ws-v2-batch": ("websocket", 2, True),
+    "ws-v3-batch": ("websocket", 3, True),
+    "mqtt-udp": ("mqtt", 3, False),
+    "mqtt-udp-batch": ("mqtt", 3, True),
+}
+
+LATENCY_FIELDS = ["connect_ms", "wake_to_stt_ms", "wake_to_first_audio_ms", "barge_in_stop_ms", "barge_in_drain_ms"]
+
+
+class DeviceStandIn:
+    def __init__(self, args, variant, uplink):
+        self.args = args
+        self.transport, self.version, self.want_batch = VARIANTS[variant]
+        self.uplink = uplink
+        self.batch = False
+        self.session_id = ""
+        self.hello = asyncio.get_running_loop().create_future()
+        self.tts_started = asyncio.Event()
+        self.tts_stopped = asyncio.Event()
+        self.first_audio = asyncio.Event()
+        self.times = {}
+        self.downlink = StreamStats()
+        self.sequences = SequenceStats()
+        self.last_audio_time = None
+        self.tools_pages = 0
+        self.device_id = "local-bench-" + uuid.uuid4().hex[:6]
+
+    def mark(self, name):
+        self.times.setdefault(name, now_ms())
+
+    def since(self, start, end):
+        if start in self.times and end in self.times:
+            return round(self.times[end] - self.times[start], 1)
+        return None
+
+    def hello_message(self):
+        features = {"mcp": True}
+        if self.want_batch:
+            features["audio_batch"] = True
+        return {
+            "type": "hello",
+            "version": self.version,
+            "transport": "websocket" if self.transport == "websocket" else "udp",
+            "features": features,
+            "audio_params": {"format": "opus", "sample_rate": 16000, "channels": 1,
+                             "frame_duration": self.uplink.frame_duration},
+        }
+
+    def send_json(self, message):
+        if self.session_id:
+            message = {"session_id": self.session_id, **message}
+        self.send_text(json.dumps(message, ensure_ascii=False))
+
+    # Server -> device
+    def on_text(self, text):
+        try:
+            message = json.loads(text)
+        except json.JSONDecodeError:
+            return
+        msg_type = message.get("type")
+        if msg_type == "hello":
+            if not self.hello.done():
+                self.hello.set_result(message)
+        elif msg_type == "stt":
+            self.mark("stt")
+        elif msg_type == "tts":
+            state = message.get("state")
+            if state == "start":
+                self.mark("tts_start")
+                self.tts_started.set()
+            elif state == "stop":
+                self.mark("tts_stop")
+                self.tts_stopped.set()
+        elif msg_type == "mcp":
+            self.on_mcp(message.get("payload") or {})
+
+    def on_audio(self, frames, size, sequence=None):
+        self.mark("first_audio")
+        self.first_audio.set()
+        self.last_audio_time = now_ms()
+        timestamp = frames[0][1] if self.has_timestamps() else None
+        self.downlink.add(len(frames), size, timestamp)
+        if sequence is not None:
+            self.sequences.add(sequence)
+
+    def on_mcp(self, payload):
+        method = payload.get("method")
+        request_id = payload.get("id")
+        if method == "initialize":
+            result = {"protocolVersion": "2024-11-05",
+                      "capabilities": {"tools": {"hash": self.args.tools_hash} if self.args.tools_hash else {}},
+                      "serverInfo": {"name": "local-bench", "version": "0.0.0"}}
+        elif method == "tools/list":
+            start = int((payload.get("params") or {}).get("cursor") or 0)
+            end = min(start + 8, self.args.tools)
+            tools = [{"name": f"self.bench.tool_{i}", "description": "Synthetic tool of the local bench",
+                      "inputSchema": {"type": "object", "properties": {}}} for i in range(start, end)]
+            result = {"tools": tools}
+            if end < self.args.tools:
+                result["nextCursor"] = str(end)
+            self.tools_pages += 1
+        else:
+            return
+        self.send_json({"type": "mcp", "payload": {"jsonrpc": "2.0", "id": request_id, "result": result}})
+
+    async def run(self):
+        start = now_ms()
+        await self.open()
+        hello = await asyncio.wait_for(self.hello, 10)
+        self.times["open"] = start
+        self.mark("hello")
+        self.session_id = hello.get("session_id", "")
+        self.batch = self.want_batch and bool((hello.get("features") or {}).get("audio_batch"))
+        self.on_hello(hello)
+
+        # Wake word audio goes first so the server can verify the speaker, then detect and start
+        frames = self.uplink.frames
+        await self.send_audio_paced(frames[:5], realtime=False)
+        self.mark("detect")
+        self.send_json({"type": "listen", "state": "detect", "text": "你好小智"})
+        self.send_json({"type": "listen", "state": "start", "mode": "auto"})
+        uplink_task = asyncio.ensure_future(self.stream_uplink())
+        try:
+            await asyncio.wait_for(self.tts_started.wait(), 30)
+            uplink_task.cancel()
+            await asyncio.wait_for(self.first_audio.wait(), 10)
+            if self.args.barge_in_ms is not None:
+                await asyncio.sleep(self.args.barge_in_ms / 1000)
+                self.mark("abort")
+                self.send_json({"type": "abort", "reason": "wake_word_detected"})
+            await asyncio.wait_for(self.tts_stopped.wait(), 60)
+            # Let frames still in flight arrive before the channel closes
+            await asyncio.sleep(0.3)
+        finally:
+            uplink_task.cancel()
+            await self.close()
+        return self.report()
+
+    async def stream_uplink(self):
+        frames = self.uplink.frames
+        while True:
+            await self.send_audio_paced(frames, realtime=True)
+
+    async def send_audio_paced(self, frames, realtime):
+        n = self.args.batch_frames if self.batch else 1
+        start = now_ms()
+        for i in range(0, len(frames), n):
+            if realtime:
+                # A batch leaves when its last frame has been captured
+                due = start + (i + n) * self.uplink.frame_duration
+                delay = due - now_ms()
+                if delay > 0:
+                    await asyncio.sleep(delay / 1000)
+            timestamp = int(now_ms()) & 0xFFFFFFFF
+            chunk = [(f, timestamp + j * self.uplink.frame_duration) for j, f in enumerate(frames[i:i + n])]
+            self.send_frames(chunk)
+
+    def report(self):
+        report = {
+            "connect_ms": self.since("open", "hello"),
+            "wake_to_stt_ms": self.since("detect", "stt"),
+            "wake_to_first_audio_ms": self.since("detect", "first_audio"),
+            "batch": self.batch,
+            "downlink": self.downlink.to_dict(),
+            "tools_pages": self.tools_pages,
+        }
+        if "abort" in self.times:
+            report["barge_in_stop_ms"] = self.since("abort", "tts_stop")
+            if self.last_audio_time is not None:
+                report["barge_in_drain_ms"] = round(max(0.0, self.last_audio_time - self.times["abort"]), 1)
+        if self.transport == "mqtt":
+            report["sequence"] = self.sequences.to_dict()
+        return report
+
+
+class WebsocketDevice(DeviceStandIn):
+    def has_timestamps(self):
+        return self.framing.version in (2, 4)
+
+    async def open(self):
+        self.framing = WebsocketFraming(self.version)
+        headers = {"Authorization": "Bearer local", "Protocol-Version": str(self.version),
+                   "Device-Id": self.device_id, "Client-Id": str(uuid.uuid4())}
+        self.connection = await websockets.connect(self.args.ws_url, additional_headers=headers, max_size=None)
+        self.reader = asyncio.ensure_future(self.read_loop())
+        self.send_text(json.dumps(self.hello_message()))
+
+    def on_hello(self, hello):
+        if self.batch:
+            self.framing.version = 4
+
+    async def read_loop(self):
+        try:
+            async for message in self.connection:
+                if isinstance(message, str):
+                    self.on_text(message)
+                    continue
+                unpacked = self.framing.unpack(message)
+                if unpacked is None:
+                    continue
+                msg_type, body = unpacked
+                if msg_type == TYPE_OPUS:
+                    self.on_audio(body, len(message))
+                elif msg_type == TYPE_JSON:
+                    self.on_text(body.decode(errors="replace"))
+        except websockets.ConnectionClosed:
+            pass
+
+    def send_text(self, text):
+        asyncio.ensure_future(self.connection.send(text))
+
+    def send_frames(self, frames):
+        if self.framing.version != 4:
+            for frame in frames:
+                asyncio.ensure_future(self.connection.send(self.framing.pack([frame])))
+        else:
+            asyncio.ensure_future(self.connection.send(self.framing.pack(frames)))
+
+    async def close(self):
+        await self.connection.close()
+        self.reader.cancel()
+
+
+class MqttUdpDevice(DeviceStandIn, asyncio.DatagramProtocol):
+    def has_timestamps(self):
+        return True
+
+    async def open(self):
+        self.mqtt = MqttClient(on_message=lambda topic, payload: self.on_text(payload.decode(errors="replace")))
+        await self.mqtt.connect(self.args.host, self.args.mqtt_port, self.device_id, "local", "local")
+        self.udp = None
+        self.sequence = 0
+        self.send_text(json.dumps(self.hello_message()))
+
+    def on_hello(self, hello):
+        udp = hello["udp"]
+        self.crypto = UdpCrypto(bytes.fromhex(udp["key"]), bytes.fromhex(udp["nonce"]))
+        address = (self.args.udp_host or udp["server"], udp["port"])
+        # The UDP socket is created once the hello tells where to send
+        self.udp_ready = asyncio.ensure_future(asyncio.get_running_loop().create_datagram_endpoint(
+            lambda: self, remote_addr=address))
+
+    def datagram_received(self, data, address):
+        unpacked = self.crypto.unpack(data)
+        if unpacked is not None:
+            self.on_audio(unpacked[2], len(data), unpacked[1])
+
+    def send_text(self, text):
+        self.mqtt.publish("device-server", text.encode())
+
+    def send_frames(self, frames):
+        if self.udp is None:
+            return
+        self.sequence += 1
+        self.udp.sendto(self.crypto.pack(frames, self.sequence, self.batch))
+
+    async def send_audio_paced(self, frames, realtime):
+        if self.udp is None:
+            self.udp, _ = await self.udp_ready
+        await super().send_audio_paced(frames, realtime)
+
+    async def close(self):
+        self.send_json({"type": "goodbye"})
+        await self.mqtt.close()
+        if self.udp is not None:
+            self.udp.close()
+
+
+def percentile(values, p):
+    values = sorted(values)
+    index = min(len(values) - 1, int(round(p / 100 * (len(values) - 1))))
+    return values[index]
+
+
+def summarize(runs):
+    summary = {}
+    for field in LATENCY_FIELDS:
+        values = [r[field] for r in runs if r.get(field) is not None]
+        if values:
+            summary[field] = {"median": round(statistics.median(values), 1), "p90": round(percentile(values, 90), 1)}
+    kbps = [r["downlink"]["kbps"] for r in runs if r["downlink"]["kbps"]]
+    if kbps:
+        summary["downlink_kbps"] = round(statistics.median(kbps), 1)
+    summary["downlink_frames"] = sum(r["downlink"]["frames"] for r in runs)
+    jitter = [r["downlink"]["jitter_ms"] for r in runs if r["downlink"]["jitter_ms"] is not None]
+    if jitter:
+        summary["downlink_jitter_ms"] = round(statistics.median(jitter), 1)
+    lost = [r["sequence"]["lost"] for r in runs if "sequence" in r]
+    if lost:
+        summary["udp_lost"] = sum(lost)
+        summary["udp_reordered"] = sum(r["sequence"]["reordered"] for r in runs)
+    summary["batch"] = any(r["batch"] for r in runs)
+    return summary
+
+
+def print_table(results):
+    columns = ["variant", "runs"] + LATENCY_FIELDS + ["downlink_kbps", "downlink_jitter_ms", "udp_lost"]
+    print("\t".join(columns))
+    for variant, result in results.items():
+        summary = result["summary"]
+        row = [variant, str(len(result["runs"]))]
+        for field in LATENCY_FIELDS:
+            value = summary.get(field)
+            row.append(f"{value['median']}/{value['p90']}" if value else "-")
+        for field in ["downlink_kbps", "downlink_jitter_ms", "udp_lost"]:
+            row.append(str(summary.get(field, "-")))
+        print("\t".join(row))
+
+
+async def bench(args):
+    uplink = opus_stream.load(args.uplink if os.path.isabs(args.uplink) else os.path.join(REPO_ROOT, args.uplink))
+    results = {}
+    for variant in args.variants:
+        runs = []
+        for i in range(args.runs):
+            device_class = WebsocketDevice if VARIANTS[variant][0] == "websocket" else MqttUdpDevice
+            try:
+                runs.append(await device_class(args, variant, uplink).run())
+            except (asyncio.TimeoutError, OSError, websockets.WebSocketException) as e:
+                print(f"{variant} run {i + 1}: {type(e).__name__} {e}", file=sys.stderr)
+        if runs:
+            results[variant] = {"summary": summarize(runs), "runs": runs}
+    print_table(results)
+    if args.report:
+        with open(args.report, "w", encoding="utf-8") as f:
+            json.dump(results, f, ensure_ascii=False, indent=2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="模拟设备端连接本地测试服务器，按协议变体输出延迟和吞吐量报告")
+    parser.add_argument("--host", default="127.0.0.1", help="本地服务器地址 (默认: 127.0.0.1)")
+    parser.add_argument("--ws-port", type=int, default=8000, help="WebSocket 端口 (默认: 8000)")
+    parser.add_argument("--mqtt-port", type=int, default=1883, help="MQTT 端口 (默认: 1883)")
+    parser.add_argument("--udp-host", help="覆盖服务器 hello 中下发的 UDP 地址")
+    parser.add_argument("--variants", nargs="+", choices=list(VARIANTS), default=list(VARIANTS),
+                        help="要测试的协议变体 (默认: 全部)")
+    parser.add_argument("--runs", type=int, default=5, help="每个变体的会话次数 (默认: 5)")
+    parser.add_argument("--batch-frames", type=int, default=3, help="上行合并发送的帧数 (默认: 3)")
+    parser.add_argument("--barge-in-ms", type=int, help="收到首个音频后多久发送 abort 打断 (默认: 不打断)")
+    parser.add_argument("--uplink", default="main/assets/locales/zh-CN/welcome.ogg", help="上行循环发送的 Opus 音频")
+    parser.add_argument("--tools", type=int, default=24, help="模拟的 MCP 工具数量 (默认: 24)")
+    parser.add_argument("--tools-hash", default="", help="initialize 响应中声明的工具目录哈希")
+    parser.add_argument("--report", help="写入 JSON 报告的文件")
+    args = parser.parse_args()
+    args.ws_url = f"ws://{args.host}:{args.ws_port}/xiaozhi/v1/"
+    asyncio.run(bench(args))
+
+
+if __name__ == "__main__":
+    main()
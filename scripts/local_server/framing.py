@@ -0,0 +1,138 @@
+"""
+Binary framing of the xiaozhi audio channel.
+
+WebSocket binary protocol versions 1-4 (docs/websocket.md §3) and the encrypted UDP packets of
+MQTT+UDP (docs/mqtt-udp.md §4). Multi-byte fields are big endian everywhere.
+"""
+
+import os
+import struct
+
+from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+
+TYPE_OPUS = 0
+TYPE_JSON = 1
+TYPE_CBOR = 2
+
+UDP_TYPE_SINGLE = 0x01
+UDP_TYPE_BATCH = 0x02
+UDP_HEADER_SIZE = 16
+
+BATCH_MAX_FRAMES = 8
+
+
+def pack_batch(frames):
+    """frames: list of (opus, timestamp). Returns (payload, first_timestamp)."""
+    base = frames[0][1]
+    table = b"".join(struct.pack(">HH", len(f), (ts - base) & 0xFFFF) for f, ts in frames)
+    return table + b"".join(f for f, _ in frames), base
+
+
+def unpack_batch(payload, frame_count, timestamp):
+    """Returns a list of (opus, timestamp), or None if the table does not match the payload."""
+    table_size = frame_count * 4
+    if frame_count == 0 or len(payload) < table_size:
+        return None
+    frames = []
+    offset = table_size
+    for i in range(frame_count):
+        length, ts_offset = struct.unpack_from(">HH", payload, i * 4)
+        if offset + length > len(payload):
+            return None
+        frames.append((payload[offset:offset + length], timestamp + ts_offset))
+        offset += length
+    return frames
+
+
+class WebsocketFraming:
+    """Binary frames of one WebSocket session. Version 4 is the negotiated audio_batch mode."""
+
+    def __init__(self, version):
+        self.version = version
+
+    def pack(self, frames):
+        """frames: list of (opus, timestamp), more than one only in version 4."""
+        if self.version == 4:
+            payload, timestamp = pack_batch(frames)
+            return struct.pack(">BBHI", TYPE_OPUS, len(frames), len(payload), timestamp) + payload
+        opus, timestamp = frames[0]
+        if self.version == 2:
+            return struct.pack(">HHIII", 2, TYPE_OPUS, 0, timestamp, len(opus)) + opus
+        if self.version == 3:
+            return struct.pack(">BBH", TYPE_OPUS, 0, len(opus)) + opus
+        return opus
+
+    def unpack(self, data):
+        """Returns (type, [(opus, timestamp)] or payload bytes), or None for malformed frames."""
+        if self.version == 4:
+            if len(data) < 8:
+                return None
+            msg_type, count, size, timestamp = struct.unpack_from(">BBHI", data)
+            payload = data[8:8 + size]
+            if msg_type != TYPE_OPUS:
+                return msg_type, payload
+            frames = unpack_batch(payload, count, timestamp)
+            return None if frames is None else (TYPE_OPUS, frames)
+        if self.version == 2:
+            if len(data) < 16:
+                return None
+            _, msg_type, _, timestamp, size = struct.unpack_from(">HHIII", data)
+            payload = data[16:16 + size]
+        elif self.version == 3:
+            if len(data) < 4:
+                return None
+            msg_type, _, size = struct.unpack_from(">BBH", data)
+            timestamp = 0
+            payload = data[4:4 + size]
+        else:
+            return TYPE_OPUS, [(data, 0)]
+        if msg_type != TYPE_OPUS:
+            return msg_type, payload
+        return TYPE_OPUS, [(payload, timestamp)]
+
+
+class UdpCrypto:
+    """AES-128-CTR of the UDP audio channel, the 16 byte packet header is the counter block."""
+
+    def __init__(self, key=None, nonce=None):
+        self.key = key or os.urandom(16)
+        # |type 1|flags 1|size 2|ssrc 4|timestamp 4|sequence 4|, only ssrc survives in packets
+        self.nonce = nonce or (b"\x01\x00\x00\x00" + os.urandom(4) + b"\x00" * 8)
+
+    @property
+    def ssrc(self):
+        return self.nonce[4:8]
+
+    def _crypt(self, header, data):
+        cipher = Cipher(algorithms.AES(self.key), modes.CTR(bytes(header)))
+        ctx = cipher.encryptor()
+        return ctx.update(data) + ctx.finalize()
+
+    def seal(self, packet_type, flags, timestamp, sequence, plaintext, ssrc=None):
+        header = struct.pack(">BBH4sII", packet_type, flags, len(plaintext), ssrc or self.ssrc,
+                             timestamp & 0xFFFFFFFF, sequence & 0xFFFFFFFF)
+        return header + self._crypt(header, plaintext)
+
+    def pack(self, frames, sequence, batch):
+        if batch and len(frames) > 1:
+            payload, timestamp = pack_batch(frames)
+            return self.seal(UDP_TYPE_BATCH, len(frames), timestamp, sequence, payload)
+        opus, timestamp = frames[0]
+        return self.seal(UDP_TYPE_SINGLE, 0, timestamp, sequence, opus)
+
+    def unpack(self, data):
+        """Returns (ssrc, sequence, [(opus, timestamp)]), or None for malformed packets."""
+        if len(data) < UDP_HEADER_SIZE:
+            return None
+        packet_type, flags, size, ssrc, timestamp, sequence = struct.unpack_from(">BBH4sII", data)
+        if packet_type not in (UDP_TYPE_SINGLE, UDP_TYPE_BATCH):
+            return None
+        plaintext = self._crypt(data[:UDP_HEADER_SIZE], data[UDP_HEADER_SIZE:UDP_HEADER_SIZE + size])
+        if packet_type == UDP_TYPE_SINGLE:
+            return ssrc, sequence, [(plaintext, timestamp)]
+        frames = unpack_batch(plaintext, flags, timestamp)
+        return None if frames is None else (ssrc, sequence, frames)
+
+
+def peek_ssrc(data):
+    return data[4:8] if len(data) >= UDP_HEADER_SIZE else None
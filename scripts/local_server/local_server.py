@@ -0,0 +1,619 @@
+"""
+Local stand-in for the xiaozhi server, used to measure latency and throughput without the cloud.
+
+It serves the OTA check (so a real device can be pointed at it), the WebSocket protocol with binary
+versions 1-4 and MQTT+UDP with AES-CTR audio. Every session follows the same script: the uplink is
+counted as one utterance, then stt, llm and a canned TTS Opus stream are sent with scripted timing.
+Loss, jitter and reordering can be injected on the downlink audio. One JSON report line is written
+per session, see README.md.
+"""
+
+import argparse
+import asyncio
+import json
+import os
+import socket
+import sys
+import time
+import uuid
+
+import websockets
+
+import opus_stream
+from framing import TYPE_CBOR, TYPE_JSON, TYPE_OPUS, UdpCrypto, WebsocketFraming, peek_ssrc
+from mqtt_lite import MqttBroker
+from netem import Impairment, SequenceStats, StreamStats, now_ms
+
+REPO_ROOT = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", ".."))
+
+DEFAULT_SCENARIO = {
+    # Uplink frames after "listen start" that count as one utterance in auto and realtime mode,
+    # manual mode waits for "listen stop" instead
+    "utterance_frames": 20,
+    "stt_delay_ms": 200,
+    "stt_text": "今天天气怎么样",
+    # From stt to "tts start", stands in for the LLM and the TTS first packet
+    "first_audio_delay_ms": 300,
+    # Frames sent ahead of real time at the start of each sentence, like a server pre-buffer
+    "lead_frames": 3,
+    "emotion": "happy",
+    "sentences": [
+        {"text": "本地测试服务器", "audio": "main/assets/common/success.ogg"},
+        {"text": "正在回放预置的语音", "audio": "main/assets/common/exclamation.ogg", "gap_ms": 100},
+    ],
+    "reply_to_wake_word": False,
+    # Send initialize and page through tools/list after hello
+    "mcp": True,
+}
+
+
+def load_scenario(path):
+    scenario = dict(DEFAULT_SCENARIO)
+    if path:
+        with open(path, encoding="utf-8") as f:
+            scenario.update(json.load(f))
+    streams = []
+    for sentence in scenario["sentences"]:
+        audio = sentence["audio"]
+        if not os.path.isabs(audio):
+            audio = os.path.join(REPO_ROOT, audio)
+        streams.append((sentence, opus_stream.load(audio)))
+    scenario["streams"] = streams
+    return scenario
+
+
+class Session:
+    """Transport independent part of one audio session."""
+
+    def __init__(self, server, transport, version):
+        self.server = server
+        self.scenario = server.scenario
+        self.transport = transport
+        self.version = version
+        self.session_id = uuid.uuid4().hex[:16]
+        self.batch = False
+        self.frames_per_message = 1
+        self.features = {}
+        self.listen_mode = None
+        self.utterance_frames = 0
+        self.utterance_done = True
+        self.speak_task = None
+        self.mcp_next_id = 1
+        self.mcp_pending = {}
+        self.impairment = Impairment(server.args.loss, server.args.jitter, server.args.reorder, seed=server.args.seed)
+        self.uplink = StreamStats()
+        self.downlink = StreamStats()
+        self.uplink_sequence = SequenceStats()
+        self.qos = False
+        self.qos_prior = (0, 0)
+        self.device_qos = []
+        self.times = {"open": now_ms()}
+        self.report = {"transport": transport, "session_id": self.session_id}
+        self.closed = False
+
+    # Implemented by the transports
+    def send_text(self, text):
+        raise NotImplementedError
+
+    def pack_frames(self, frames):
+        """Build the finished downlink packet, or None when it cannot be sent"""
+        raise NotImplementedError
+
+    def send_packet(self, packet):
+        raise NotImplementedError
+
+    def send_json(self, message):
+        self.send_text(json.dumps(message, ensure_ascii=False))
+
+    def mark(self, name):
+        if name not in self.times:
+            self.times[name] = now_ms()
+
+    def since(self, start, end):
+        if start in self.times and end in self.times:
+            return round(self.times[end] - self.times[start], 1)
+        return None
+
+    def build_hello(self, hello):
+        self.mark("hello")
+        self.features = hello.get("features") or {}
+        params = hello.get("audio_params") or {}
+        self.uplink.frame_duration = params.get("frame_duration", 60)
+        stream = self.scenario["streams"][0][1]
+        reply = {
+            "type": "hello",
+            "transport": self.transport,
+            "session_id": self.session_id,
+            "audio_params": {
+                "format": "opus",
+                "sample_rate": stream.sample_rate,
+                "channels": 1,
+                "frame_duration": stream.frame_duration,
+            },
+        }
+        features = {}
+        if self.server.args.batch_frames > 1 and self.features.get("audio_batch") and self.transport_can_batch():
+            self.batch = True
+            self.frames_per_message = self.server.args.batch_frames
+            features["audio_batch"] = True
+        if self.features.get("qos"):
+            self.qos = True
+            features["qos"] = True
+        if features:
+            reply["features"] = features
+        self.report["version"] = self.version
+        self.report["batch"] = self.batch
+        return reply
+
+    def transport_can_batch(self):
+        return True
+
+    def has_timestamps(self):
+        return True
+
+    def after_hello(self):
+        if self.scenario["mcp"]:
+            self.send_mcp("initialize", {"protocolVersion": "2024-11-05", "capabilities": {}})
+
+    # Device -> server
+    def on_json(self, message):
+        msg_type = message.get("type")
+        if msg_type == "listen":
+            self.on_listen(message)
+        elif msg_type == "abort":
+            self.on_abort(message)
+        elif msg_type == "mcp":
+            self.on_mcp(message.get("payload") or {})
+        elif msg_type == "qos":
+            self.on_qos(message)
+        elif msg_type == "goodbye":
+            self.close("goodbye")
+
+    def on_listen(self, message):
+        state = message.get("state")
+        if state == "detect":
+            self.mark("detect")
+            self.report["wake_word"] = message.get("text")
+            if self.scenario["reply_to_wake_word"]:
+                self.start_speaking()
+        elif state == "start":
+            self.mark("listen")
+            self.listen_mode = message.get("mode", "auto")
+            self.utterance_frames = 0
+            self.utterance_done = False
+        elif state == "stop" and not self.utterance_done:
+            self.utterance_done = True
+            self.start_speaking()
+
+    def on_abort(self, message):
+        self.mark("abort")
+        self.report["abort_reason"] = message.get("reason")
+        if self.speak_task is not None and not self.speak_task.done():
+            self.speak_task.cancel()
+            self.report["abort_after_tts_ms"] = self.since("tts_start", "abort")
+            self.send_json({"session_id": self.session_id, "type": "tts", "state": "stop"})
+
+    def on_audio(self, frames, size):
+        if "listen" in self.times:
+            self.mark("uplink_audio")
+        self.uplink.add(len(frames), size, frames[0][1] if self.has_timestamps() else None)
+        if self.utterance_done:
+            return
+        self.utterance_frames += len(frames)
+        if self.listen_mode != "manual" and self.utterance_frames >= self.scenario["utterance_frames"]:
+            self.utterance_done = True
+            self.start_speaking()
+
+    # QoS receiver reports, answered at once so that dlsr is 0 and the device RTT is the transport round trip
+    def on_qos(self, message):
+        if not self.qos:
+            return
+        self.device_qos.append(message)
+        if message.get("final"):
+            self.report["device_summary"] = message.get("summary")
+        if self.uplink_sequence.received:
+            received = self.uplink_sequence.received
+            expected = self.uplink_sequence.highest
+        else:
+            # WebSocket messages carry no sequence number
+            received = expected = self.uplink.messages
+        prior_expected, prior_received = self.qos_prior
+        self.qos_prior = (expected, received)
+        interval = expected - prior_expected
+        lost_interval = interval - (received - prior_received)
+        reply = {
+            "session_id": self.session_id,
+            "type": "qos",
+            "timestamp": int(now_ms()) & 0xFFFFFFFF,
+            "received": received,
+            "lost": max(0, expected - received),
+            "fraction_lost": min(255, (lost_interval << 8) // interval) if interval > 0 and lost_interval > 0 else 0,
+            "jitter": round(self.uplink.jitter),
+            "lsr": message.get("timestamp", 0),
+            "dlsr": 0,
+        }
+        if self.server.args.max_uplink_bitrate:
+            reply["max_bitrate"] = self.server.args.max_uplink_bitrate
+        self.send_json(reply)
+
+    # MCP, the server side of docs/mcp-protocol.md
+    def send_mcp(self, method, params):
+        request_id = self.mcp_next_id
+        self.mcp_next_id += 1
+        self.mcp_pending[request_id] = (method, now_ms())
+        payload = {"jsonrpc": "2.0", "method": method, "params": params, "id": request_id}
+        self.send_json({"session_id": self.session_id, "type": "mcp", "payload": payload})
+
+    def on_mcp(self, payload):
+        pending = self.mcp_pending.pop(payload.get("id"), None)
+        if pending is None:
+            return
+        method, sent_time = pending
+        elapsed = now_ms() - sent_time
+        result = payload.get("result") or {}
+        if method == "initialize":
+            self.report["mcp_initialize_ms"] = round(elapsed, 1)
+            tools_hash = ((result.get("capabilities") or {}).get("tools") or {}).get("hash")
+            self.report["tools_hash"] = tools_hash
+            if tools_hash and tools_hash in self.server.tools_cache:
+                self.report["tools"] = self.server.tools_cache[tools_hash]
+                self.report["tools_cached"] = True
+                return
+            self.report["tools_list_ms"] = 0
+            self.report["tools"] = 0
+            self.report["tools_pages"] = 0
+            self.send_mcp("tools/list", {"cursor": ""})
+        elif method == "tools/list":
+            self.report["tools_list_ms"] = round(self.report["tools_list_ms"] + elapsed, 1)
+            self.report["tools_pages"] += 1
+            self.report["tools"] += len(result.get("tools") or [])
+            cursor = result.get("nextCursor")
+            if cursor:
+                self.send_mcp("tools/list", {"cursor": cursor})
+            elif self.report.get("tools_hash"):
+                self.server.tools_cache[self.report["tools_hash"]] = self.report["tools"]
+
+    # Server -> device
+    def start_speaking(self):
+        if self.speak_task is None or self.speak_task.done():
+            self.speak_task = asyncio.ensure_future(self.speak())
+
+    async def speak(self):
+        scenario = self.scenario
+        await asyncio.sleep(scenario["stt_delay_ms"] / 1000)
+        self.send_json({"session_id": self.session_id, "type": "stt", "text": scenario["stt_text"]})
+        self.send_json({"session_id": self.session_id, "type": "llm", "emotion": scenario["emotion"], "text": "😀"})
+        await asyncio.sleep(scenario["first_audio_delay_ms"] / 1000)
+        self.mark("tts_start")
+        self.send_json({"session_id": self.session_id, "type": "tts", "state": "start"})
+        timestamp = 0
+        for sentence, stream in scenario["streams"]:
+            await asyncio.sleep(sentence.get("gap_ms", 0) / 1000)
+            self.send_json({"session_id": self.session_id, "type": "tts", "state": "sentence_start",
+                            "text": sentence["text"]})
+            start = now_ms()
+            frames = stream.frames
+            n = self.frames_per_message
+            for i in range(0, len(frames), n):
+                # Frame i is due when it starts playing, minus the pre-buffer
+                due = start + (i - scenario["lead_frames"]) * stream.frame_duration
+                delay = due - now_ms()
+                if delay > 0:
+                    await asyncio.sleep(delay / 1000)
+                chunk = []
+                for frame in frames[i:i + n]:
+                    chunk.append((frame, timestamp))
+                    timestamp += stream.frame_duration
+                self.mark("first_audio")
+                self.downlink.add(len(chunk), sum(len(f) for f, _ in chunk))
+                # Impair the finished packet so dropped and held datagrams keep their sequence numbers
+                packet = self.pack_frames(chunk)
+                if packet is not None:
+                    self.impairment.submit(self.send_packet, packet)
+        self.mark("tts_stop")
+        self.send_json({"session_id": self.session_id, "type": "tts", "state": "stop"})
+
+    def close(self, reason):
+        if self.closed:
+            return
+        self.closed = True
+        if self.speak_task is not None:
+            self.speak_task.cancel()
+        self.mark("close")
+        report = self.report
+        report["close_reason"] = reason
+        report["hello_ms"] = self.since("open", "hello")
+        report["wake_to_first_audio_ms"] = self.since("detect", "first_audio")
+        report["listen_to_first_audio_ms"] = self.since("listen", "first_audio")
+        report["listen_to_uplink_ms"] = self.since("listen", "uplink_audio")
+        report["duration_ms"] = self.since("open", "close")
+        report["uplink"] = self.uplink.to_dict()
+        report["downlink"] = self.downlink.to_dict()
+        if self.device_qos:
+            last = self.device_qos[-1]
+            report["device_qos"] = {
+                "reports": len(self.device_qos),
+                "received": last.get("received"),
+                "lost": last.get("lost"),
+                "jitter_ms": last.get("jitter"),
+                "max_bitrate": min((r["max_bitrate"] for r in self.device_qos if r.get("max_bitrate")), default=None),
+            }
+        if self.impairment.enabled:
+            report["impairment"] = {"sent": self.impairment.sent, "dropped": self.impairment.dropped,
+                                    "reordered": self.impairment.reordered}
+        self.server.write_report({k: v for k, v in report.items() if v is not None})
+
+
+class WebsocketSession(Session):
+    def __init__(self, server, connection, version):
+        super().__init__(server, "websocket", version)
+        self.connection = connection
+        self.framing = WebsocketFraming(version)
+
+    def transport_can_batch(self):
+        # Version 1 frames carry no type, so they cannot switch to BinaryProtocol4
+        return self.version in (2, 3)
+
+    def has_timestamps(self):
+        return self.framing.version in (2, 4)
+
+    def send_text(self, text):
+        asyncio.ensure_future(self._send(text))
+
+    def pack_frames(self, frames):
+        return self.framing.pack(frames)
+
+    def send_packet(self, packet):
+        return self._send(packet)
+
+    async def _send(self, data):
+        try:
+            await self.connection.send(data)
+        except websockets.ConnectionClosed:
+            pass
+
+    async def run(self):
+        async for message in self.connection:
+            if isinstance(message, str):
+                self.on_text(message)
+                continue
+            unpacked = self.framing.unpack(message)
+            if unpacked is None:
+                continue
+            msg_type, body = unpacked
+            if msg_type == TYPE_OPUS:
+                self.on_audio(body, len(message))
+            elif msg_type == TYPE_JSON:
+                self.on_text(body.decode(errors="replace"))
+            elif msg_type == TYPE_CBOR:
+                print("CBOR control messages are not negotiated by the local server", file=sys.stderr)
+
+    def on_text(self, text):
+        try:
+            message = json.loads(text)
+        except json.JSONDecodeError:
+            return
+        if message.get("type") == "hello":
+            reply = self.build_hello(message)
+            self.send_json(reply)
+            if self.batch:
+                self.framing.version = 4
+                self.report["version"] = 4
+            self.after_hello()
+        else:
+            self.on_json(message)
+
+
+class MqttSession(Session):
+    def __init__(self, server, connection, version):
+        super().__init__(server, "udp", version)
+        self.connection = connection
+        self.crypto = UdpCrypto()
+        self.address = None
+        self.sequence = 0
+        self.no_address = 0
+
+    def send_text(self, text):
+        self.connection.publish(f"devices/p2p/{self.connection.client_id}", text.encode())
+
+    def pack_frames(self, frames):
+        if self.address is None:
+            # The device has not sent any audio yet, so its UDP address is unknown
+            self.no_address += 1
+            return None
+        self.sequence += 1
+        return self.crypto.pack(frames, self.sequence, self.batch)
+
+    def send_packet(self, packet):
+        self.server.udp.sendto(packet, self.address)
+
+    def build_hello(self, hello):
+        reply = super().build_hello(hello)
+        reply["udp"] = {
+            "server": self.server.public_host,
+            "port": self.server.args.udp_port,
+            "key": self.crypto.key.hex().upper(),
+            "nonce": self.crypto.nonce.hex().upper(),
+        }
+        return reply
+
+    def on_datagram(self, data, address):
+        if self.address is None:
+            self.mark("udp_ready")
+            self.report["udp_ready_ms"] = self.since("hello", "udp_ready")
+        self.address = address
+        unpacked = self.crypto.unpack(data)
+        if unpacked is not None:
+            self.uplink_sequence.add(unpacked[1])
+            self.on_audio(unpacked[2], len(data))
+
+    def close(self, reason):
+        if self.no_address:
+            self.report["downlink_no_address"] = self.no_address
+        super().close(reason)
+
+
+class UdpEndpoint(asyncio.DatagramProtocol):
+    def __init__(self, server):
+        self.server = server
+
+    def datagram_received(self, data, address):
+        session = self.server.udp_sessions.get(peek_ssrc(data))
+        if session is not None:
+            session.on_datagram(data, address)
+
+
+class LocalServer:
+    def __init__(self, args):
+        self.args = args
+        self.scenario = load_scenario(args.scenario)
+        self.public_host = args.public_host or guess_public_host()
+        self.udp = None
+        self.udp_sessions = {}
+        self.mqtt_sessions = {}
+        self.tools_cache = {}
+        self.report_file = open(args.report, "a", encoding="utf-8") if args.report else None
+
+    def write_report(self, report):
+        line = json.dumps(report, ensure_ascii=False)
+        print(line, flush=True)
+        if self.report_file:
+            self.report_file.write(line + "\n")
+            self.report_file.flush()
+
+    # OTA, enough of the check version response for the device to pick this server
+    def ota_response(self):
+        args = self.args
+        response = {
+            "server_time": {"timestamp": int(time.time() * 1000), "timezone_offset": 480},
+            "firmware": {"version": "0.0.0", "url": ""},
+        }
+        if args.ota_transport == "mqtt":
+            response["mqtt"] = {
+                "endpoint": f"{self.public_host}:{args.mqtt_port}",
+                "client_id": "local",
+                "username": "local",
+                "password": "local",
+                "publish_topic": "device-server",
+            }
+        else:
+            response["websocket"] = {
+                "url": f"ws://{self.public_host}:{args.ws_port}/xiaozhi/v1/",
+                "token": "local",
+                "version": args.ota_version,
+            }
+        return response
+
+    async def handle_http(self, reader, writer):
+        try:
+            request = await reader.readuntil(b"\r\n\r\n")
+            length = 0
+            for line in request.split(b"\r\n"):
+                if line.lower().startswith(b"content-length:"):
+                    length = int(line.split(b":")[1])
+            if length:
+                await reader.readexactly(length)
+            body = json.dumps(self.ota_response()).encode()
+            writer.write(b"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                         b"Content-Length: " + str(len(body)).encode() + b"\r\nConnection: close\r\n\r\n" + body)
+            await writer.drain()
+        except (asyncio.IncompleteReadError, asyncio.LimitOverrunError, ConnectionError):
+            pass
+        finally:
+            writer.close()
+
+    async def handle_websocket(self, connection):
+        headers = connection.request.headers
+        version = int(headers.get("Protocol-Version", "1") or 1)
+        session = WebsocketSession(self, connection, version)
+        session.report["device_id"] = headers.get("Device-Id")
+        try:
+            await session.run()
+        except websockets.ConnectionClosed:
+            pass
+        session.close("disconnected")
+
+    def on_mqtt_publish(self, connection, topic, payload):
+        try:
+            message = json.loads(payload)
+        except (json.JSONDecodeError, UnicodeDecodeError):
+            return
+        session = self.mqtt_sessions.get(connection.client_id)
+        if message.get("type") == "hello":
+            if session is not None:
+                self.end_mqtt_session(session, "replaced")
+            session = MqttSession(self, connection, message.get("version", 3))
+            session.report["device_id"] = connection.client_id
+            self.mqtt_sessions[connection.client_id] = session
+            self.udp_sessions[session.crypto.ssrc] = session
+            session.send_json(session.build_hello(message))
+            session.after_hello()
+        elif session is not None:
+            session.on_json(message)
+            if session.closed:
+                self.end_mqtt_session(session, "goodbye")
+
+    def on_mqtt_disconnect(self, connection):
+        session = self.mqtt_sessions.get(connection.client_id)
+        if session is not None and session.connection is connection:
+            self.end_mqtt_session(session, "disconnected")
+
+    def end_mqtt_session(self, session, reason):
+        self.mqtt_sessions.pop(session.connection.client_id, None)
+        self.udp_sessions.pop(session.crypto.ssrc, None)
+        session.close(reason)
+
+    async def run(self):
+        args = self.args
+        loop = asyncio.get_running_loop()
+        self.udp, _ = await loop.create_datagram_endpoint(lambda: UdpEndpoint(self), local_addr=(args.host, args.udp_port))
+        await asyncio.start_server(self.handle_http, args.host, args.http_port)
+        await MqttBroker(on_publish=self.on_mqtt_publish, on_disconnect=self.on_mqtt_disconnect).serve(args.host, args.mqtt_port)
+        async with websockets.serve(self.handle_websocket, args.host, args.ws_port, max_size=None):
+            print(f"OTA:       http://{self.public_host}:{args.http_port}/xiaozhi/ota/ ({args.ota_transport})")
+            print(f"WebSocket: ws://{self.public_host}:{args.ws_port}/xiaozhi/v1/")
+            print(f"MQTT:      {self.public_host}:{args.mqtt_port}, UDP: {args.udp_port}")
+            await asyncio.Future()
+
+
+def guess_public_host():
+    # No packet is sent, connect() only picks the interface of the default route
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+        try:
+            s.connect(("8.8.8.8", 80))
+            return s.getsockname()[0]
+        except OSError:
+            return "127.0.0.1"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="小智本地测试服务器，用于端到端延迟和吞吐量测试")
+    parser.add_argument("--host", default="0.0.0.0", help="监听地址 (默认: 0.0.0.0)")
+    parser.add_argument("--public-host", help="下发给设备的服务器地址 (默认: 自动检测)")
+    parser.add_argument("--http-port", type=int, default=8002, help="OTA 端口 (默认: 8002)")
+    parser.add_argument("--ws-port", type=int, default=8000, help="WebSocket 端口 (默认: 8000)")
+    parser.add_argument("--mqtt-port", type=int, default=1883, help="MQTT 端口 (默认: 1883)")
+    parser.add_argument("--udp-port", type=int, default=8888, help="UDP 音频端口 (默认: 8888)")
+    parser.add_argument("--ota-transport", choices=["websocket", "mqtt"], default="websocket",
+                        help="OTA 响应中下发的协议 (默认: websocket)")
+    parser.add_argument("--ota-version", type=int, choices=[1, 2, 3], default=1,
+                        help="OTA 下发的 WebSocket 二进制协议版本 (默认: 1)")
+    parser.add_argument("--batch-frames", type=int, default=1,
+                        help="设备声明 audio_batch 时每条下行消息的帧数，1 表示不接受合并 (默认: 1)")
+    parser.add_argument("--scenario", help="场景 JSON 文件，覆盖默认的时序和 TTS 音频")
+    parser.add_argument("--loss", type=float, default=0.0, help="下行音频丢包率 0-1")
+    parser.add_argument("--jitter", type=float, default=0, help="下行音频附加抖动上限 (毫秒)")
+    parser.add_argument("--reorder", type=float, default=0.0, help="下行音频乱序概率 0-1")
+    parser.add_argument("--seed", type=int, help="损伤随机数种子")
+    parser.add_argument("--max-uplink-bitrate", type=int, default=0,
+                        help="协商 qos 后在接收报告中要求设备的上行码率上限 (bps)")
+    parser.add_argument("--report", help="追加写入每个会话报告 (JSON lines) 的文件")
+    args = parser.parse_args()
+    try:
+        asyncio.run(LocalServer(args).run())
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,201 @@
+"""
+Just enough MQTT 3.1.1 for the local server: QoS 0/1 publish, subscribe, ping. No retained
+messages, wills or sessions. Like the production broker, messages for a device are pushed to
+its connection directly, the device does not need to subscribe.
+"""
+
+import asyncio
+import struct
+
+CONNECT = 1
+CONNACK = 2
+PUBLISH = 3
+PUBACK = 4
+SUBSCRIBE = 8
+SUBACK = 9
+PINGREQ = 12
+PINGRESP = 13
+DISCONNECT = 14
+
+
+def _encode_length(n):
+    out = bytearray()
+    while True:
+        byte = n % 128
+        n //= 128
+        out.append(byte | 0x80 if n > 0 else byte)
+        if n == 0:
+            return bytes(out)
+
+
+def _string(s):
+    data = s.encode() if isinstance(s, str) else s
+    return struct.pack(">H", len(data)) + data
+
+
+def packet(packet_type, flags, body):
+    return bytes([(packet_type << 4) | flags]) + _encode_length(len(body)) + body
+
+
+def publish_packet(topic, payload, qos=0, packet_id=1):
+    body = _string(topic)
+    if qos > 0:
+        body += struct.pack(">H", packet_id)
+    return packet(PUBLISH, qos << 1, body + payload)
+
+
+async def read_packet(reader):
+    """Returns (type, flags, body), raises asyncio.IncompleteReadError when the peer closes."""
+    first = (await reader.readexactly(1))[0]
+    length = 0
+    multiplier = 1
+    for _ in range(4):
+        byte = (await reader.readexactly(1))[0]
+        length += (byte & 0x7F) * multiplier
+        if byte < 0x80:
+            break
+        multiplier *= 128
+    body = await reader.readexactly(length) if length else b""
+    return first >> 4, first & 0x0F, body
+
+
+def parse_publish(flags, body):
+    """Returns (topic, packet_id or None, payload)."""
+    topic_len = struct.unpack_from(">H", body)[0]
+    topic = body[2:2 + topic_len].decode(errors="replace")
+    offset = 2 + topic_len
+    packet_id = None
+    if (flags >> 1) & 0x03:
+        packet_id = struct.unpack_from(">H", body, offset)[0]
+        offset += 2
+    return topic, packet_id, body[offset:]
+
+
+class BrokerConnection:
+    def __init__(self, writer):
+        self.writer = writer
+        self.client_id = ""
+        self.username = ""
+
+    def publish(self, topic, payload):
+        if not self.writer.is_closing():
+            self.writer.write(publish_packet(topic, payload))
+
+    def close(self):
+        self.writer.close()
+
+
+class MqttBroker:
+    """Calls on_connect(conn), on_publish(conn, topic, payload) and on_disconnect(conn)."""
+
+    def __init__(self, on_connect=None, on_publish=None, on_disconnect=None):
+        self.on_connect = on_connect
+        self.on_publish = on_publish
+        self.on_disconnect = on_disconnect
+
+    async def serve(self, host, port):
+        return await asyncio.start_server(self._handle, host, port)
+
+    async def _handle(self, reader, writer):
+        conn = BrokerConnection(writer)
+        try:
+            packet_type, _, body = await read_packet(reader)
+            if packet_type != CONNECT:
+                return
+            self._parse_connect(conn, body)
+            writer.write(packet(CONNACK, 0, b"\x00\x00"))
+            if self.on_connect:
+                self.on_connect(conn)
+            while True:
+                packet_type, flags, body = await read_packet(reader)
+                if packet_type == PUBLISH:
+                    topic, packet_id, payload = parse_publish(flags, body)
+                    if packet_id is not None:
+                        writer.write(packet(PUBACK, 0, struct.pack(">H", packet_id)))
+                    if self.on_publish:
+                        self.on_publish(conn, topic, payload)
+                elif packet_type == SUBSCRIBE:
+                    packet_id = struct.unpack_from(">H", body)[0]
+                    count = 0
+                    offset = 2
+                    while offset < len(body):
+                        offset += 2 + struct.unpack_from(">H", body, offset)[0] + 1
+                        count += 1
+                    writer.write(packet(SUBACK, 0, struct.pack(">H", packet_id) + b"\x00" * count))
+                elif packet_type == PINGREQ:
+                    writer.write(packet(PINGRESP, 0, b""))
+                elif packet_type == DISCONNECT:
+                    break
+        except (asyncio.IncompleteReadError, ConnectionError, struct.error):
+            pass
+        finally:
+            if self.on_disconnect and conn.client_id:
+                self.on_disconnect(conn)
+            writer.close()
+
+    @staticmethod
+    def _parse_connect(conn, body):
+        offset = 2 + struct.unpack_from(">H", body)[0] + 1  # Protocol name, level
+        connect_flags = body[offset]
+        offset += 3  # Flags, keepalive
+
+        def take():
+            nonlocal offset
+            n = struct.unpack_from(">H", body, offset)[0]
+            value = body[offset + 2:offset + 2 + n]
+            offset += 2 + n
+            return value
+
+        conn.client_id = take().decode(errors="replace")
+        if connect_flags & 0x04:  # Will topic and message
+            take()
+            take()
+        if connect_flags & 0x80:
+            conn.username = take().decode(errors="replace")
+
+
+class MqttClient:
+    """Client side for the bench client, messages are delivered to on_message(topic, payload)."""
+
+    def __init__(self, on_message=None):
+        self.on_message = on_message
+        self.reader = None
+        self.writer = None
+        self._task = None
+
+    async def connect(self, host, port, client_id, username="", password="", keepalive=240):
+        self.reader, self.writer = await asyncio.open_connection(host, port)
+        flags = 0x02
+        payload = _string(client_id)
+        if username:
+            flags |= 0x80
+            payload += _string(username)
+        if password:
+            flags |= 0x40
+            payload += _string(password)
+        body = _string("MQTT") + bytes([4, flags]) + struct.pack(">H", keepalive) + payload
+        self.writer.write(packet(CONNECT, 0, body))
+        packet_type, _, body = await read_packet(self.reader)
+        if packet_type != CONNACK or body[1] != 0:
+            raise ConnectionError("MQTT connection refused")
+        self._task = asyncio.ensure_future(self._read_loop())
+
+    async def _read_loop(self):
+        try:
+            while True:
+                packet_type, flags, body = await read_packet(self.reader)
+                if packet_type == PUBLISH and self.on_message:
+                    topic, _, payload = parse_publish(flags, body)
+                    self.on_message(topic, payload)
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+
+    def publish(self, topic, payload):
+        self.writer.write(publish_packet(topic, payload))
+
+    async def close(self):
+        if self.writer is not None:
+            self.writer.write(packet(DISCONNECT, 0, b""))
+            self.writer.close()
+        if self._task is not None:
+            self._task.cancel()
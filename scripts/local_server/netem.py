@@ -0,0 +1,127 @@
+"""
+Downlink impairment (loss, jitter, reordering) and the per-session statistics of the local server.
+"""
+
+import asyncio
+import inspect
+import random
+import time
+
+
+def now_ms():
+    return time.monotonic() * 1000
+
+
+class Impairment:
+    """
+    Delays or drops outgoing audio messages before they reach the transport.
+
+    loss     probability of dropping a message
+    jitter   extra delay drawn uniformly from [0, jitter] ms
+    reorder  probability of holding a message for `hold` ms so the following ones overtake it
+    """
+
+    def __init__(self, loss=0.0, jitter=0, reorder=0.0, hold=120, seed=None):
+        self.loss = loss
+        self.jitter = jitter
+        self.reorder = reorder
+        self.hold = hold
+        self.random = random.Random(seed)
+        self.sent = 0
+        self.dropped = 0
+        self.reordered = 0
+
+    @property
+    def enabled(self):
+        return self.loss > 0 or self.jitter > 0 or self.reorder > 0
+
+    def submit(self, send, packet):
+        """`send` may be a plain function or a coroutine function."""
+        if self.loss > 0 and self.random.random() < self.loss:
+            self.dropped += 1
+            return
+        self.sent += 1
+        delay = self.random.uniform(0, self.jitter) if self.jitter > 0 else 0
+        if self.reorder > 0 and self.random.random() < self.reorder:
+            self.reordered += 1
+            delay += self.hold
+        if delay == 0:
+            self._deliver(send, packet)
+        else:
+            asyncio.get_running_loop().call_later(delay / 1000, self._deliver, send, packet)
+
+    @staticmethod
+    def _deliver(send, packet):
+        result = send(packet)
+        if inspect.isawaitable(result):
+            asyncio.ensure_future(result)
+
+
+class StreamStats:
+    """Message counts, bytes and RFC 3550 interarrival jitter of one audio direction."""
+
+    def __init__(self, frame_duration=60):
+        self.frame_duration = frame_duration
+        self.messages = 0
+        self.frames = 0
+        self.bytes = 0
+        self.first_time = None
+        self.last_time = None
+        self.jitter = 0.0
+        self.jitter_samples = 0
+        self._last_transit = None
+
+    def add(self, frame_count, size, timestamp=None):
+        t = now_ms()
+        if self.first_time is None:
+            self.first_time = t
+        self.last_time = t
+        self.messages += 1
+        self.frames += frame_count
+        self.bytes += size
+        if timestamp is not None:
+            transit = t - timestamp
+            if self._last_transit is not None:
+                self.jitter_samples += 1
+                self.jitter += (abs(transit - self._last_transit) - self.jitter) / 16
+            self._last_transit = transit
+
+    def to_dict(self):
+        elapsed = (self.last_time - self.first_time) if self.messages > 1 else 0
+        return {
+            "messages": self.messages,
+            "frames": self.frames,
+            "bytes": self.bytes,
+            "kbps": round(self.bytes * 8 / elapsed, 1) if elapsed > 0 else 0,
+            # Versions 1 and 3 of the WebSocket framing carry no timestamps
+            "jitter_ms": round(self.jitter, 1) if self.jitter_samples else None,
+        }
+
+
+class SequenceStats:
+    """Loss and reordering of the sequence numbered UDP downlink."""
+
+    def __init__(self):
+        self.highest = 0
+        self.received = 0
+        self.reordered = 0
+        self.duplicate = 0
+        self._seen = set()
+
+    def add(self, sequence):
+        if sequence in self._seen:
+            self.duplicate += 1
+            return
+        self._seen.add(sequence)
+        self.received += 1
+        if sequence < self.highest:
+            self.reordered += 1
+        self.highest = max(self.highest, sequence)
+
+    def to_dict(self):
+        return {
+            "received": self.received,
+            "lost": max(0, self.highest - self.received),
+            "reordered": self.reordered,
+            "duplicate": self.duplicate,
+        }
@@ -0,0 +1,92 @@
+"""
+Canned Opus streams for the TTS replay: Ogg Opus files (main/assets) and P3 files (scripts/p3_tools).
+"""
+
+import struct
+
+# Frame sizes in units of 2.5 ms, indexed by the TOC config number (RFC 6716 §3.1)
+_SILK_SIZES = [4, 8, 16, 24]
+_HYBRID_SIZES = [4, 8]
+_CELT_SIZES = [1, 2, 4, 8]
+
+
+def packet_duration_ms(packet):
+    """Duration of an Opus packet from its TOC byte, 0 if it cannot be determined."""
+    if not packet:
+        return 0
+    toc = packet[0]
+    config = toc >> 3
+    if config < 12:
+        frame = _SILK_SIZES[config % 4]
+    elif config < 16:
+        frame = _HYBRID_SIZES[config % 2]
+    else:
+        frame = _CELT_SIZES[config % 4]
+    code = toc & 0x03
+    if code == 0:
+        count = 1
+    elif code in (1, 2):
+        count = 2
+    else:
+        count = packet[1] & 0x3F if len(packet) > 1 else 0
+    return frame * count * 2.5
+
+
+class OpusStream:
+    def __init__(self, name, frames, sample_rate, frame_duration):
+        self.name = name
+        self.frames = frames
+        self.sample_rate = sample_rate
+        self.frame_duration = frame_duration
+
+    @property
+    def duration_ms(self):
+        return len(self.frames) * self.frame_duration
+
+
+def read_ogg(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    packets = []
+    pending = b""
+    offset = 0
+    while offset + 27 <= len(data):
+        if data[offset:offset + 4] != b"OggS":
+            raise ValueError(f"{path}: bad Ogg page at {offset}")
+        segments = data[offset + 26]
+        table = data[offset + 27:offset + 27 + segments]
+        body = offset + 27 + segments
+        for lacing in table:
+            pending += data[body:body + lacing]
+            body += lacing
+            if lacing < 255:
+                packets.append(pending)
+                pending = b""
+        offset = body
+    if len(packets) < 2 or not packets[0].startswith(b"OpusHead"):
+        raise ValueError(f"{path}: not an Ogg Opus file")
+    sample_rate = struct.unpack_from("<I", packets[0], 12)[0] or 48000
+    frames = packets[2:]  # Skip OpusHead and OpusTags
+    return OpusStream(path, frames, sample_rate, _frame_duration(frames))
+
+
+def read_p3(path, sample_rate=16000):
+    # |type 1|reserved 1|length 2 (big endian)|opus ...|
+    with open(path, "rb") as f:
+        data = f.read()
+    frames = []
+    offset = 0
+    while offset + 4 <= len(data):
+        length = struct.unpack_from(">H", data, offset + 2)[0]
+        frames.append(data[offset + 4:offset + 4 + length])
+        offset += 4 + length
+    return OpusStream(path, frames, sample_rate, _frame_duration(frames))
+
+
+def _frame_duration(frames):
+    durations = [packet_duration_ms(f) for f in frames[:8] if f]
+    return int(max(durations)) if durations else 60
+
+
+def load(path):
+    return read_p3(path) if path.lower().endswith(".p3") else read_ogg(path)